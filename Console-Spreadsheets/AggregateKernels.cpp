@@ -0,0 +1,321 @@
+#include "AggregateKernels.h"
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define AGGREGATE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AGGREGATE_AVX2
+#else
+#define AGGREGATE_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Numeric lanes are read as a plain array of doubles
+static_assert(sizeof(CellPayload) == sizeof(double), "CellPayload must be exactly one double wide");
+
+typedef void (*FoldKernel)(const double* values, uint64_t mask, size_t laneCount, double& sum, double& max);
+typedef uint64_t (*CompareKernel)(const double* values, size_t laneCount, CompareOp op, double value);
+
+static uint64_t lowLanes(size_t laneCount) {
+    return laneCount >= 64 ? ~0ULL : (1ULL << laneCount) - 1;
+}
+
+static void foldScalar(const double* values, uint64_t mask, size_t laneCount, double& sum, double& max) {
+    for (size_t i = 0; i < laneCount; i++) {
+        if ((mask >> i) & 1) {
+            if (values[i] > max) {
+                max = values[i];
+            }
+            sum += values[i];
+        }
+    }
+}
+
+// Each comparison gets its own loop, so the compiler can vectorize it too
+template<typename Holds>
+static uint64_t compareWith(const double* values, size_t laneCount, Holds holds) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < laneCount; i++) {
+        bits |= static_cast<uint64_t>(holds(values[i])) << i;
+    }
+    return bits;
+}
+
+static uint64_t compareScalar(const double* values, size_t laneCount, CompareOp op, double value) {
+    switch (op) {
+    case CompareOp::EQUAL:
+        return compareWith(values, laneCount, [value](double x) { return x == value; });
+    case CompareOp::NOT_EQUAL:
+        return compareWith(values, laneCount, [value](double x) { return x != value; });
+    case CompareOp::LESS:
+        return compareWith(values, laneCount, [value](double x) { return x < value; });
+    case CompareOp::LESS_EQUAL:
+        return compareWith(values, laneCount, [value](double x) { return x <= value; });
+    case CompareOp::GREATER:
+        return compareWith(values, laneCount, [value](double x) { return x > value; });
+    default:
+        return compareWith(values, laneCount, [value](double x) { return x >= value; });
+    }
+}
+
+#ifdef AGGREGATE_X86
+
+template<CompareOp Op>
+static __m128d compareSse2Lanes(__m128d x, __m128d key) {
+    switch (Op) {
+    case CompareOp::EQUAL:
+        return _mm_cmpeq_pd(x, key);
+    case CompareOp::NOT_EQUAL:
+        return _mm_cmpneq_pd(x, key);
+    case CompareOp::LESS:
+        return _mm_cmplt_pd(x, key);
+    case CompareOp::LESS_EQUAL:
+        return _mm_cmple_pd(x, key);
+    case CompareOp::GREATER:
+        return _mm_cmpgt_pd(x, key);
+    default:
+        return _mm_cmpge_pd(x, key);
+    }
+}
+
+template<CompareOp Op>
+static uint64_t compareSse2With(const double* values, size_t laneCount, double value) {
+    const __m128d key = _mm_set1_pd(value);
+    uint64_t bits = 0;
+    size_t i = 0;
+    for (; i + 2 <= laneCount; i += 2) {
+        bits |= static_cast<uint64_t>(_mm_movemask_pd(compareSse2Lanes<Op>(_mm_loadu_pd(values + i), key))) << i;
+    }
+    if (i < laneCount) {
+        bits |= compareScalar(values + i, laneCount - i, Op, value) << i;
+    }
+    return bits;
+}
+
+static uint64_t compareSse2(const double* values, size_t laneCount, CompareOp op, double value) {
+    switch (op) {
+    case CompareOp::EQUAL:
+        return compareSse2With<CompareOp::EQUAL>(values, laneCount, value);
+    case CompareOp::NOT_EQUAL:
+        return compareSse2With<CompareOp::NOT_EQUAL>(values, laneCount, value);
+    case CompareOp::LESS:
+        return compareSse2With<CompareOp::LESS>(values, laneCount, value);
+    case CompareOp::LESS_EQUAL:
+        return compareSse2With<CompareOp::LESS_EQUAL>(values, laneCount, value);
+    case CompareOp::GREATER:
+        return compareSse2With<CompareOp::GREATER>(values, laneCount, value);
+    default:
+        return compareSse2With<CompareOp::GREATER_EQUAL>(values, laneCount, value);
+    }
+}
+
+static void foldSse2(const double* values, uint64_t mask, size_t laneCount, double& sum, double& max) {
+    const __m128d negativeInfinity = _mm_set1_pd(-HUGE_VAL);
+    const __m128d laneMasks[4] = {
+        _mm_castsi128_pd(_mm_set_epi64x(0, 0)),
+        _mm_castsi128_pd(_mm_set_epi64x(0, -1)),
+        _mm_castsi128_pd(_mm_set_epi64x(-1, 0)),
+        _mm_castsi128_pd(_mm_set_epi64x(-1, -1))
+    };
+
+    __m128d sums = _mm_setzero_pd();
+    __m128d maxes = negativeInfinity;
+    size_t i = 0;
+    for (; i + 2 <= laneCount; i += 2) {
+        unsigned bits = static_cast<unsigned>((mask >> i) & 3);
+        if (bits == 0) {
+            continue;
+        }
+
+        __m128d x = _mm_loadu_pd(values + i);
+        if (bits != 3) {
+            // Dropped lanes add zero and take part in the max as -inf
+            __m128d keep = laneMasks[bits];
+            maxes = _mm_max_pd(maxes, _mm_or_pd(_mm_and_pd(keep, x), _mm_andnot_pd(keep, negativeInfinity)));
+            x = _mm_and_pd(keep, x);
+        }
+        else {
+            maxes = _mm_max_pd(maxes, x);
+        }
+        sums = _mm_add_pd(sums, x);
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, sums);
+    sum += lanes[0] + lanes[1];
+    _mm_storeu_pd(lanes, maxes);
+    if (lanes[0] > max) max = lanes[0];
+    if (lanes[1] > max) max = lanes[1];
+
+    if (i < laneCount) {
+        foldScalar(values + i, mask >> i, laneCount - i, sum, max);
+    }
+}
+
+AGGREGATE_AVX2
+static __m256d avx2LaneMask(uint64_t bits) {
+    const __m256i laneBits = _mm256_set_epi64x(8, 4, 2, 1);
+    __m256i selected = _mm256_and_si256(_mm256_set1_epi64x(static_cast<long long>(bits)), laneBits);
+    return _mm256_castsi256_pd(_mm256_cmpeq_epi64(selected, laneBits));
+}
+
+AGGREGATE_AVX2
+static void foldAvx2(const double* values, uint64_t mask, size_t laneCount, double& sum, double& max) {
+    const __m256d negativeInfinity = _mm256_set1_pd(-HUGE_VAL);
+
+    // Two accumulators hide the latency of the adds
+    __m256d sums0 = _mm256_setzero_pd();
+    __m256d sums1 = _mm256_setzero_pd();
+    __m256d maxes0 = negativeInfinity;
+    __m256d maxes1 = negativeInfinity;
+    size_t i = 0;
+    for (; i + 8 <= laneCount; i += 8) {
+        unsigned bits = static_cast<unsigned>((mask >> i) & 0xFF);
+        if (bits == 0) {
+            continue;
+        }
+
+        __m256d x0 = _mm256_loadu_pd(values + i);
+        __m256d x1 = _mm256_loadu_pd(values + i + 4);
+        if (bits == 0xFF) {
+            sums0 = _mm256_add_pd(sums0, x0);
+            sums1 = _mm256_add_pd(sums1, x1);
+            maxes0 = _mm256_max_pd(maxes0, x0);
+            maxes1 = _mm256_max_pd(maxes1, x1);
+            continue;
+        }
+
+        __m256d keep0 = avx2LaneMask(bits & 0xF);
+        __m256d keep1 = avx2LaneMask(bits >> 4);
+        sums0 = _mm256_add_pd(sums0, _mm256_and_pd(keep0, x0));
+        sums1 = _mm256_add_pd(sums1, _mm256_and_pd(keep1, x1));
+        maxes0 = _mm256_max_pd(maxes0, _mm256_blendv_pd(negativeInfinity, x0, keep0));
+        maxes1 = _mm256_max_pd(maxes1, _mm256_blendv_pd(negativeInfinity, x1, keep1));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(sums0, sums1));
+    sum += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, _mm256_max_pd(maxes0, maxes1));
+    for (int lane = 0; lane < 4; lane++) {
+        if (lanes[lane] > max) max = lanes[lane];
+    }
+
+    if (i < laneCount) {
+        foldScalar(values + i, mask >> i, laneCount - i, sum, max);
+    }
+}
+
+// The predicate of _mm256_cmp_pd has to be a constant, hence one loop per comparison
+template<int Predicate>
+AGGREGATE_AVX2
+static uint64_t compareAvx2With(const double* values, size_t laneCount, CompareOp op, double value) {
+    const __m256d key = _mm256_set1_pd(value);
+    uint64_t bits = 0;
+    size_t i = 0;
+    for (; i + 8 <= laneCount; i += 8) {
+        unsigned low = static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(values + i), key, Predicate)));
+        unsigned high = static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(values + i + 4), key, Predicate)));
+        bits |= static_cast<uint64_t>(low | (high << 4)) << i;
+    }
+    if (i < laneCount) {
+        bits |= compareScalar(values + i, laneCount - i, op, value) << i;
+    }
+    return bits;
+}
+
+AGGREGATE_AVX2
+static uint64_t compareAvx2(const double* values, size_t laneCount, CompareOp op, double value) {
+    switch (op) {
+    case CompareOp::EQUAL:
+        return compareAvx2With<_CMP_EQ_OQ>(values, laneCount, op, value);
+    case CompareOp::NOT_EQUAL:
+        return compareAvx2With<_CMP_NEQ_UQ>(values, laneCount, op, value);
+    case CompareOp::LESS:
+        return compareAvx2With<_CMP_LT_OQ>(values, laneCount, op, value);
+    case CompareOp::LESS_EQUAL:
+        return compareAvx2With<_CMP_LE_OQ>(values, laneCount, op, value);
+    case CompareOp::GREATER:
+        return compareAvx2With<_CMP_GT_OQ>(values, laneCount, op, value);
+    default:
+        return compareAvx2With<_CMP_GE_OQ>(values, laneCount, op, value);
+    }
+}
+
+static bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+struct KernelChoice {
+    FoldKernel fold;
+    CompareKernel compare;
+    const char* name;
+};
+
+static const KernelChoice& chooseKernel() {
+#ifdef AGGREGATE_X86
+    // SSE2 is part of every x64 CPU and of the x86 baseline MSVC targets
+    static const KernelChoice choice = cpuHasAvx2()
+        ? KernelChoice{ &foldAvx2, &compareAvx2, "AVX2" }
+        : KernelChoice{ &foldSse2, &compareSse2, "SSE2" };
+#else
+    static const KernelChoice choice = { &foldScalar, &compareScalar, "scalar" };
+#endif
+    return choice;
+}
+
+void AggregateKernels::foldLanes(const CellPayload* payload, uint64_t mask, size_t laneCount, NumberAggregate& aggregate) {
+    mask &= lowLanes(laneCount);
+    if (mask == 0) {
+        return;
+    }
+
+    double sum = 0.0;
+    double max = -HUGE_VAL;
+    chooseKernel().fold(&payload[0].number, mask, laneCount, sum, max);
+
+    NumberAggregate strip;
+    strip.sum = sum;
+    strip.max = max;
+    strip.count = countLanes(mask, laneCount);
+    aggregate.merge(strip);
+}
+
+uint64_t AggregateKernels::compareLanes(const CellPayload* payload, uint64_t mask, size_t laneCount, CompareOp op, double value) {
+    // Lanes that hold no number are compared too, their bits are masked off
+    mask &= lowLanes(laneCount);
+    if (mask == 0) {
+        return 0;
+    }
+    return chooseKernel().compare(&payload[0].number, laneCount, op, value) & mask;
+}
+
+size_t AggregateKernels::countLanes(uint64_t mask, size_t laneCount) {
+    mask &= lowLanes(laneCount);
+
+    // Parallel bit count
+    mask = mask - ((mask >> 1) & 0x5555555555555555ULL);
+    mask = (mask & 0x3333333333333333ULL) + ((mask >> 2) & 0x3333333333333333ULL);
+    mask = (mask + (mask >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<size_t>((mask * 0x0101010101010101ULL) >> 56);
+}
+
+const char* AggregateKernels::getKernelName() {
+    return chooseKernel().name;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "CellStorage.h"
+
+// Sum, max and count of the numbers folded so far
+struct NumberAggregate {
+    double sum;
+    double max;
+    size_t count;
+
+    NumberAggregate() : sum(0.0), max(0.0), count(0) {}
+
+    void add(double value) {
+        if (count == 0 || value > max) {
+            max = value;
+        }
+        sum += value;
+        count++;
+    }
+
+    void merge(const NumberAggregate& other) {
+        if (other.count > 0 && (count == 0 || other.max > max)) {
+            max = other.max;
+        }
+        sum += other.sum;
+        count += other.count;
+    }
+};
+
+// Comparison a lane kernel applies between each lane and a value
+enum class CompareOp : unsigned char {
+    EQUAL,
+    NOT_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL
+};
+
+// Vectorized reductions over column strips. The widest kernel the CPU
+// supports (AVX2, SSE2 or plain scalar code) is picked on first use.
+class AggregateKernels {
+public:
+    // Folds the numbers of the first laneCount lanes whose bit is set in mask
+    static void foldLanes(const CellPayload* payload, uint64_t mask, size_t laneCount, NumberAggregate& aggregate);
+
+    // Bits of the lanes among mask's first laneCount whose number compares to value as op says
+    static uint64_t compareLanes(const CellPayload* payload, uint64_t mask, size_t laneCount, CompareOp op, double value);
+
+    // Number of set bits among the first laneCount lanes
+    static size_t countLanes(uint64_t mask, size_t laneCount);
+
+    // "AVX2", "SSE2" or "scalar"
+    static const char* getKernelName();
+};
@@ -1,11 +1,18 @@
 #pragma once
 #include "MyString.h"
+#include "CellKind.h"
 
 class BaseCell {
 public:
     virtual ~BaseCell() = default;
     virtual MyString toString() const = 0;
     virtual double evaluate() const = 0;
+    // Display name of the cell class; use getKind() for type checks
     virtual MyString getType() const = 0;
+    virtual CellKind getKind() const = 0;
     virtual BaseCell* clone() const = 0;
+
+    bool isNumeric() const {
+        return isNumericKind(getKind());
+    }
 };
\ No newline at end of file
@@ -0,0 +1,287 @@
+#include "BufferedIO.h"
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const size_t LineReader::BLOCK_SIZE;
+const size_t BufferedWriter::BLOCK_SIZE;
+
+LineReader::LineReader(const char* path)
+    : file(path, std::ios::in | std::ios::binary), buffer(nullptr), capacity(0), start(0), end(0), exhausted(false) {
+    if (file.is_open()) {
+        buffer = new char[BLOCK_SIZE];
+        capacity = BLOCK_SIZE;
+    }
+}
+
+LineReader::~LineReader() {
+    delete[] buffer;
+}
+
+bool LineReader::isOpen() const {
+    return buffer != nullptr;
+}
+
+bool LineReader::fill() {
+    if (exhausted) {
+        return false;
+    }
+
+    if (start > 0) {
+        memmove(buffer, buffer + start, end - start);
+        end -= start;
+        start = 0;
+    }
+    // One byte always stays free for the terminator of a last line without \n
+    if (end + 1 >= capacity) {
+        char* grown = new char[capacity * 2];
+        memcpy(grown, buffer, end);
+        delete[] buffer;
+        buffer = grown;
+        capacity *= 2;
+    }
+
+    file.read(buffer + end, static_cast<std::streamsize>(capacity - 1 - end));
+    size_t received = static_cast<size_t>(file.gcount());
+    end += received;
+    if (received == 0) {
+        exhausted = true;
+        return false;
+    }
+    return true;
+}
+
+bool LineReader::next(char*& line, size_t& length) {
+    if (buffer == nullptr) {
+        return false;
+    }
+
+    // Only the bytes not searched yet are scanned after a refill
+    size_t searched = start;
+    char* newline = nullptr;
+    while ((newline = static_cast<char*>(memchr(buffer + searched, '\n', end - searched))) == nullptr) {
+        size_t offset = end - start;
+        if (!fill()) {
+            break;
+        }
+        searched = start + offset;
+    }
+
+    if (newline == nullptr && start == end) {
+        return false;
+    }
+
+    size_t lineEnd = newline != nullptr ? static_cast<size_t>(newline - buffer) : end;
+    line = buffer + start;
+    length = lineEnd - start;
+    start = newline != nullptr ? lineEnd + 1 : end;
+
+    if (length > 0 && line[length - 1] == '\r') {
+        length--;
+    }
+    line[length] = '\0';
+    return true;
+}
+
+bool LineReader::parseUnsigned(const char*& cursor, const char* end, size_t& value) {
+    const char* digits = cursor;
+    value = 0;
+    while (cursor < end && *cursor >= '0' && *cursor <= '9') {
+        value = value * 10 + static_cast<size_t>(*cursor - '0');
+        cursor++;
+    }
+    return cursor != digits;
+}
+
+BufferedWriter::BufferedWriter(const char* path)
+    : file(path, std::ios::out | std::ios::binary | std::ios::trunc), buffer(nullptr), used(0), failed(false), written(0) {
+    if (file.is_open()) {
+        buffer = new char[BLOCK_SIZE];
+    }
+}
+
+BufferedWriter::~BufferedWriter() {
+    delete[] buffer;
+}
+
+bool BufferedWriter::isOpen() const {
+    return buffer != nullptr;
+}
+
+void BufferedWriter::write(const void* data, size_t length) {
+    if (buffer == nullptr) {
+        failed = true;
+        return;
+    }
+
+    const char* bytes = static_cast<const char*>(data);
+    if (used + length > BLOCK_SIZE) {
+        file.write(buffer, static_cast<std::streamsize>(used));
+        written += used;
+        used = 0;
+        // Blocks larger than the buffer go straight to the file
+        if (length >= BLOCK_SIZE) {
+            file.write(bytes, static_cast<std::streamsize>(length));
+            written += length;
+            failed = failed || !file;
+            return;
+        }
+        failed = failed || !file;
+    }
+    memcpy(buffer + used, bytes, length);
+    used += length;
+}
+
+void BufferedWriter::writeText(const char* text) {
+    write(text, strlen(text));
+}
+
+void BufferedWriter::writeInteger(long long value) {
+    char digits[24];
+    size_t start = sizeof(digits);
+    unsigned long long magnitude = value < 0 ? 0ULL - static_cast<unsigned long long>(value) : static_cast<unsigned long long>(value);
+    do {
+        digits[--start] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        digits[--start] = '-';
+    }
+    write(digits + start, sizeof(digits) - start);
+}
+
+void BufferedWriter::align(size_t alignment) {
+    static const char zeros[16] = {};
+    size_t padding = (alignment - (written + used) % alignment) % alignment;
+    while (padding > 0) {
+        size_t step = padding < sizeof(zeros) ? padding : sizeof(zeros);
+        write(zeros, step);
+        padding -= step;
+    }
+}
+
+bool BufferedWriter::finish() {
+    if (buffer == nullptr) {
+        return false;
+    }
+    file.write(buffer, static_cast<std::streamsize>(used));
+    written += used;
+    used = 0;
+    file.flush();
+    return !failed && static_cast<bool>(file);
+}
+
+MemoryReader::MemoryReader(const char* data, size_t size) : cursor(data), end(data + size), failed(false) {
+}
+
+const char* MemoryReader::take(size_t length) {
+    if (failed || length > static_cast<size_t>(end - cursor)) {
+        failed = true;
+        return nullptr;
+    }
+    const char* bytes = cursor;
+    cursor += length;
+    return bytes;
+}
+
+void MemoryReader::align(const char* start, size_t alignment) {
+    size_t padding = (alignment - static_cast<size_t>(cursor - start) % alignment) % alignment;
+    take(padding);
+}
+
+bool MemoryReader::hasFailed() const {
+    return failed;
+}
+
+size_t MemoryReader::getRemaining() const {
+    return static_cast<size_t>(end - cursor);
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const char* path)
+    : data(nullptr), size(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr) {
+    fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+        return;
+    }
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr) {
+        return;
+    }
+    data = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (data != nullptr) {
+        size = static_cast<size_t>(fileSize.QuadPart);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data != nullptr) {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle != nullptr) {
+        CloseHandle(mappingHandle);
+    }
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        CloseHandle(fileHandle);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const char* path) : data(nullptr), size(0), descriptor(-1) {
+    descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+        return;
+    }
+    void* mapped = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+    if (mapped == MAP_FAILED) {
+        return;
+    }
+    data = static_cast<const char*>(mapped);
+    size = static_cast<size_t>(status.st_size);
+    madvise(mapped, size, MADV_SEQUENTIAL);
+}
+
+MappedFile::~MappedFile() {
+    if (data != nullptr) {
+        munmap(const_cast<char*>(data), size);
+    }
+    if (descriptor >= 0) {
+        close(descriptor);
+    }
+}
+
+#endif
+
+bool MappedFile::isOpen() const {
+    return data != nullptr;
+}
+
+const char* MappedFile::getData() const {
+    return data;
+}
+
+size_t MappedFile::getSize() const {
+    return size;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+
+// Reads a file in large blocks and hands out its lines in place. Lines may be
+// of any length: the buffer grows to hold the longest one.
+class LineReader {
+    std::ifstream file;
+    char* buffer;
+    size_t capacity;
+    size_t start;       // first byte not handed out yet
+    size_t end;         // end of the bytes read so far
+    bool exhausted;
+
+    // Moves the pending bytes to the front, growing the buffer when they fill
+    // it, and reads more. Returns false at the end of the file.
+    bool fill();
+
+public:
+    static const size_t BLOCK_SIZE = 1 << 20;
+
+    explicit LineReader(const char* path);
+    ~LineReader();
+
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+
+    bool isOpen() const;
+
+    // Next line without its \n or \r\n, null terminated in the buffer. The
+    // line stays valid and writable until the following call.
+    bool next(char*& line, size_t& length);
+
+    // Reads the digits in [cursor, end) and moves past them; false when there are none
+    static bool parseUnsigned(const char*& cursor, const char* end, size_t& value);
+};
+
+// Writes a file through a large buffer, so many small fields cost one
+// system call per block
+class BufferedWriter {
+    std::ofstream file;
+    char* buffer;
+    size_t used;
+    bool failed;
+    size_t written;     // bytes handed to the file so far
+
+public:
+    static const size_t BLOCK_SIZE = 1 << 20;
+
+    explicit BufferedWriter(const char* path);
+    ~BufferedWriter();
+
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+    bool isOpen() const;
+
+    void write(const void* data, size_t length);
+    void writeText(const char* text);
+    // Writes value in decimal
+    void writeInteger(long long value);
+    // Writes the bytes of a plain value as they lie in memory
+    template<typename T>
+    void writeValue(const T& value);
+    // Pads with zeros up to a multiple of alignment bytes from the start
+    void align(size_t alignment);
+
+    // Flushes what is buffered; false when any write failed
+    bool finish();
+};
+
+template<typename T>
+void BufferedWriter::writeValue(const T& value) {
+    write(&value, sizeof(T));
+}
+
+// Bounds-checked cursor over bytes in memory, such as a mapped file. A read
+// past the end fails and so does every read after it.
+class MemoryReader {
+    const char* cursor;
+    const char* end;
+    bool failed;
+
+public:
+    MemoryReader(const char* data, size_t size);
+
+    // Returns the next length bytes in place, or null past the end
+    const char* take(size_t length);
+    template<typename T>
+    bool readValue(T& value);
+    // Skips the padding align() wrote, counted from start
+    void align(const char* start, size_t alignment);
+
+    bool hasFailed() const;
+    size_t getRemaining() const;
+};
+
+template<typename T>
+bool MemoryReader::readValue(T& value) {
+    const char* bytes = take(sizeof(T));
+    if (bytes == nullptr) {
+        return false;
+    }
+    memcpy(&value, bytes, sizeof(T));
+    return true;
+}
+
+// Read-only mapping of a whole file, through CreateFileMapping on Windows
+// and mmap elsewhere. Empty files are not mapped.
+class MappedFile {
+    const char* data;
+    size_t size;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int descriptor;
+#endif
+
+public:
+    explicit MappedFile(const char* path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const;
+    const char* getData() const;
+    size_t getSize() const;
+};
@@ -6,22 +6,32 @@
 #include "ValueCell.hpp"
 #include "FormulaCell.h"
 #include "ReferenceCell.h"
+#include "CellKind.h"
+#include "CellPool.h"
+#include "FormulaParser.h"
 
 class Table;
 
 static class CellFactory {
-private:
-    static bool parseFormula(const MyString& input, MyString& formulaName, MyString& parametersString);
-    static FormulaType getFormulaType(const MyString& formulaName);
-    static MyVector<FormulaParameter> parseFormulaParameters(const MyString& parametersString, Table* table);
-    static FormulaParameter parseParameter(const MyString& param, Table* table);
-    static bool parseRange(const MyString& range, size_t& startRow, size_t& startCol, size_t& endRow, size_t& endCol);
-
 public:
     static unique_ptr<BaseCell> createCell(const MyString& input);
 
     static unique_ptr<BaseCell> createCell(const MyString& input, Table* table);
 
+    // Builds the formula or reference for input starting with '='; on failure returns nullptr and sets error.
+    // A formula is placed in pool when one is given; everything else is heap allocated and owned by the caller.
+    // Tables store plain references by value and never pass one here.
+    static BaseCell* createExpressionCell(const MyString& input, Table* table, CellPool* pool, CellError& error);
+
+    // Parses input that does not start with '=' into one of the literal outputs and returns its kind.
+    // Whole numbers that fit an int are INT; decimals, exponents and larger whole numbers are DOUBLE.
+    static CellKind parseLiteral(const MyString& input, int& intValue, bool& boolValue, double& doubleValue, MyString& stringValue);
+
+    // Same rules over length bytes in place: a string literal is returned as the
+    // bytes [text, text + textLength) of data, so nothing is allocated
+    static CellKind parseLiteral(const char* data, size_t length, int& intValue, bool& boolValue, double& doubleValue,
+        const char*& text, size_t& textLength);
+
     static bool parseCellReference(const MyString& reference, size_t& row, size_t& col);
 };
 
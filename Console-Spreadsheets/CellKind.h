@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+// What a storage slot holds. Everything but formulas is stored by value,
+// formulas are backed by FormulaCell objects.
+enum class CellKind : unsigned char {
+    EMPTY,
+    INT,
+    BOOL,
+    DOUBLE,
+    STRING,
+    REFERENCE,
+    FORMULA,
+    ERROR_VALUE     // payload is a CellError
+};
+
+// Error a cell shows in place of a value. Stored in ERROR_VALUE cells and in the
+// cached results of formulas and references, and propagated by formulas.
+enum class CellError : unsigned char {
+    NONE,
+    VALUE,      // #VALUE!    unusable formula arguments
+    REF,        // #REF!      reference to an empty cell, or no cell at all
+    CIRCULAR,   // #CIRCULAR! the cell reads itself through a cycle
+    SYNTAX,     // #ERROR!    the formula could not be parsed
+    DIV_ZERO,   // #DIV/0!    division by zero
+    NA          // #N/A       a lookup found no match
+};
+
+inline const char* getErrorText(CellError error) {
+    static const char* const texts[] = { "", "#VALUE!", "#REF!", "#CIRCULAR!", "#ERROR!", "#DIV/0!", "#N/A" };
+    return texts[static_cast<unsigned char>(error)];
+}
+
+// Reads an error back from its text; false for anything else
+inline bool parseErrorText(const char* text, size_t length, CellError& error) {
+    for (unsigned char code = 1; code <= static_cast<unsigned char>(CellError::NA); code++) {
+        const char* candidate = getErrorText(static_cast<CellError>(code));
+        if (strlen(candidate) == length && memcmp(candidate, text, length) == 0) {
+            error = static_cast<CellError>(code);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Kinds whose payload is a plain number in the column strips
+inline bool isNumericKind(CellKind kind) {
+    return kind == CellKind::INT || kind == CellKind::BOOL || kind == CellKind::DOUBLE;
+}
@@ -0,0 +1,132 @@
+#include "CellPool.h"
+
+const size_t CellPool::SLAB_SIZE;
+const size_t CellPool::MIN_BLOCK;
+const size_t CellPool::SIZE_CLASS_COUNT;
+
+CellPool::CellPool() : cursor(nullptr), remaining(0), largeBytes(0) {
+    for (size_t i = 0; i < SIZE_CLASS_COUNT; i++) {
+        freeLists[i] = nullptr;
+    }
+    for (size_t i = 0; i < static_cast<size_t>(PoolClass::COUNT); i++) {
+        bytesInUse[i] = 0;
+        blocksInUse[i] = 0;
+    }
+}
+
+CellPool::~CellPool() {
+    reset();
+}
+
+size_t CellPool::sizeClassOf(size_t bytes) {
+    size_t sizeClass = 0;
+    size_t size = MIN_BLOCK;
+    while (size < bytes) {
+        size *= 2;
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+size_t CellPool::blockSize(size_t sizeClass) {
+    return MIN_BLOCK << sizeClass;
+}
+
+char* CellPool::bump(size_t bytes) {
+    if (bytes > remaining) {
+        // The tail of the previous slab is abandoned until reset()
+        cursor = new char[SLAB_SIZE];
+        remaining = SLAB_SIZE;
+        slabs.push_back(cursor);
+    }
+
+    char* block = cursor;
+    cursor += bytes;
+    remaining -= bytes;
+    return block;
+}
+
+void* CellPool::allocate(size_t bytes, PoolClass owner) {
+    size_t sizeClass = sizeClassOf(bytes);
+    void* block;
+
+    if (sizeClass >= SIZE_CLASS_COUNT) {
+        char* large = new char[bytes];
+        largeBlocks.push_back(large);
+        largeBytes += bytes;
+        block = large;
+    }
+    else if (freeLists[sizeClass] != nullptr) {
+        FreeBlock* head = freeLists[sizeClass];
+        freeLists[sizeClass] = head->next;
+        block = head;
+    }
+    else {
+        block = bump(blockSize(sizeClass));
+    }
+
+    bytesInUse[static_cast<size_t>(owner)] += bytes;
+    blocksInUse[static_cast<size_t>(owner)]++;
+    return block;
+}
+
+void CellPool::release(void* block, size_t bytes, PoolClass owner) {
+    if (block == nullptr) {
+        return;
+    }
+
+    bytesInUse[static_cast<size_t>(owner)] -= bytes;
+    blocksInUse[static_cast<size_t>(owner)]--;
+
+    size_t sizeClass = sizeClassOf(bytes);
+    if (sizeClass >= SIZE_CLASS_COUNT) {
+        for (size_t i = 0; i < largeBlocks.getSize(); i++) {
+            if (largeBlocks[i] == block) {
+                largeBlocks[i] = largeBlocks[largeBlocks.getSize() - 1];
+                largeBlocks.pop_back();
+                break;
+            }
+        }
+        largeBytes -= bytes;
+        delete[] static_cast<char*>(block);
+        return;
+    }
+
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = freeLists[sizeClass];
+    freeLists[sizeClass] = freed;
+}
+
+void CellPool::reset() {
+    for (size_t i = 0; i < slabs.getSize(); i++) {
+        delete[] slabs[i];
+    }
+    for (size_t i = 0; i < largeBlocks.getSize(); i++) {
+        delete[] largeBlocks[i];
+    }
+    slabs.clear();
+    largeBlocks.clear();
+
+    cursor = nullptr;
+    remaining = 0;
+    largeBytes = 0;
+    for (size_t i = 0; i < SIZE_CLASS_COUNT; i++) {
+        freeLists[i] = nullptr;
+    }
+    for (size_t i = 0; i < static_cast<size_t>(PoolClass::COUNT); i++) {
+        bytesInUse[i] = 0;
+        blocksInUse[i] = 0;
+    }
+}
+
+size_t CellPool::getBytesInUse(PoolClass owner) const {
+    return bytesInUse[static_cast<size_t>(owner)];
+}
+
+size_t CellPool::getBlocksInUse(PoolClass owner) const {
+    return blocksInUse[static_cast<size_t>(owner)];
+}
+
+size_t CellPool::getReservedBytes() const {
+    return slabs.getSize() * SLAB_SIZE + largeBytes;
+}
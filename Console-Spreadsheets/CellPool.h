@@ -0,0 +1,67 @@
+#pragma once
+
+#include <new>
+#include <utility>
+#include "MyVector.hpp"
+
+// Owners that the pool keeps separate byte counters for
+enum class PoolClass {
+    FORMULA_CELL,
+    STRING,
+    COUNT
+};
+
+// Per-table size-class allocator. Small blocks are bump-allocated from large
+// slabs and recycled through one free list per size class, so allocation is a
+// pointer bump or a free-list pop. reset() drops every slab at once.
+class CellPool {
+public:
+    static const size_t SLAB_SIZE = 64 * 1024;
+    static const size_t MIN_BLOCK = 16;
+    static const size_t SIZE_CLASS_COUNT = 9; // 16, 32, ... 4096 bytes
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    MyVector<char*> slabs;
+    MyVector<char*> largeBlocks;  // blocks above the biggest size class
+    char* cursor;
+    size_t remaining;
+    size_t largeBytes;
+    FreeBlock* freeLists[SIZE_CLASS_COUNT];
+
+    size_t bytesInUse[static_cast<size_t>(PoolClass::COUNT)];
+    size_t blocksInUse[static_cast<size_t>(PoolClass::COUNT)];
+
+    static size_t sizeClassOf(size_t bytes);
+    static size_t blockSize(size_t sizeClass);
+    char* bump(size_t bytes);
+
+public:
+    CellPool();
+    CellPool(const CellPool& other) = delete;
+    CellPool& operator=(const CellPool& other) = delete;
+    ~CellPool();
+
+    void* allocate(size_t bytes, PoolClass owner);
+    void release(void* block, size_t bytes, PoolClass owner);
+
+    // Frees every slab without touching the blocks; callers must have run
+    // the destructors that matter beforehand
+    void reset();
+
+    size_t getBytesInUse(PoolClass owner) const;
+    size_t getBlocksInUse(PoolClass owner) const;
+    size_t getReservedBytes() const;
+
+    template<typename T, typename... Args>
+    T* create(PoolClass owner, Args&&... args);
+};
+
+template<typename T, typename... Args>
+T* CellPool::create(PoolClass owner, Args&&... args) {
+    void* block = allocate(sizeof(T), owner);
+    return new (block) T(std::forward<Args>(args)...);
+}
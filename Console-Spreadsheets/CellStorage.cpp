@@ -0,0 +1,660 @@
+#include "CellStorage.h"
+#include "FormulaCell.h"
+
+const size_t CellStorage::TILE_SIZE;
+
+CellStorage::Tile::Tile() : occupied(0) {
+    for (size_t i = 0; i < TILE_SIZE * TILE_SIZE; i++) {
+        kinds[i] = CellKind::EMPTY;
+    }
+    for (size_t c = 0; c < TILE_SIZE; c++) {
+        valid[c] = 0;
+        numeric[c] = 0;
+    }
+}
+
+CellStorage::CellStorage()
+    : cellCount(0), tileCount(0), tilesPerBand(0), rowTail(0), columnTail(0), rowExtent(0), columnExtent(0),
+    strings(pool) {
+}
+
+CellStorage::~CellStorage() {
+    clear();
+}
+
+size_t CellStorage::slotIndex(size_t row, size_t col) {
+    return (col % TILE_SIZE) * TILE_SIZE + (row % TILE_SIZE);
+}
+
+CellStorage::Tile* CellStorage::findTile(size_t row, size_t col) const {
+    size_t bandIndex = row / TILE_SIZE;
+    if (bandIndex >= bands.getSize() || bands[bandIndex] == nullptr) {
+        return nullptr;
+    }
+
+    const TileBand* band = bands[bandIndex];
+    size_t tileIndex = col / TILE_SIZE;
+    if (tileIndex >= band->tiles.getSize()) {
+        return nullptr;
+    }
+
+    return band->tiles[tileIndex];
+}
+
+CellStorage::Tile* CellStorage::touchTile(size_t row, size_t col) {
+    size_t bandIndex = row / TILE_SIZE;
+    if (bands.getSize() <= bandIndex) {
+        // resize reserves exactly; doubling keeps appending rows linear
+        if (bands.getCapacity() <= bandIndex) {
+            bands.reserve(bandIndex + 1 > bands.getCapacity() * 2 ? bandIndex + 1 : bands.getCapacity() * 2);
+        }
+        bands.resize(bandIndex + 1);
+    }
+    if (bands[bandIndex] == nullptr) {
+        bands[bandIndex] = new TileBand();
+        bands[bandIndex]->tiles.reserve(tilesPerBand);
+    }
+
+    TileBand* band = bands[bandIndex];
+    size_t tileIndex = col / TILE_SIZE;
+    if (band->tiles.getSize() <= tileIndex) {
+        band->tiles.resize(tileIndex + 1);
+    }
+    if (band->tiles[tileIndex] == nullptr) {
+        band->tiles[tileIndex] = new Tile();
+        band->tileCount++;
+        tileCount++;
+    }
+
+    return band->tiles[tileIndex];
+}
+
+void CellStorage::releaseTile(size_t row, size_t col) {
+    size_t bandIndex = row / TILE_SIZE;
+    TileBand* band = bands[bandIndex];
+    size_t tileIndex = col / TILE_SIZE;
+
+    delete band->tiles[tileIndex];
+    band->tiles[tileIndex] = nullptr;
+    band->tileCount--;
+    tileCount--;
+
+    if (band->tileCount == 0) {
+        delete band;
+        bands[bandIndex] = nullptr;
+    }
+}
+
+bool CellStorage::takeSlot(size_t row, size_t col, CellKind& kind, CellPayload& payload) {
+    Tile* tile = findTile(row, col);
+    if (tile == nullptr) {
+        return false;
+    }
+
+    size_t slot = slotIndex(row, col);
+    if (tile->kinds[slot] == CellKind::EMPTY) {
+        return false;
+    }
+
+    kind = tile->kinds[slot];
+    payload = tile->payload[slot];
+
+    uint64_t bit = 1ULL << (row % TILE_SIZE);
+    tile->kinds[slot] = CellKind::EMPTY;
+    tile->valid[col % TILE_SIZE] &= ~bit;
+    tile->numeric[col % TILE_SIZE] &= ~bit;
+    tile->occupied--;
+    cellCount--;
+
+    if (tile->occupied == 0) {
+        releaseTile(row, col);
+    }
+
+    return true;
+}
+
+void CellStorage::putSlot(size_t row, size_t col, CellKind kind, CellPayload payload) {
+    CellKind oldKind;
+    CellPayload oldPayload;
+    if (takeSlot(row, col, oldKind, oldPayload)) {
+        releasePayload(oldKind, oldPayload);
+    }
+
+    Tile* tile = touchTile(row, col);
+    size_t slot = slotIndex(row, col);
+    uint64_t bit = 1ULL << (row % TILE_SIZE);
+
+    tile->kinds[slot] = kind;
+    tile->payload[slot] = payload;
+    tile->valid[col % TILE_SIZE] |= bit;
+    if (isNumericKind(kind)) {
+        tile->numeric[col % TILE_SIZE] |= bit;
+    }
+    tile->occupied++;
+    cellCount++;
+}
+
+void CellStorage::releasePayload(CellKind kind, CellPayload payload) {
+    if (kind == CellKind::STRING) {
+        strings.release(static_cast<uint32_t>(payload.handle));
+    }
+    else if (kind == CellKind::FORMULA) {
+        destroyFormula(objects[payload.handle]);
+        objects[payload.handle] = nullptr;
+        freeObjects.push_back(payload.handle);
+    }
+}
+
+void CellStorage::destroyFormula(BaseCell* object) {
+    FormulaCell* formula = static_cast<FormulaCell*>(object);
+    formula->~FormulaCell();
+    pool.release(formula, sizeof(FormulaCell), PoolClass::FORMULA_CELL);
+}
+
+const CellStorage::Tile* CellStorage::findCell(size_t row, size_t col, size_t& slot) const {
+    size_t physRow = physicalRow(row);
+    size_t physCol = physicalColumn(col);
+    slot = slotIndex(physRow, physCol);
+    return findTile(physRow, physCol);
+}
+
+void CellStorage::putCell(size_t row, size_t col, CellKind kind, CellPayload payload) {
+    if (row >= rowExtent) {
+        rowExtent = row + 1;
+    }
+    if (col >= columnExtent) {
+        columnExtent = col + 1;
+    }
+    putSlot(physicalRow(row), physicalColumn(col), kind, payload);
+}
+
+CellKind CellStorage::getKind(size_t row, size_t col) const {
+    size_t slot;
+    const Tile* tile = findCell(row, col, slot);
+    if (tile == nullptr) {
+        return CellKind::EMPTY;
+    }
+
+    return tile->kinds[slot];
+}
+
+CellValue CellStorage::getValue(size_t row, size_t col) const {
+    CellValue value;
+    size_t slot;
+    const Tile* tile = findCell(row, col, slot);
+    if (tile == nullptr) {
+        return value;
+    }
+
+    const CellPayload& payload = tile->payload[slot];
+    value.kind = tile->kinds[slot];
+    switch (value.kind) {
+    case CellKind::INT:
+        value.intValue = static_cast<int>(payload.number);
+        break;
+    case CellKind::BOOL:
+        value.boolValue = payload.number != 0.0;
+        break;
+    case CellKind::DOUBLE:
+        value.doubleValue = payload.number;
+        break;
+    case CellKind::STRING:
+        value.stringId = static_cast<uint32_t>(payload.handle);
+        break;
+    case CellKind::REFERENCE:
+        value.target = payload.target;
+        break;
+    case CellKind::FORMULA:
+        value.formula = payload.handle;
+        break;
+    case CellKind::ERROR_VALUE:
+        value.error = static_cast<CellError>(payload.handle);
+        break;
+    default:
+        break;
+    }
+    return value;
+}
+
+double CellStorage::getNumber(size_t row, size_t col) const {
+    size_t slot;
+    const Tile* tile = findCell(row, col, slot);
+    if (tile == nullptr || ((tile->numeric[slot / TILE_SIZE] >> (slot % TILE_SIZE)) & 1) == 0) {
+        return 0.0;
+    }
+
+    return tile->payload[slot].number;
+}
+
+const char* CellStorage::getString(size_t row, size_t col) const {
+    static const char empty[] = "";
+
+    size_t slot;
+    const Tile* tile = findCell(row, col, slot);
+    if (tile == nullptr || tile->kinds[slot] != CellKind::STRING) {
+        return empty;
+    }
+
+    return strings.getText(static_cast<uint32_t>(tile->payload[slot].handle));
+}
+
+BaseCell* CellStorage::getObject(size_t row, size_t col) const {
+    size_t slot;
+    const Tile* tile = findCell(row, col, slot);
+    if (tile == nullptr || tile->kinds[slot] != CellKind::FORMULA) {
+        return nullptr;
+    }
+
+    return objects[tile->payload[slot].handle];
+}
+
+bool CellStorage::getReferenceTarget(size_t row, size_t col, size_t& targetRow, size_t& targetCol) const {
+    size_t slot;
+    const Tile* tile = findCell(row, col, slot);
+    if (tile == nullptr || tile->kinds[slot] != CellKind::REFERENCE) {
+        return false;
+    }
+
+    targetRow = tile->payload[slot].target.row;
+    targetCol = tile->payload[slot].target.col;
+    return true;
+}
+
+void CellStorage::setInt(size_t row, size_t col, int value) {
+    CellPayload payload;
+    payload.number = static_cast<double>(value);
+    putCell(row, col, CellKind::INT, payload);
+}
+
+void CellStorage::setBool(size_t row, size_t col, bool value) {
+    CellPayload payload;
+    payload.number = value ? 1.0 : 0.0;
+    putCell(row, col, CellKind::BOOL, payload);
+}
+
+void CellStorage::setDouble(size_t row, size_t col, double value) {
+    CellPayload payload;
+    payload.number = value;
+    putCell(row, col, CellKind::DOUBLE, payload);
+}
+
+void CellStorage::setString(size_t row, size_t col, const MyString& value) {
+    setString(row, col, value.data(), value.length());
+}
+
+void CellStorage::setString(size_t row, size_t col, const char* text, size_t length) {
+    CellPayload payload;
+    payload.handle = strings.intern(text, length);
+    putCell(row, col, CellKind::STRING, payload);
+}
+
+void CellStorage::setError(size_t row, size_t col, CellError error) {
+    CellPayload payload;
+    payload.handle = static_cast<size_t>(error);
+    putCell(row, col, CellKind::ERROR_VALUE, payload);
+}
+
+void CellStorage::setReference(size_t row, size_t col, size_t targetRow, size_t targetCol) {
+    CellPayload payload;
+    payload.target.row = static_cast<uint32_t>(targetRow);
+    payload.target.col = static_cast<uint32_t>(targetCol);
+    putCell(row, col, CellKind::REFERENCE, payload);
+}
+
+void CellStorage::setObject(size_t row, size_t col, CellKind kind, BaseCell* object) {
+    CellPayload payload;
+    if (freeObjects.getSize() > 0) {
+        payload.handle = freeObjects.pop_back();
+        objects[payload.handle] = object;
+    }
+    else {
+        payload.handle = objects.getSize();
+        objects.push_back(object);
+    }
+    putCell(row, col, kind, payload);
+}
+
+void CellStorage::erase(size_t row, size_t col) {
+    CellKind kind;
+    CellPayload payload;
+    if (takeSlot(physicalRow(row), physicalColumn(col), kind, payload)) {
+        releasePayload(kind, payload);
+    }
+}
+
+void CellStorage::clear() {
+    for (size_t b = 0; b < bands.getSize(); b++) {
+        TileBand* band = bands[b];
+        if (band == nullptr) {
+            continue;
+        }
+
+        for (size_t t = 0; t < band->tiles.getSize(); t++) {
+            Tile* tile = band->tiles[t];
+            if (tile == nullptr) {
+                continue;
+            }
+
+            // Formulas own their parameter lists; strings hold nothing
+            // outside the pool and simply vanish with it
+            for (size_t slot = 0; slot < TILE_SIZE * TILE_SIZE; slot++) {
+                if (tile->kinds[slot] == CellKind::FORMULA) {
+                    static_cast<FormulaCell*>(objects[tile->payload[slot].handle])->~FormulaCell();
+                }
+            }
+            delete tile;
+        }
+        delete band;
+        bands[b] = nullptr;
+    }
+
+    bands.clear();
+    strings.clear();
+    objects.clear();
+    freeObjects.clear();
+    pool.reset();
+    cellCount = 0;
+    tileCount = 0;
+
+    rowOrder.clear();
+    columnOrder.clear();
+    rowTail = 0;
+    columnTail = 0;
+    rowExtent = 0;
+    columnExtent = 0;
+}
+
+CellPool& CellStorage::getPool() {
+    return pool;
+}
+
+const CellPool& CellStorage::getPool() const {
+    return pool;
+}
+
+const StringInterner& CellStorage::getStrings() const {
+    return strings;
+}
+
+void CellStorage::collectRuns(const MyVector<size_t>& order, size_t tail, size_t extent, MyVector<OrderRun>& runs) {
+    size_t mapped = order.getSize();
+    for (size_t logical = 0; logical < extent; logical++) {
+        size_t physical = logical < mapped ? order.atUnchecked(logical) : tail + (logical - mapped);
+        if (runs.getSize() > 0) {
+            OrderRun& last = runs[runs.getSize() - 1];
+            if (last.physical + last.count == physical && physical % TILE_SIZE != 0) {
+                last.count++;
+                continue;
+            }
+        }
+        OrderRun run = { logical, physical, 1 };
+        runs.push_back(run);
+    }
+}
+
+void CellStorage::mapRowsThrough(size_t count) {
+    // Appending the tail's own ids keeps every existing cell where it is
+    while (rowOrder.getSize() < count) {
+        rowOrder.push_back(rowTail++);
+    }
+}
+
+void CellStorage::mapColumnsThrough(size_t count) {
+    while (columnOrder.getSize() < count) {
+        columnOrder.push_back(columnTail++);
+    }
+}
+
+void CellStorage::eraseRowCells(size_t physRow) {
+    size_t bandIndex = physRow / TILE_SIZE;
+    if (bandIndex >= bands.getSize() || bands[bandIndex] == nullptr) {
+        return;
+    }
+
+    // Collect first, erasing the last cell of a tile frees the tile and maybe the band
+    MyVector<size_t> columns;
+    const TileBand* band = bands[bandIndex];
+    uint64_t bit = 1ULL << (physRow % TILE_SIZE);
+    for (size_t t = 0; t < band->tiles.getSize(); t++) {
+        const Tile* tile = band->tiles[t];
+        if (tile == nullptr) {
+            continue;
+        }
+        for (size_t c = 0; c < TILE_SIZE; c++) {
+            if (tile->valid[c] & bit) {
+                columns.push_back(t * TILE_SIZE + c);
+            }
+        }
+    }
+
+    for (size_t physCol : columns) {
+        CellKind kind;
+        CellPayload payload;
+        if (takeSlot(physRow, physCol, kind, payload)) {
+            releasePayload(kind, payload);
+        }
+    }
+}
+
+void CellStorage::eraseColumnCells(size_t physCol) {
+    size_t tileIndex = physCol / TILE_SIZE;
+    for (size_t b = 0; b < bands.getSize(); b++) {
+        const TileBand* band = bands[b];
+        if (band == nullptr || tileIndex >= band->tiles.getSize() || band->tiles[tileIndex] == nullptr) {
+            continue;
+        }
+
+        uint64_t rows = band->tiles[tileIndex]->valid[physCol % TILE_SIZE];
+        for (size_t r = 0; r < TILE_SIZE && rows != 0; r++) {
+            if ((rows >> r) & 1) {
+                CellKind kind;
+                CellPayload payload;
+                if (takeSlot(b * TILE_SIZE + r, physCol, kind, payload)) {
+                    releasePayload(kind, payload);
+                }
+            }
+        }
+    }
+}
+
+// Structural edits only rewrite the logical order; no cell is moved, so a
+// cell keeps its physical slot for as long as it lives
+void CellStorage::insertRow(size_t index) {
+    if (index >= rowExtent) {
+        return;
+    }
+
+    mapRowsThrough(rowExtent);
+    rowOrder.insert(rowTail++, index);
+    rowExtent++;
+}
+
+void CellStorage::removeRow(size_t index) {
+    if (index >= rowExtent) {
+        return;
+    }
+
+    mapRowsThrough(rowExtent);
+    eraseRowCells(rowOrder[index]);
+    rowOrder.erase(index);
+    rowExtent--;
+}
+
+void CellStorage::insertColumn(size_t index) {
+    if (index >= columnExtent) {
+        return;
+    }
+
+    mapColumnsThrough(columnExtent);
+    columnOrder.insert(columnTail++, index);
+    columnExtent++;
+}
+
+void CellStorage::removeColumn(size_t index) {
+    if (index >= columnExtent) {
+        return;
+    }
+
+    mapColumnsThrough(columnExtent);
+    eraseColumnCells(columnOrder[index]);
+    columnOrder.erase(index);
+    columnExtent--;
+}
+
+void CellStorage::truncate(size_t rows, size_t cols) {
+    for (size_t row = rows; row < rowExtent; row++) {
+        eraseRowCells(physicalRow(row));
+    }
+    for (size_t col = cols; col < columnExtent; col++) {
+        eraseColumnCells(physicalColumn(col));
+    }
+
+    // Ids past the cut are empty now, so the maps can forget them
+    if (rowOrder.getSize() > rows) {
+        rowOrder.erase(rows, rowOrder.getSize());
+    }
+    if (columnOrder.getSize() > cols) {
+        columnOrder.erase(cols, columnOrder.getSize());
+    }
+    if (rowExtent > rows) {
+        rowExtent = rows;
+    }
+    if (columnExtent > cols) {
+        columnExtent = cols;
+    }
+}
+
+void CellStorage::reserve(size_t rows, size_t cols) {
+    bands.reserve((rows + TILE_SIZE - 1) / TILE_SIZE);
+    tilesPerBand = (cols + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+size_t CellStorage::getCellCount() const {
+    return cellCount;
+}
+
+size_t CellStorage::getTileCount() const {
+    return tileCount;
+}
+
+bool CellStorage::copyBlock(size_t firstRow, size_t firstCol, CellPayload* payload, CellKind* kinds, uint64_t* valid) const {
+    memset(payload, 0, sizeof(CellPayload) * TILE_SIZE * TILE_SIZE);
+    memset(kinds, 0, sizeof(CellKind) * TILE_SIZE * TILE_SIZE);
+    memset(valid, 0, sizeof(uint64_t) * TILE_SIZE);
+
+    bool any = false;
+    forEachStrip(firstRow, firstCol, firstRow + TILE_SIZE - 1, firstCol + TILE_SIZE - 1,
+        [&](size_t row, size_t col, const CellPayload* stripPayload, const CellKind* stripKinds,
+            uint64_t validMask, uint64_t /*numericMask*/, size_t count) {
+            size_t first = row - firstRow;
+            size_t offset = (col - firstCol) * TILE_SIZE + first;
+            for (size_t i = 0; i < count; i++) {
+                if ((validMask >> i) & 1) {
+                    payload[offset + i] = stripPayload[i];
+                    kinds[offset + i] = stripKinds[i];
+                }
+            }
+            valid[col - firstCol] |= validMask << first;
+            any = true;
+        });
+    return any;
+}
+
+bool CellStorage::loadBlock(size_t firstRow, size_t firstCol, const uint64_t* valid, const CellPayload* payload,
+    const CellKind* kinds, const MyVector<uint32_t>& textIds) {
+    if (rowOrder.getSize() > 0 || columnOrder.getSize() > 0 || firstRow % TILE_SIZE != 0 || firstCol % TILE_SIZE != 0
+        || findTile(firstRow, firstCol) != nullptr) {
+        return false;
+    }
+
+    // Check every cell before storing any
+    size_t cells = 0;
+    size_t strip = 0;
+    size_t lastRow = 0, lastCol = 0;
+    for (size_t c = 0; c < TILE_SIZE; c++) {
+        if (valid[c] == 0) {
+            continue;
+        }
+        for (size_t r = 0; r < TILE_SIZE; r++) {
+            if (((valid[c] >> r) & 1) == 0) {
+                continue;
+            }
+
+            size_t slot = strip * TILE_SIZE + r;
+            switch (kinds[slot]) {
+            case CellKind::INT:
+            case CellKind::BOOL:
+            case CellKind::DOUBLE:
+            case CellKind::REFERENCE:
+                break;
+            case CellKind::STRING:
+                if (payload[slot].handle >= textIds.getSize()) {
+                    return false;
+                }
+                break;
+            case CellKind::ERROR_VALUE:
+                if (payload[slot].handle == 0 || payload[slot].handle > static_cast<size_t>(CellError::NA)) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+            }
+            cells++;
+            lastRow = r > lastRow ? r : lastRow;
+        }
+        lastCol = c;
+        strip++;
+    }
+    if (cells == 0) {
+        return true;
+    }
+
+    Tile* tile = touchTile(firstRow, firstCol);
+    strip = 0;
+    for (size_t c = 0; c < TILE_SIZE; c++) {
+        if (valid[c] == 0) {
+            continue;
+        }
+
+        CellPayload* tilePayload = tile->payload + c * TILE_SIZE;
+        CellKind* tileKinds = tile->kinds + c * TILE_SIZE;
+        memcpy(tilePayload, payload + strip * TILE_SIZE, sizeof(CellPayload) * TILE_SIZE);
+        memcpy(tileKinds, kinds + strip * TILE_SIZE, sizeof(CellKind) * TILE_SIZE);
+        strip++;
+
+        tile->valid[c] = valid[c];
+        for (size_t r = 0; r < TILE_SIZE; r++) {
+            if (((valid[c] >> r) & 1) == 0) {
+                // Unused slots read as empty like in any other tile
+                tileKinds[r] = CellKind::EMPTY;
+            }
+            else if (isNumericKind(tileKinds[r])) {
+                tile->numeric[c] |= 1ULL << r;
+            }
+            else if (tileKinds[r] == CellKind::STRING) {
+                uint32_t id = textIds[tilePayload[r].handle];
+                strings.retain(id);
+                tilePayload[r].handle = id;
+            }
+        }
+    }
+    tile->occupied = cells;
+    cellCount += cells;
+
+    if (firstRow + lastRow + 1 > rowExtent) {
+        rowExtent = firstRow + lastRow + 1;
+    }
+    if (firstCol + lastCol + 1 > columnExtent) {
+        columnExtent = firstCol + lastCol + 1;
+    }
+    return true;
+}
+
+uint32_t CellStorage::internText(const char* text, size_t length) {
+    return strings.intern(text, length);
+}
+
+void CellStorage::releaseText(uint32_t id) {
+    strings.release(id);
+}
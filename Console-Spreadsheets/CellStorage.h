@@ -0,0 +1,315 @@
+#pragma once
+
+#include <cstdint>
+#include "MyVector.hpp"
+#include "MyString.h"
+#include "BaseCell.h"
+#include "CellKind.h"
+#include "CellValue.h"
+#include "CellPool.h"
+#include "StringInterner.h"
+
+// Value slot of a stored cell
+union CellPayload {
+    double number;      // INT, BOOL and DOUBLE cells
+    size_t handle;      // interned string id, formula object index or CellError
+    CellTarget target;  // REFERENCE cells
+};
+
+// Sparse, column-major cell storage. The sheet is split into fixed-size square
+// tiles that are allocated only when a cell inside them is written. Inside a
+// tile every column is a contiguous strip of payloads and kind tags with a
+// validity bitmap, so range scans walk plain arrays instead of cell objects.
+//
+// Tiles are addressed by physical row and column ids. The public interface
+// takes logical positions, which go through two order maps, so inserting or
+// removing a row or column edits one map instead of moving cells.
+class CellStorage {
+public:
+    static const size_t TILE_SIZE = 64;
+
+private:
+    struct Tile {
+        CellPayload payload[TILE_SIZE * TILE_SIZE]; // column-major
+        CellKind kinds[TILE_SIZE * TILE_SIZE];
+        uint64_t valid[TILE_SIZE];                  // occupied rows, one bitmap per column
+        uint64_t numeric[TILE_SIZE];                // INT, BOOL and DOUBLE rows, one bitmap per column
+        size_t occupied;
+
+        Tile();
+    };
+
+    // One band per TILE_SIZE rows, holding the tiles of that band by tile column
+    struct TileBand {
+        MyVector<Tile*> tiles;
+        size_t tileCount;
+
+        TileBand() : tileCount(0) {}
+    };
+
+    MyVector<TileBand*> bands;
+    size_t cellCount;
+    size_t tileCount;
+    size_t tilesPerBand;    // reserve() hint for new bands
+
+    // Logical positions [logical, logical + count) sitting at consecutive
+    // physical ids [physical, physical + count) within one tile
+    struct OrderRun {
+        size_t logical;
+        size_t physical;
+        size_t count;
+    };
+
+    // Logical to physical order. Positions past the end of a map continue
+    // linearly from its tail id, so an untouched sheet needs no map at all.
+    MyVector<size_t> rowOrder;
+    MyVector<size_t> columnOrder;
+    size_t rowTail;
+    size_t columnTail;
+    size_t rowExtent;       // logical rows that may hold a cell
+    size_t columnExtent;
+
+    // String bytes and formula objects are carved out of the pool
+    CellPool pool;
+    StringInterner strings;
+    MyVector<BaseCell*> objects;
+    MyVector<size_t> freeObjects;
+
+    Tile* findTile(size_t row, size_t col) const;
+    Tile* touchTile(size_t row, size_t col);
+    void releaseTile(size_t row, size_t col);
+    static size_t slotIndex(size_t row, size_t col);
+
+    bool takeSlot(size_t row, size_t col, CellKind& kind, CellPayload& payload);
+    void putSlot(size_t row, size_t col, CellKind kind, CellPayload payload);
+    void releasePayload(CellKind kind, CellPayload payload);
+    void destroyFormula(BaseCell* object);
+    const Tile* findCell(size_t row, size_t col, size_t& slot) const;
+    void putCell(size_t row, size_t col, CellKind kind, CellPayload payload);
+
+    static void collectRuns(const MyVector<size_t>& order, size_t tail, size_t extent, MyVector<OrderRun>& runs);
+    void mapRowsThrough(size_t count);
+    void mapColumnsThrough(size_t count);
+    void eraseRowCells(size_t physRow);
+    void eraseColumnCells(size_t physCol);
+
+public:
+    CellStorage();
+    CellStorage(const CellStorage& other) = delete;
+    CellStorage& operator=(const CellStorage& other) = delete;
+    ~CellStorage();
+
+    CellKind getKind(size_t row, size_t col) const;
+    CellValue getValue(size_t row, size_t col) const;
+    double getNumber(size_t row, size_t col) const;
+    const char* getString(size_t row, size_t col) const;
+    BaseCell* getObject(size_t row, size_t col) const;
+    bool getReferenceTarget(size_t row, size_t col, size_t& targetRow, size_t& targetCol) const;
+
+    void setInt(size_t row, size_t col, int value);
+    void setBool(size_t row, size_t col, bool value);
+    void setDouble(size_t row, size_t col, double value);
+    void setString(size_t row, size_t col, const MyString& value);
+    void setString(size_t row, size_t col, const char* text, size_t length);
+    void setError(size_t row, size_t col, CellError error);
+    void setReference(size_t row, size_t col, size_t targetRow, size_t targetCol);
+    // The formula must have been created from getPool(); the storage takes ownership
+    void setObject(size_t row, size_t col, CellKind kind, BaseCell* object);
+    void erase(size_t row, size_t col);
+
+    // Runs the destructors that own memory and then drops all pool slabs at once
+    void clear();
+
+    CellPool& getPool();
+    const CellPool& getPool() const;
+    const StringInterner& getStrings() const;
+
+    // Structural edits cost O(rows) or O(cols) at most, and nothing when
+    // index lies past the last occupied row or column
+    void insertRow(size_t index);
+    void removeRow(size_t index);
+    void insertColumn(size_t index);
+    void removeColumn(size_t index);
+
+    // Drops every cell at or past the given logical row or column in one pass
+    void truncate(size_t rows, size_t cols);
+    // Capacity hint for a sheet of the given logical shape
+    void reserve(size_t rows, size_t cols);
+
+    // Stable ids of a logical position; they do not change when rows or
+    // columns are inserted or removed around it
+    size_t physicalRow(size_t row) const;
+    size_t physicalColumn(size_t col) const;
+
+    size_t getCellCount() const;
+    size_t getTileCount() const;
+
+    // Snapshot blocks. A block is the logical TILE_SIZE square at firstRow,
+    // firstCol: one valid bitmap per column, and for each column holding a
+    // cell a strip of TILE_SIZE payloads and one of TILE_SIZE kinds, as a tile
+    // keeps them.
+    // Copies the block's cells as full tile arrays, empty slots zeroed; false when it holds none
+    bool copyBlock(size_t firstRow, size_t firstCol, CellPayload* payload, CellKind* kinds, uint64_t* valid) const;
+    // Fills an unallocated block of a storage whose rows and columns never
+    // moved, from the strips of its occupied columns packed in column order.
+    // String payloads index textIds and formulas are refused; on false the
+    // block held something else and nothing was stored.
+    bool loadBlock(size_t firstRow, size_t firstCol, const uint64_t* valid, const CellPayload* payload,
+        const CellKind* kinds, const MyVector<uint32_t>& textIds);
+    // Interns a text for loadBlock, with one reference the caller releases
+    uint32_t internText(const char* text, size_t length);
+    void releaseText(uint32_t id);
+
+    // Visits every occupied cell in row-major order as visit(row, col)
+    template<typename Visitor>
+    void forEachCell(Visitor visit) const;
+
+    // Visits the allocated column strips of an inclusive range as
+    // visit(firstRow, col, payload, kinds, validMask, numericMask, count).
+    // Bit i of the masks describes row firstRow + i.
+    template<typename Visitor>
+    void forEachStrip(size_t startRow, size_t startCol, size_t endRow, size_t endCol, Visitor visit) const;
+};
+
+inline size_t CellStorage::physicalRow(size_t row) const {
+    size_t mapped = rowOrder.getSize();
+    return row < mapped ? rowOrder.atUnchecked(row) : rowTail + (row - mapped);
+}
+
+inline size_t CellStorage::physicalColumn(size_t col) const {
+    size_t mapped = columnOrder.getSize();
+    return col < mapped ? columnOrder.atUnchecked(col) : columnTail + (col - mapped);
+}
+
+template<typename Visitor>
+void CellStorage::forEachCell(Visitor visit) const {
+    if (rowOrder.getSize() == 0 && columnOrder.getSize() == 0) {
+        // Identity order, walk the allocated tiles directly
+        for (size_t b = 0; b < bands.getSize(); b++) {
+            const TileBand* band = bands[b];
+            if (band == nullptr || band->tileCount == 0) {
+                continue;
+            }
+
+            for (size_t r = 0; r < TILE_SIZE; r++) {
+                for (size_t t = 0; t < band->tiles.getSize(); t++) {
+                    const Tile* tile = band->tiles[t];
+                    if (tile == nullptr) {
+                        continue;
+                    }
+
+                    for (size_t c = 0; c < TILE_SIZE; c++) {
+                        if ((tile->valid[c] >> r) & 1) {
+                            visit(b * TILE_SIZE + r, t * TILE_SIZE + c);
+                        }
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    // Rows and columns moved: walk the order maps a run at a time, looking
+    // only at the tiles a band holds for the column runs
+    MyVector<OrderRun> rowRuns;
+    MyVector<OrderRun> columnRuns;
+    MyVector<const OrderRun*> held;
+    collectRuns(rowOrder, rowTail, rowExtent, rowRuns);
+    collectRuns(columnOrder, columnTail, columnExtent, columnRuns);
+
+    for (const OrderRun& rows : rowRuns) {
+        size_t bandIndex = rows.physical / TILE_SIZE;
+        if (bandIndex >= bands.getSize() || bands[bandIndex] == nullptr) {
+            continue;
+        }
+
+        const TileBand* band = bands[bandIndex];
+        held.clear();
+        for (const OrderRun& columns : columnRuns) {
+            size_t t = columns.physical / TILE_SIZE;
+            if (t < band->tiles.getSize() && band->tiles[t] != nullptr) {
+                held.push_back(&columns);
+            }
+        }
+
+        for (size_t r = 0; r < rows.count; r++) {
+            uint64_t bit = 1ULL << ((rows.physical + r) % TILE_SIZE);
+            for (const OrderRun* columns : held) {
+                const uint64_t* valid = band->tiles[columns->physical / TILE_SIZE]->valid + columns->physical % TILE_SIZE;
+                for (size_t c = 0; c < columns->count; c++) {
+                    if (valid[c] & bit) {
+                        visit(rows.logical + r, columns->logical + c);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template<typename Visitor>
+void CellStorage::forEachStrip(size_t startRow, size_t startCol, size_t endRow, size_t endCol, Visitor visit) const {
+    if (bands.getSize() == 0 || startRow > endRow || startCol > endCol) {
+        return;
+    }
+    if (endRow >= rowExtent) {
+        if (rowExtent == 0 || startRow >= rowExtent) {
+            return;
+        }
+        endRow = rowExtent - 1;
+    }
+
+    size_t row = startRow;
+    while (row <= endRow) {
+        // A run is a stretch of logical rows that sit consecutively in one tile
+        size_t physRow = physicalRow(row);
+        size_t first = physRow % TILE_SIZE;
+        size_t maxCount = TILE_SIZE - first;
+        if (maxCount > endRow - row + 1) {
+            maxCount = endRow - row + 1;
+        }
+
+        size_t count = 1;
+        if (row >= rowOrder.getSize()) {
+            count = maxCount;
+        }
+        else {
+            while (count < maxCount && physicalRow(row + count) == physRow + count) {
+                count++;
+            }
+        }
+
+        size_t bandIndex = physRow / TILE_SIZE;
+        const TileBand* band = bandIndex < bands.getSize() ? bands[bandIndex] : nullptr;
+        if (band == nullptr) {
+            row += count;
+            continue;
+        }
+
+        uint64_t window = count == TILE_SIZE ? ~0ULL : ((1ULL << count) - 1);
+
+        for (size_t col = startCol; col <= endCol; col++) {
+            size_t physCol = physicalColumn(col);
+            size_t t = physCol / TILE_SIZE;
+            const Tile* tile = t < band->tiles.getSize() ? band->tiles[t] : nullptr;
+            if (tile == nullptr) {
+                if (col >= columnOrder.getSize()) {
+                    // Past the column map ids are consecutive, skip the rest of the tile
+                    col += TILE_SIZE - 1 - physCol % TILE_SIZE;
+                }
+                continue;
+            }
+
+            size_t c = physCol % TILE_SIZE;
+            uint64_t validMask = (tile->valid[c] >> first) & window;
+            if (validMask == 0) {
+                continue;
+            }
+
+            size_t offset = c * TILE_SIZE + first;
+            visit(row, col, tile->payload + offset, tile->kinds + offset,
+                validMask, (tile->numeric[c] >> first) & window, count);
+        }
+
+        row += count;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include "CellKind.h"
+
+// Cell a REFERENCE points at
+struct CellTarget {
+    uint32_t row;
+    uint32_t col;
+};
+
+// Fixed-size value of one cell; readers switch on kind
+struct CellValue {
+    CellKind kind;
+    union {
+        int intValue;
+        bool boolValue;
+        double doubleValue;
+        uint32_t stringId;      // StringInterner id
+        CellTarget target;
+        size_t formula;         // handle of the FormulaCell in the storage
+        CellError error;
+    };
+
+    CellValue() : kind(CellKind::EMPTY), doubleValue(0.0) {}
+
+    static CellValue makeInt(int value) {
+        CellValue result;
+        result.kind = CellKind::INT;
+        result.intValue = value;
+        return result;
+    }
+
+    static CellValue makeBool(bool value) {
+        CellValue result;
+        result.kind = CellKind::BOOL;
+        result.boolValue = value;
+        return result;
+    }
+
+    static CellValue makeDouble(double value) {
+        CellValue result;
+        result.kind = CellKind::DOUBLE;
+        result.doubleValue = value;
+        return result;
+    }
+
+    static CellValue makeError(CellError error) {
+        CellValue result;
+        result.kind = CellKind::ERROR_VALUE;
+        result.error = error;
+        return result;
+    }
+
+    static CellValue makeReference(size_t row, size_t col) {
+        CellValue result;
+        result.kind = CellKind::REFERENCE;
+        result.target.row = static_cast<uint32_t>(row);
+        result.target.col = static_cast<uint32_t>(col);
+        return result;
+    }
+
+    bool isNumeric() const {
+        return isNumericKind(kind);
+    }
+};
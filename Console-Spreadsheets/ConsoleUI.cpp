@@ -2,12 +2,14 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <cstring>
 
 struct SimpleConfig {
     int initialTableRows;
     int initialTableCols;
     bool autoFit;
     int visibleCellSymbols;
+    int recalculationThreads;
 };
 
 // Simple string to int converter (replaces atoi)
@@ -29,6 +31,12 @@ int stringToInt(const char* str) {
     return negative ? -result : result;
 }
 
+// Files named *.tsv are tab separated, any other is comma separated
+static char csvDelimiter(const MyString& filename) {
+    size_t length = filename.length();
+    return length >= 4 && memcmp(filename.data() + length - 4, ".tsv", 4) == 0 ? '\t' : ',';
+}
+
 // Simple string search (replaces strstr)
 bool stringContains(const char* haystack, const char* needle) {
     int hayLen = 0, needleLen = 0;
@@ -63,6 +71,7 @@ bool loadSimpleConfig(const MyString& filename, SimpleConfig& config) {
     config.initialTableCols = 5;
     config.autoFit = true;
     config.visibleCellSymbols = 10;
+    config.recalculationThreads = 1;
 
     char line[1000];
     while (file.getline(line, 1000)) {
@@ -94,6 +103,14 @@ bool loadSimpleConfig(const MyString& filename, SimpleConfig& config) {
                 }
             }
         }
+        else if (stringContains(line, "recalculationThreads:")) {
+            for (int i = 0; line[i]; i++) {
+                if (line[i] == ':') {
+                    config.recalculationThreads = stringToInt(line + i + 1);
+                    break;
+                }
+            }
+        }
     }
 
     file.close();
@@ -157,9 +174,21 @@ void ConsoleUI::processCommand(const MyString& command) {
     else if (firstToken == MyString("show")) {
         handleDisplay();
     }
+    else if (firstToken == MyString("stats")) {
+        handleStats();
+    }
     else if (firstToken == MyString("save") && tokens.getSize() >= 2) {
         handleSave(tokens);
     }
+    else if (firstToken == MyString("snapshot") && tokens.getSize() >= 2) {
+        handleSnapshot(tokens);
+    }
+    else if (firstToken == MyString("import_csv") && tokens.getSize() >= 2) {
+        handleImportCsv(tokens);
+    }
+    else if (firstToken == MyString("export_csv") && tokens.getSize() >= 2) {
+        handleExportCsv(tokens);
+    }
     else if (firstToken == MyString("add_row")) {
         handleAddRow();
     }
@@ -173,21 +202,23 @@ void ConsoleUI::processCommand(const MyString& command) {
         handleCellDelete(tokens);
     }
     else if (tokens.getSize() >= 2 && tokens[1].data()[0] == '=') {
-        // Check if it's a formula (contains parentheses) or simple reference
-        MyString formula = tokens[1];
-        bool hasParentheses = false;
-        for (size_t i = 0; i < formula.length(); i++) {
-            if (formula.data()[i] == '(' || formula.data()[i] == ')') {
-                hasParentheses = true;
-                break;
-            }
+        // Check if it's a simple reference (letters then digits, like =B12) or a formula
+        const char* formula = tokens[1].data();
+        size_t i = 1;
+        while (i < tokens[1].length() && formula[i] >= 'A' && formula[i] <= 'Z') {
+            i++;
+        }
+        bool isReference = tokens.getSize() == 2 && i > 1 && i < tokens[1].length();
+        while (i < tokens[1].length() && isReference) {
+            isReference = formula[i] >= '0' && formula[i] <= '9';
+            i++;
         }
 
-        if (hasParentheses) {
-            handleCellFormula(tokens);
+        if (isReference) {
+            handleCellReference(tokens);
         }
         else {
-            handleCellReference(tokens);
+            handleCellFormula(tokens);
         }
     }
     else if (firstToken == MyString("insert_row") && tokens.getSize() >= 2) {
@@ -221,14 +252,7 @@ MyVector<MyString> ConsoleUI::parseCommand(const MyString& input) {
         if (i == len || str[i] == ' ') {
             if (i > start) {
                 // Create substring from start to i
-                size_t tokenLen = i - start;
-                char* buffer = new char[tokenLen + 1];
-                for (size_t j = 0; j < tokenLen; j++) {
-                    buffer[j] = str[start + j];
-                }
-                buffer[tokenLen] = '\0';
-                tokens.push_back(MyString(buffer));
-                delete[] buffer;
+                tokens.push_back(MyString(str + start, i - start));
             }
             start = i + 1;
         }
@@ -283,9 +307,9 @@ void ConsoleUI::handleCellInsert(const MyVector<MyString>& tokens) {
     MyString value;
     for (size_t i = 2; i < tokens.getSize(); i++) {
         if (i > 2) {
-            value = value + MyString(" ");
+            value.append(' ');
         }
-        value = value + tokens[i];
+        value.append(tokens[i]);
     }
 
     // Ensure table is large enough
@@ -347,14 +371,7 @@ void ConsoleUI::handleCellReference(const MyVector<MyString>& tokens) {
 
     // Extract the cell reference after the '=' sign
     const char* refStr = refString.data();
-    size_t refLen = refString.length() - 1;
-    char* refBuffer = new char[refLen + 1];
-    for (size_t i = 0; i < refLen; i++) {
-        refBuffer[i] = refStr[i + 1];
-    }
-    refBuffer[refLen] = '\0';
-    MyString referencedCell(refBuffer);
-    delete[] refBuffer;
+    MyString referencedCell(refStr + 1, refString.length() - 1);
 
     // Validate that the referenced cell exists within table bounds
     size_t refRow, refCol;
@@ -374,7 +391,7 @@ void ConsoleUI::handleCellReference(const MyVector<MyString>& tokens) {
 
 void ConsoleUI::handleCellFormula(const MyVector<MyString>& tokens) {
     if (tokens.getSize() < 2) {
-        printError(MyString("Usage: {cell} ={formulaName}({parameters})"));
+        printError(MyString("Usage: {cell} ={formula}"));
         return;
     }
 
@@ -391,7 +408,16 @@ void ConsoleUI::handleCellFormula(const MyVector<MyString>& tokens) {
         currentTable->resize(newRows, newCols);
     }
 
-    currentTable->setCell(row, col, tokens[1]);
+    // The formula may contain spaces, so all tokens after the cell are joined again
+    MyString formula;
+    for (size_t i = 1; i < tokens.getSize(); i++) {
+        if (i > 1) {
+            formula.append(' ');
+        }
+        formula.append(tokens[i]);
+    }
+
+    currentTable->setCell(row, col, formula);
     printSuccess(MyString("Formula cell created successfully"));
 }
 
@@ -532,6 +558,10 @@ void ConsoleUI::handleDisplay() {
     currentTable->display();
 }
 
+void ConsoleUI::handleStats() {
+    currentTable->displayMemoryStats();
+}
+
 void ConsoleUI::handleExit() {
     running = false;
     cout << "Goodbye!\n";
@@ -555,6 +585,7 @@ void ConsoleUI::handleOpen(const MyVector<MyString>& tokens) {
     // Create new table with config
     currentTable = new Table(config.initialTableRows, config.initialTableCols,
         config.autoFit, config.visibleCellSymbols);
+    currentTable->setRecalculationThreads(config.recalculationThreads > 0 ? config.recalculationThreads : 1);
 
     // Try to load table data
     MyString tableFile = tableName + MyString(".txt");
@@ -586,6 +617,7 @@ void ConsoleUI::handleNew(const MyVector<MyString>& tokens) {
     // Create table with config values
     currentTable = new Table(config.initialTableRows, config.initialTableCols,
         config.autoFit, config.visibleCellSymbols);
+    currentTable->setRecalculationThreads(config.recalculationThreads > 0 ? config.recalculationThreads : 1);
 
     printSuccess(MyString("New table created successfully"));
     currentTable->display();
@@ -611,6 +643,55 @@ void ConsoleUI::handleSave(const MyVector<MyString>& tokens) {
     }
 }
 
+void ConsoleUI::handleSnapshot(const MyVector<MyString>& tokens) {
+    if (!currentTable) {
+        printError(MyString("No table to save"));
+        return;
+    }
+
+    if (tokens.getSize() < 2) {
+        printError(MyString("Usage: snapshot {filename}"));
+        return;
+    }
+
+    // Same name as a text save, so open finds it; the format is detected on loading
+    MyString filename = tokens[1] + MyString(".txt");
+    if (currentTable->saveSnapshot(filename)) {
+        printSuccess(MyString("Snapshot saved successfully"));
+    }
+    else {
+        printError(MyString("Failed to save snapshot"));
+    }
+}
+
+void ConsoleUI::handleImportCsv(const MyVector<MyString>& tokens) {
+    if (tokens.getSize() < 2) {
+        printError(MyString("Usage: import_csv {filename}"));
+        return;
+    }
+
+    if (currentTable->importCsv(tokens[1], csvDelimiter(tokens[1]))) {
+        printSuccess(MyString("Table imported successfully"));
+    }
+    else {
+        printError(MyString("Failed to import table"));
+    }
+}
+
+void ConsoleUI::handleExportCsv(const MyVector<MyString>& tokens) {
+    if (tokens.getSize() < 2) {
+        printError(MyString("Usage: export_csv {filename}"));
+        return;
+    }
+
+    if (currentTable->exportCsv(tokens[1], csvDelimiter(tokens[1]))) {
+        printSuccess(MyString("Table exported successfully"));
+    }
+    else {
+        printError(MyString("Failed to export table"));
+    }
+}
+
 void ConsoleUI::printError(const MyString& message) {
     cout << "Error: " << message.data() << "\n";
 }
@@ -630,6 +711,9 @@ void ConsoleUI::showCommands() {
         cout << "  {cell} ={referenceCell}        - Create cell reference (e.g., C3 =A1)\n";
         cout << "  {cell} ={formula}              - Create formula (e.g., A5 =SUM(A1:C3,6))\n";
         cout << "  save {filename}                - Save table to file\n";
+        cout << "  snapshot {filename}            - Save table as a binary snapshot\n";
+        cout << "  import_csv {filename}          - Replace contents with a CSV file (.tsv: tab separated)\n";
+        cout << "  export_csv {filename}          - Write shown values as CSV (.tsv: tab separated)\n";
         cout << "  add_row                        - Add row at the end\n";
         cout << "  add_col                        - Add column at the end\n";
         cout << "  insert_row {index}             - Insert row at index\n";
@@ -638,6 +722,7 @@ void ConsoleUI::showCommands() {
         cout << "  remove_col {index}             - Remove column at index\n";
         cout << "  resize {rows} {cols}           - Resize table\n";
         cout << "  show                           - Display current table\n";
+        cout << "  stats                          - Show cell memory usage\n";
     }
 
     cout << "  exit                           - Exit program\n";
@@ -23,11 +23,15 @@ private:
     void handleRemoveRow(const MyVector<MyString>& tokens);
     void handleRemoveColumn(const MyVector<MyString>& tokens);
     void handleDisplay();
+    void handleStats();
     void handleResize(const MyVector<MyString>& tokens);
     void handleExit();
     void handleOpen(const MyVector<MyString>& tokens);
     void handleNew(const MyVector<MyString>& tokens);
     void handleSave(const MyVector<MyString>& tokens);
+    void handleSnapshot(const MyVector<MyString>& tokens);
+    void handleImportCsv(const MyVector<MyString>& tokens);
+    void handleExportCsv(const MyVector<MyString>& tokens);
 
     // Utility methods
     void printError(const MyString& message);
@@ -0,0 +1,193 @@
+#include "Criteria.h"
+#include "BufferedIO.h"
+#include "LookupIndex.h"
+#include "Table.h"
+#include <cstring>
+
+Criteria::Criteria() : op(CompareOp::EQUAL), numeric(false), number(0.0) {
+}
+
+// An optional minus, digits and an optional fraction, like formula numbers
+bool Criteria::parseNumber(const char* source, size_t length, double& value) {
+    size_t position = 0;
+    bool negative = length > 0 && source[0] == '-';
+    if (negative) {
+        position++;
+    }
+
+    value = 0.0;
+    size_t digits = 0;
+    while (position < length && source[position] >= '0' && source[position] <= '9') {
+        value = value * 10.0 + (source[position++] - '0');
+        digits++;
+    }
+    if (position < length && source[position] == '.') {
+        position++;
+        double fraction = 0.0;
+        double scale = 1.0;
+        while (position < length && source[position] >= '0' && source[position] <= '9') {
+            fraction = fraction * 10.0 + (source[position++] - '0');
+            scale *= 10.0;
+            digits++;
+        }
+        value += fraction / scale;
+    }
+
+    if (digits == 0 || position != length) {
+        return false;
+    }
+    if (negative) {
+        value = -value;
+    }
+    return true;
+}
+
+Criteria Criteria::parse(const char* source, size_t length) {
+    Criteria result;
+    size_t start = 0;
+    if (length >= 2 && source[0] == '<' && source[1] == '=') {
+        result.op = CompareOp::LESS_EQUAL;
+        start = 2;
+    }
+    else if (length >= 2 && source[0] == '>' && source[1] == '=') {
+        result.op = CompareOp::GREATER_EQUAL;
+        start = 2;
+    }
+    else if (length >= 2 && source[0] == '<' && source[1] == '>') {
+        result.op = CompareOp::NOT_EQUAL;
+        start = 2;
+    }
+    else if (length >= 1 && (source[0] == '<' || source[0] == '>' || source[0] == '=')) {
+        result.op = source[0] == '<' ? CompareOp::LESS : (source[0] == '>' ? CompareOp::GREATER : CompareOp::EQUAL);
+        start = 1;
+    }
+
+    const char* value = source + start;
+    size_t valueLength = length - start;
+    if (parseNumber(value, valueLength, result.number)) {
+        result.numeric = true;
+    }
+    else if ((valueLength == 4 && memcmp(value, "true", 4) == 0) || (valueLength == 5 && memcmp(value, "false", 5) == 0)) {
+        result.numeric = true;
+        result.number = valueLength == 4 ? 1.0 : 0.0;
+    }
+    else {
+        result.text = MyString(value, valueLength);
+    }
+    return result;
+}
+
+Criteria Criteria::fromNumber(double value) {
+    Criteria result;
+    result.numeric = true;
+    result.number = value;
+    return result;
+}
+
+bool Criteria::matchesEmpty() const {
+    if (!numeric && text.length() == 0) {
+        return op == CompareOp::EQUAL;
+    }
+    return op == CompareOp::NOT_EQUAL;
+}
+
+bool Criteria::holds(int order) const {
+    switch (op) {
+    case CompareOp::EQUAL:
+        return order == 0;
+    case CompareOp::NOT_EQUAL:
+        return order != 0;
+    case CompareOp::LESS:
+        return order < 0;
+    case CompareOp::LESS_EQUAL:
+        return order <= 0;
+    case CompareOp::GREATER:
+        return order > 0;
+    default:
+        return order >= 0;
+    }
+}
+
+bool Criteria::matchesCached(const Table& table, size_t row, size_t col) const {
+    const DependencyNode* node = table.getCachedResult(row, col);
+    if (node == nullptr || node->error != CellError::NONE) {
+        return false;
+    }
+
+    if ((node->kind == CellKind::STRING) == numeric) {
+        return op == CompareOp::NOT_EQUAL;
+    }
+    if (numeric) {
+        return holds(node->number < number ? -1 : (node->number > number ? 1 : 0));
+    }
+    return holds(LookupIndex::compareText(node->text.data(), node->text.length(), text.data(), text.length()));
+}
+
+uint64_t Criteria::matchRows(const Table& table, size_t row, size_t col, size_t count) const {
+    const StringInterner& strings = table.getStorage().getStrings();
+    uint64_t matched = matchesEmpty() ? (count >= 64 ? ~0ULL : (1ULL << count) - 1) : 0;
+
+    // Texts equal to the criterion share its interned id; without an id no cell holds it
+    uint32_t id = 0;
+    bool interned = !numeric && strings.find(text.data(), text.length(), id);
+
+    // Unallocated strips are left empty; in the others each occupied lane
+    // replaces its bit. Numbers are compared a strip at a time.
+    table.getStorage().forEachStrip(row, col, row + count - 1, col,
+        [&](size_t firstRow, size_t stripCol, const CellPayload* payload, const CellKind* kinds,
+            uint64_t validMask, uint64_t numericMask, size_t laneCount) {
+            uint64_t lanes = numeric
+                ? AggregateKernels::compareLanes(payload, numericMask, laneCount, op, number)
+                : (op == CompareOp::NOT_EQUAL ? numericMask : 0);
+
+            uint64_t others = validMask & ~numericMask;
+            for (size_t i = 0; i < laneCount && (others >> i) != 0; i++) {
+                if (((others >> i) & 1) == 0) {
+                    continue;
+                }
+
+                bool match = false;
+                if (kinds[i] == CellKind::STRING) {
+                    uint32_t textId = static_cast<uint32_t>(payload[i].handle);
+                    if (numeric) {
+                        match = op == CompareOp::NOT_EQUAL;
+                    }
+                    else if (op == CompareOp::EQUAL || op == CompareOp::NOT_EQUAL) {
+                        match = (interned && textId == id) == (op == CompareOp::EQUAL);
+                    }
+                    else {
+                        match = holds(LookupIndex::compareText(strings.getText(textId), strings.getLength(textId), text.data(), text.length()));
+                    }
+                }
+                else if (kinds[i] == CellKind::REFERENCE || kinds[i] == CellKind::FORMULA) {
+                    match = matchesCached(table, firstRow + i, stripCol);
+                }
+                lanes |= static_cast<uint64_t>(match) << i;
+            }
+
+            size_t shift = firstRow - row;
+            matched = (matched & ~(validMask << shift)) | (lanes << shift);
+        });
+    return matched;
+}
+
+void Criteria::writeTo(BufferedWriter& out) const {
+    out.writeValue(static_cast<unsigned char>(op));
+    out.writeValue(static_cast<unsigned char>(numeric));
+    out.writeValue(number);
+    out.writeValue(static_cast<uint64_t>(text.length()));
+    out.write(text.data(), text.length());
+}
+
+bool Criteria::readFrom(MemoryReader& in) {
+    unsigned char opCode = 0, isNumeric = 0;
+    uint64_t length = 0;
+    if (!in.readValue(opCode) || !in.readValue(isNumeric) || !in.readValue(number) || !in.readValue(length)
+        || opCode > static_cast<unsigned char>(CompareOp::GREATER_EQUAL) || length > in.getRemaining()) {
+        return false;
+    }
+    op = static_cast<CompareOp>(opCode);
+    numeric = isNumeric != 0;
+    text = MyString(in.take(static_cast<size_t>(length)), static_cast<size_t>(length));
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include "AggregateKernels.h"
+#include "CellStorage.h"
+#include "MyString.h"
+
+class Table; // Forward declaration
+class BufferedWriter;
+class MemoryReader;
+
+// Condition of SUMIF, COUNTIF and the like, compiled once from its text: an
+// optional comparison operator (=, <>, <, <=, >, >=) and a number, true or
+// false, or a text. Numbers, booleans included, only compare with numbers and
+// texts with texts by their bytes; a cell of the other kind only matches <>.
+// Empty cells match "", "=" and any <> but "<>" itself; errors match nothing.
+class Criteria {
+    CompareOp op;
+    bool numeric;
+    double number;
+    MyString text;
+
+    static bool parseNumber(const char* source, size_t length, double& value);
+    bool holds(int order) const;
+    // Matches a result cached for a reference or formula
+    bool matchesCached(const Table& table, size_t row, size_t col) const;
+
+public:
+    Criteria();
+
+    static Criteria parse(const char* source, size_t length);
+    static Criteria fromNumber(double value);
+
+    bool matchesEmpty() const;
+
+    // Mask of the rows [row, row + count) of the column that match; count is at most 64
+    uint64_t matchRows(const Table& table, size_t row, size_t col, size_t count) const;
+
+    // Snapshot form: operator, kind and number, then the length-prefixed text
+    void writeTo(BufferedWriter& out) const;
+    bool readFrom(MemoryReader& in);
+};
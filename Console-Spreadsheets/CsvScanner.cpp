@@ -0,0 +1,179 @@
+#include "CsvScanner.h"
+#include "AggregateKernels.h"
+#include <cstring>
+
+// SSE2 is part of every x64 CPU and of the x86 baseline MSVC targets
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define CSV_SSE2 1
+#include <emmintrin.h>
+#endif
+
+const size_t CsvScanner::BLOCK_SIZE;
+
+namespace {
+    // Bit i of each mask stands for byte i of the block; bytes past available are left out
+    void classifyBlock(const char* data, size_t available, char delimiter,
+        uint64_t& quotes, uint64_t& delimiters, uint64_t& lineEnds) {
+        char padded[CsvScanner::BLOCK_SIZE];
+        if (available < CsvScanner::BLOCK_SIZE) {
+            memset(padded, 0, sizeof(padded));
+            memcpy(padded, data, available);
+            data = padded;
+        }
+
+        quotes = delimiters = lineEnds = 0;
+#ifdef CSV_SSE2
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i separator = _mm_set1_epi8(delimiter);
+        const __m128i newline = _mm_set1_epi8('\n');
+        for (size_t i = 0; i < CsvScanner::BLOCK_SIZE; i += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            quotes |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quote)))) << i;
+            delimiters |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, separator)))) << i;
+            lineEnds |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)))) << i;
+        }
+#else
+        for (size_t i = 0; i < CsvScanner::BLOCK_SIZE; i++) {
+            quotes |= static_cast<uint64_t>(data[i] == '"') << i;
+            delimiters |= static_cast<uint64_t>(data[i] == delimiter) << i;
+            lineEnds |= static_cast<uint64_t>(data[i] == '\n') << i;
+        }
+#endif
+
+        if (available < CsvScanner::BLOCK_SIZE) {
+            uint64_t valid = (1ULL << available) - 1;
+            quotes &= valid;
+            delimiters &= valid;
+            lineEnds &= valid;
+        }
+    }
+
+    // Bit i becomes the XOR of bits 0..i: set from an opening quote up to the closing one
+    uint64_t prefixXor(uint64_t bits) {
+        bits ^= bits << 1;
+        bits ^= bits << 2;
+        bits ^= bits << 4;
+        bits ^= bits << 8;
+        bits ^= bits << 16;
+        bits ^= bits << 32;
+        return bits;
+    }
+
+    size_t lowestBitIndex(uint64_t bit) {
+        return AggregateKernels::countLanes(bit - 1, 64);
+    }
+}
+
+CsvScanner::CsvScanner(const char* start, const char* end, char delimiter, bool insideQuotes)
+    : block(start), end(end), delimiter(delimiter), separators(0), lineEnds(0),
+      quoted(insideQuotes ? ~0ULL : 0), fieldStart(start), recordOpen(false), finished(start >= end) {
+    if (!finished) {
+        loadBlock();
+    }
+}
+
+void CsvScanner::loadBlock() {
+    uint64_t quotes, delimiters, newlines;
+    classifyBlock(block, static_cast<size_t>(end - block), delimiter, quotes, delimiters, newlines);
+
+    uint64_t inside = prefixXor(quotes) ^ quoted;
+    quoted = 0 - (inside >> 63);
+    lineEnds = newlines & ~inside;
+    separators = (delimiters | newlines) & ~inside;
+}
+
+bool CsvScanner::next(const char*& field, size_t& length, bool& lastInRecord) {
+    if (finished) {
+        return false;
+    }
+
+    while (separators == 0) {
+        block += BLOCK_SIZE;
+        if (block >= end) {
+            // The text ends without a line end: what is left is the last field
+            finished = true;
+            if (fieldStart >= end && !recordOpen) {
+                return false;
+            }
+            field = fieldStart;
+            length = static_cast<size_t>(end - fieldStart);
+            lastInRecord = true;
+            if (length > 0 && field[length - 1] == '\r') {
+                length--;
+            }
+            return true;
+        }
+        loadBlock();
+    }
+
+    uint64_t bit = separators & (0 - separators);
+    separators ^= bit;
+    const char* separator = block + lowestBitIndex(bit);
+
+    field = fieldStart;
+    length = static_cast<size_t>(separator - fieldStart);
+    lastInRecord = (lineEnds & bit) != 0;
+    if (lastInRecord && length > 0 && field[length - 1] == '\r') {
+        length--;
+    }
+    recordOpen = !lastInRecord;
+    fieldStart = separator + 1;
+    return true;
+}
+
+const char* CsvScanner::getPosition() const {
+    return fieldStart;
+}
+
+bool CsvScanner::skipRecord() {
+    while (!finished) {
+        uint64_t pending = separators & lineEnds;
+        if (pending != 0) {
+            uint64_t bit = pending & (0 - pending);
+            separators &= ~(bit | (bit - 1));
+            fieldStart = block + lowestBitIndex(bit) + 1;
+            recordOpen = false;
+            return true;
+        }
+
+        block += BLOCK_SIZE;
+        if (block >= end) {
+            finished = true;
+            fieldStart = end;
+            return false;
+        }
+        loadBlock();
+    }
+    return false;
+}
+
+size_t CsvScanner::countQuotes(const char* start, const char* end) {
+    size_t count = 0;
+    for (const char* block = start; block < end; block += BLOCK_SIZE) {
+        uint64_t quotes, delimiters, lineEnds;
+        classifyBlock(block, static_cast<size_t>(end - block), '"', quotes, delimiters, lineEnds);
+        count += AggregateKernels::countLanes(quotes, 64);
+    }
+    return count;
+}
+
+void CsvScanner::unquote(const char*& field, size_t& length, bool& wasQuoted, bool& hasEscapes) {
+    wasQuoted = length >= 2 && field[0] == '"' && field[length - 1] == '"';
+    hasEscapes = false;
+    if (wasQuoted) {
+        field++;
+        length -= 2;
+        hasEscapes = memchr(field, '"', length) != nullptr;
+    }
+}
+
+size_t CsvScanner::unescape(const char* field, size_t length, char* target) {
+    size_t written = 0;
+    for (size_t i = 0; i < length; i++) {
+        target[written++] = field[i];
+        if (field[i] == '"' && i + 1 < length && field[i + 1] == '"') {
+            i++;
+        }
+    }
+    return written;
+}
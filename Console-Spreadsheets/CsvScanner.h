@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Splits CSV or TSV text into fields. The bytes are classified 64 at a time
+// into bit masks of quotes, delimiters and line ends, and a prefix XOR of the
+// quote bits marks the quoted stretches, so separators inside quotes drop out
+// without a byte-by-byte state machine. Every quote toggles quoting; a doubled
+// quote inside a quoted field toggles twice and stays in the field.
+class CsvScanner {
+    const char* block;          // first byte of the current block
+    const char* end;
+    char delimiter;
+    uint64_t separators;        // unquoted delimiters and line ends of the block not consumed yet
+    uint64_t lineEnds;          // unquoted line ends of the block
+    uint64_t quoted;            // all ones when the bytes before the block end inside quotes
+    const char* fieldStart;
+    bool recordOpen;            // a delimiter was passed since the last line end
+    bool finished;
+
+    void loadBlock();
+
+public:
+    static const size_t BLOCK_SIZE = 64;
+
+    // Scans [start, end); insideQuotes tells whether start lies within a quoted field
+    CsvScanner(const char* start, const char* end, char delimiter, bool insideQuotes);
+
+    // Next field as it appears in the text, quotes included but the \r of a
+    // \r\n line end left out, and whether it is the last of its record.
+    // False once the text is used up.
+    bool next(const char*& field, size_t& length, bool& lastInRecord);
+
+    // Where the next field starts
+    const char* getPosition() const;
+
+    // Moves past the next unquoted line end; false when there is none
+    bool skipRecord();
+
+    // Number of quote characters in [start, end)
+    static size_t countQuotes(const char* start, const char* end);
+
+    // Content of a field: quotes around it are dropped, and hasEscapes tells
+    // whether doubled quotes remain to be undone by unescape
+    static void unquote(const char*& field, size_t& length, bool& wasQuoted, bool& hasEscapes);
+    // Copies the content of a quoted field to target, one quote per doubled
+    // pair; target needs room for length bytes. Returns the bytes written.
+    static size_t unescape(const char* field, size_t length, char* target);
+};
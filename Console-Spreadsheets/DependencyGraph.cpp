@@ -0,0 +1,516 @@
+#include "DependencyGraph.h"
+
+const size_t DependencyGraph::BLOCK_SIZE;
+const size_t DependencyGraph::SMALL_RANGE_CELLS;
+
+DependencyGraph::DependencyGraph() : everythingDirty(false), stampCounter(0) {
+}
+
+bool DependencyGraph::isSmall(const Precedent& precedent) {
+    size_t rows = precedent.endRow - precedent.startRow + 1;
+    size_t cols = precedent.endCol - precedent.startCol + 1;
+    return rows <= SMALL_RANGE_CELLS && cols <= SMALL_RANGE_CELLS && rows * cols <= SMALL_RANGE_CELLS;
+}
+
+bool DependencyGraph::reads(const DependencyNode& node, const Precedent& range) {
+    if (!node.live) {
+        return false;
+    }
+    for (const Precedent& precedent : node.precedents) {
+        if (precedent == range) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void DependencyGraph::addReader(MyVector<uint32_t>& readers, uint32_t id) {
+    // A node registers its precedents one after another, so a repeat is always the last entry
+    if (readers.getSize() == 0 || readers[readers.getSize() - 1] != id) {
+        readers.push_back(id);
+    }
+}
+
+void DependencyGraph::removeReader(MyVector<uint32_t>* readers, uint32_t id) {
+    if (readers == nullptr) {
+        return;
+    }
+
+    for (size_t i = 0; i < readers->getSize(); i++) {
+        if ((*readers)[i] == id) {
+            (*readers)[i] = (*readers)[readers->getSize() - 1];
+            readers->pop_back();
+            return;
+        }
+    }
+}
+
+uint32_t DependencyGraph::findGroup(const Precedent& range) {
+    const MyVector<uint32_t>* candidates = groupsAt.find(range.startRow, range.startCol);
+    if (candidates != nullptr) {
+        for (uint32_t group : *candidates) {
+            if (groups[group].range == range) {
+                return group;
+            }
+        }
+    }
+    return static_cast<uint32_t>(groups.getSize());
+}
+
+uint32_t DependencyGraph::addGroup(const Precedent& range) {
+    uint32_t group;
+    if (freeGroups.getSize() > 0) {
+        group = freeGroups.pop_back();
+    }
+    else {
+        group = static_cast<uint32_t>(groups.getSize());
+        groups.emplace_back();
+    }
+    groups[group].range = range;
+    groupsAt.get(range.startRow, range.startCol).push_back(group);
+
+    for (size_t br = range.startRow / BLOCK_SIZE; br <= range.endRow / BLOCK_SIZE; br++) {
+        for (size_t bc = range.startCol / BLOCK_SIZE; bc <= range.endCol / BLOCK_SIZE; bc++) {
+            blockGroups.get(br, bc).push_back(group);
+        }
+    }
+    return group;
+}
+
+void DependencyGraph::releaseGroup(uint32_t group) {
+    Precedent range = groups[group].range;
+    for (size_t br = range.startRow / BLOCK_SIZE; br <= range.endRow / BLOCK_SIZE; br++) {
+        for (size_t bc = range.startCol / BLOCK_SIZE; bc <= range.endCol / BLOCK_SIZE; bc++) {
+            removeReader(blockGroups.find(br, bc), group);
+        }
+    }
+
+    MyVector<uint32_t>* candidates = groupsAt.find(range.startRow, range.startCol);
+    removeReader(candidates, group);
+    if (candidates->getSize() == 0) {
+        groupsAt.erase(range.startRow, range.startCol);
+    }
+
+    groups[group] = RangeGroup();
+    freeGroups.push_back(group);
+}
+
+// Keeps each node that still reads the range once
+void DependencyGraph::compactGroup(RangeGroup& group) {
+    size_t seen = ++stampCounter;
+    size_t kept = 0;
+    for (size_t i = 0; i < group.readers.getSize(); i++) {
+        DependencyNode& node = nodes[group.readers[i]];
+        if (node.stamp != seen && reads(node, group.range)) {
+            node.stamp = seen;
+            group.readers[kept++] = group.readers[i];
+        }
+    }
+    group.readers.resize(kept);
+}
+
+void DependencyGraph::unregister(uint32_t id) {
+    // The node is dead before its groups are touched, so compaction drops it
+    DependencyNode& node = nodes[id];
+    MyVector<Precedent> precedents = move(node.precedents);
+    nodeAt.erase(node.row, node.col);
+    node = DependencyNode();
+    freeNodes.push_back(id);
+
+    size_t seen = ++stampCounter;
+    for (const Precedent& precedent : precedents) {
+        if (isSmall(precedent)) {
+            for (size_t row = precedent.startRow; row <= precedent.endRow; row++) {
+                for (size_t col = precedent.startCol; col <= precedent.endCol; col++) {
+                    removeReader(cellReaders.find(row, col), id);
+                }
+            }
+            continue;
+        }
+
+        // A range read twice may have gone with its first occurrence
+        uint32_t group = findGroup(precedent);
+        if (group == groups.getSize() || groups[group].stamp == seen) {
+            continue;
+        }
+        groups[group].stamp = seen;
+        if (--groups[group].liveReaders == 0) {
+            releaseGroup(group);
+        }
+        else if (groups[group].readers.getSize() > groups[group].liveReaders * 2 + 8) {
+            compactGroup(groups[group]);
+        }
+    }
+}
+
+void DependencyGraph::setNode(size_t row, size_t col, const MyVector<Precedent>& precedents) {
+    removeNode(row, col);
+
+    uint32_t id;
+    if (freeNodes.getSize() > 0) {
+        id = freeNodes.pop_back();
+    }
+    else {
+        id = static_cast<uint32_t>(nodes.getSize());
+        nodes.emplace_back();
+    }
+
+    DependencyNode& node = nodes[id];
+    node.row = row;
+    node.col = col;
+    node.precedents = precedents;
+    node.live = true;
+    nodeAt.get(row, col) = id;
+
+    // A range read twice by one node is one reader of its group
+    size_t seen = ++stampCounter;
+    for (const Precedent& precedent : precedents) {
+        if (isSmall(precedent)) {
+            for (size_t row = precedent.startRow; row <= precedent.endRow; row++) {
+                for (size_t col = precedent.startCol; col <= precedent.endCol; col++) {
+                    addReader(cellReaders.get(row, col), id);
+                }
+            }
+            continue;
+        }
+
+        uint32_t group = findGroup(precedent);
+        if (group == groups.getSize()) {
+            group = addGroup(precedent);
+        }
+        RangeGroup& ranged = groups[group];
+        if (ranged.stamp != seen) {
+            ranged.stamp = seen;
+            ranged.readers.push_back(id);
+            ranged.liveReaders++;
+        }
+    }
+}
+
+void DependencyGraph::removeNode(size_t row, size_t col) {
+    const uint32_t* id = nodeAt.find(row, col);
+    if (id != nullptr) {
+        unregister(*id);
+    }
+}
+
+void DependencyGraph::moveRows(size_t index, bool inserted) {
+    moveNodes(index, inserted, true);
+}
+
+void DependencyGraph::moveColumns(size_t index, bool inserted) {
+    moveNodes(index, inserted, false);
+}
+
+void DependencyGraph::moveNodes(size_t index, bool inserted, bool alongRows) {
+    // Every old key goes before a new one is set, a node may take a neighbour's old place
+    MyVector<uint32_t> moved;
+    for (size_t id = 0; id < nodes.getSize(); id++) {
+        DependencyNode& node = nodes[id];
+        size_t& line = alongRows ? node.row : node.col;
+        if (node.live && line >= index) {
+            nodeAt.erase(node.row, node.col);
+            line = inserted ? line + 1 : line - 1;
+            moved.push_back(static_cast<uint32_t>(id));
+        }
+    }
+    for (uint32_t id : moved) {
+        nodeAt.get(nodes[id].row, nodes[id].col) = id;
+    }
+
+    // Edits not recalculated yet move with their cells; those on a removed line have no cell left
+    size_t kept = 0;
+    for (size_t i = 0; i < changed.getSize(); i++) {
+        size_t row = PositionMap<uint32_t>::keyRow(changed[i]);
+        size_t col = PositionMap<uint32_t>::keyCol(changed[i]);
+        size_t& line = alongRows ? row : col;
+        if (!inserted && line == index) {
+            continue;
+        }
+        if (line >= index) {
+            line = inserted ? line + 1 : line - 1;
+        }
+        changed[kept++] = PositionMap<uint32_t>::makeKey(row, col);
+    }
+    changed.resize(kept);
+}
+
+void DependencyGraph::markChanged(size_t row, size_t col) {
+    if (!everythingDirty) {
+        changed.push_back(PositionMap<uint32_t>::makeKey(row, col));
+    }
+}
+
+void DependencyGraph::markAllDirty() {
+    everythingDirty = true;
+    changed.clear();
+}
+
+bool DependencyGraph::hasPendingChanges() const {
+    return everythingDirty || changed.getSize() > 0;
+}
+
+void DependencyGraph::collectReaders(size_t row, size_t col, MyVector<uint32_t>& readers, size_t pass) {
+    size_t seen = ++stampCounter;
+
+    const MyVector<uint32_t>* direct = cellReaders.find(row, col);
+    if (direct != nullptr) {
+        for (uint32_t id : *direct) {
+            if (nodes[id].stamp != seen) {
+                nodes[id].stamp = seen;
+                readers.push_back(id);
+            }
+        }
+    }
+
+    const MyVector<uint32_t>* ranged = blockGroups.find(row / BLOCK_SIZE, col / BLOCK_SIZE);
+    if (ranged != nullptr) {
+        for (uint32_t group : *ranged) {
+            RangeGroup& candidate = groups[group];
+            if (!candidate.range.contains(row, col) || (pass != 0 && candidate.expanded == pass)) {
+                continue;
+            }
+            candidate.expanded = pass;
+            for (uint32_t id : candidate.readers) {
+                DependencyNode& node = nodes[id];
+                if (node.stamp != seen && reads(node, candidate.range)) {
+                    node.stamp = seen;
+                    readers.push_back(id);
+                }
+            }
+        }
+    }
+}
+
+void DependencyGraph::takeDirtyNodes(MyVector<uint32_t>& order, MyVector<size_t>& levels, MyVector<uint32_t>& cycles) {
+    order.clear();
+    levels.clear();
+    cycles.clear();
+
+    // Gather the stale nodes: the edited cells' readers and everything downstream of them
+    MyVector<uint32_t> affected;
+    MyVector<uint32_t> readers;
+    MyVector<bool> inAffected;
+    inAffected.resize(nodes.getSize());
+
+    if (everythingDirty) {
+        for (size_t id = 0; id < nodes.getSize(); id++) {
+            if (nodes[id].live) {
+                inAffected[id] = true;
+                affected.push_back(static_cast<uint32_t>(id));
+            }
+        }
+    }
+    else {
+        // A range group queues all its readers the first time, so edits down a
+        // column many formulas read cost no more than one
+        size_t pass = ++stampCounter;
+        for (uint64_t key : changed) {
+            size_t row = PositionMap<uint32_t>::keyRow(key);
+            size_t col = PositionMap<uint32_t>::keyCol(key);
+
+            readers.clear();
+            const uint32_t* self = nodeAt.find(row, col);
+            if (self != nullptr) {
+                readers.push_back(*self);
+            }
+            collectReaders(row, col, readers, pass);
+
+            for (uint32_t id : readers) {
+                if (!inAffected[id]) {
+                    inAffected[id] = true;
+                    affected.push_back(id);
+                }
+            }
+        }
+    }
+
+    // Record the edges between stale nodes and count how many stale precedents each one waits for
+    MyVector<uint32_t> pending;
+    MyVector<size_t> edgeStart;
+    MyVector<uint32_t> edges;
+    pending.resize(nodes.getSize());
+
+    for (size_t i = 0; i < affected.getSize(); i++) {
+        const DependencyNode& node = nodes[affected[i]];
+        readers.clear();
+        collectReaders(node.row, node.col, readers);
+
+        edgeStart.push_back(edges.getSize());
+        for (uint32_t id : readers) {
+            if (!inAffected[id]) {
+                inAffected[id] = true;
+                affected.push_back(id);
+            }
+            edges.push_back(id);
+            pending[id]++;
+        }
+    }
+    edgeStart.push_back(edges.getSize());
+
+    MyVector<size_t> position;
+    position.resize(nodes.getSize());
+    for (size_t i = 0; i < affected.getSize(); i++) {
+        position[affected[i]] = i;
+    }
+
+    // Kahn's algorithm. The queue is consumed first in, first out, so a node becomes
+    // ready while the level before its own is processed and each level is contiguous.
+    auto drain = [&](size_t next) {
+        if (next == order.getSize()) {
+            return;
+        }
+        if (levels.getSize() == 0) {
+            levels.push_back(next);
+        }
+        size_t levelEnd = order.getSize();
+        for (; next < order.getSize(); next++) {
+            if (next == levelEnd) {
+                levels.push_back(next);
+                levelEnd = order.getSize();
+            }
+            size_t i = position[order[next]];
+            for (size_t e = edgeStart[i]; e < edgeStart[i + 1]; e++) {
+                uint32_t reader = edges[e];
+                if (--pending[reader] == 0) {
+                    order.push_back(reader);
+                }
+            }
+        }
+        levels.push_back(order.getSize());
+    };
+
+    for (uint32_t id : affected) {
+        if (pending[id] == 0) {
+            order.push_back(id);
+        }
+    }
+    drain(0);
+
+    // Whatever never became ready sits on a cycle or reads one. Tarjan's algorithm
+    // over that remainder finds the strongly connected components; it keeps its own
+    // stack of frames, so chains of any length cannot exhaust the call stack.
+    MyVector<uint32_t> index;
+    MyVector<uint32_t> lowLink;
+    MyVector<bool> onStack;
+    MyVector<bool> isCyclic;
+    MyVector<uint32_t> component;
+    MyVector<TarjanFrame> frames;
+    uint32_t nextIndex = 1;
+
+    for (uint32_t root : affected) {
+        if (pending[root] == 0 || (index.getSize() > 0 && index[root] != 0)) {
+            continue;
+        }
+        if (index.getSize() == 0) {
+            index.resize(nodes.getSize());
+            lowLink.resize(nodes.getSize());
+            onStack.resize(nodes.getSize());
+            isCyclic.resize(nodes.getSize());
+        }
+
+        TarjanFrame first = { root, edgeStart[position[root]] };
+        frames.push_back(first);
+        index[root] = lowLink[root] = nextIndex++;
+        component.push_back(root);
+        onStack[root] = true;
+
+        while (frames.getSize() > 0) {
+            TarjanFrame& frame = frames[frames.getSize() - 1];
+            uint32_t id = frame.id;
+            if (frame.edge < edgeStart[position[id] + 1]) {
+                uint32_t reader = edges[frame.edge++];
+                if (pending[reader] == 0) {
+                    continue;
+                }
+                if (index[reader] == 0) {
+                    TarjanFrame next = { reader, edgeStart[position[reader]] };
+                    frames.push_back(next);
+                    index[reader] = lowLink[reader] = nextIndex++;
+                    component.push_back(reader);
+                    onStack[reader] = true;
+                }
+                else if (onStack[reader] && index[reader] < lowLink[id]) {
+                    lowLink[id] = index[reader];
+                }
+                continue;
+            }
+
+            frames.pop_back();
+            if (frames.getSize() > 0) {
+                uint32_t parent = frames[frames.getSize() - 1].id;
+                if (lowLink[id] < lowLink[parent]) {
+                    lowLink[parent] = lowLink[id];
+                }
+            }
+            if (lowLink[id] != index[id]) {
+                continue;
+            }
+
+            // id roots a component; it is a cycle if it has several nodes or reads itself
+            size_t begin = component.getSize() - 1;
+            while (component[begin] != id) {
+                begin--;
+            }
+            bool cyclic = begin + 1 < component.getSize();
+            for (size_t e = edgeStart[position[id]]; e < edgeStart[position[id] + 1] && !cyclic; e++) {
+                cyclic = edges[e] == id;
+            }
+            while (component.getSize() > begin) {
+                uint32_t member = component.pop_back();
+                onStack[member] = false;
+                if (cyclic) {
+                    isCyclic[member] = true;
+                    cycles.push_back(member);
+                }
+            }
+        }
+    }
+
+    // Cycle members only ever show #CIRCULAR!, so the nodes reading them can now run
+    size_t resume = order.getSize();
+    for (uint32_t id : cycles) {
+        size_t i = position[id];
+        for (size_t e = edgeStart[i]; e < edgeStart[i + 1]; e++) {
+            uint32_t reader = edges[e];
+            if (!isCyclic[reader] && --pending[reader] == 0) {
+                order.push_back(reader);
+            }
+        }
+    }
+    drain(resume);
+
+    changed.clear();
+    everythingDirty = false;
+}
+
+DependencyNode* DependencyGraph::findNode(size_t row, size_t col) {
+    const uint32_t* id = nodeAt.find(row, col);
+    return id != nullptr ? &nodes[*id] : nullptr;
+}
+
+const DependencyNode* DependencyGraph::findNode(size_t row, size_t col) const {
+    const uint32_t* id = nodeAt.find(row, col);
+    return id != nullptr ? &nodes[*id] : nullptr;
+}
+
+DependencyNode& DependencyGraph::getNode(uint32_t id) {
+    return nodes[id];
+}
+
+size_t DependencyGraph::getNodeCount() const {
+    return nodeAt.getSize();
+}
+
+void DependencyGraph::clear() {
+    nodes.clear();
+    freeNodes.clear();
+    nodeAt.clear();
+    cellReaders.clear();
+    groups.clear();
+    freeGroups.clear();
+    groupsAt.clear();
+    blockGroups.clear();
+    changed.clear();
+    everythingDirty = false;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include "MyVector.hpp"
+#include "MyString.h"
+#include "PositionMap.hpp"
+#include "CellKind.h"
+
+// Cells a formula or reference reads, as an inclusive rectangle
+struct Precedent {
+    size_t startRow, startCol, endRow, endCol;
+
+    bool contains(size_t row, size_t col) const {
+        return row >= startRow && row <= endRow && col >= startCol && col <= endCol;
+    }
+
+    bool operator==(const Precedent& other) const {
+        return startRow == other.startRow && startCol == other.startCol &&
+            endRow == other.endRow && endCol == other.endCol;
+    }
+};
+
+// A formula or reference cell together with its cached result
+struct DependencyNode {
+    size_t row, col;
+    MyVector<Precedent> precedents;
+    MyString text;      // cached display value
+    double number;      // cached numeric value
+    CellKind kind;      // kind of the cached value: STRING, BOOL or a number
+    CellError error;    // cached error, NONE when text and number hold a value
+    bool live;
+    size_t stamp;       // scratch marker for graph walks
+
+    DependencyNode() : row(0), col(0), number(0.0), kind(CellKind::DOUBLE), error(CellError::NONE), live(false), stamp(0) {}
+};
+
+// Precedent/dependent graph over logical cell positions. Single cells and
+// small ranges are indexed per cell, larger ranges per BLOCK_SIZE square
+// block they overlap, so finding the readers of a cell never scans all formulas.
+// A large range is listed in its blocks once however many nodes read it, as
+// many formulas share one lookup table or column.
+class DependencyGraph {
+    // Node being expanded by the cycle search and the next edge to follow
+    struct TarjanFrame {
+        uint32_t id;
+        size_t edge;
+    };
+
+    // A large range and the nodes reading it. Removed readers are dropped
+    // lazily: readers may hold ids that no longer read the range, and the
+    // list is compacted once those outnumber the liveReaders.
+    struct RangeGroup {
+        Precedent range;
+        MyVector<uint32_t> readers;
+        size_t liveReaders;
+        size_t stamp;       // scratch marker, as in DependencyNode
+        size_t expanded;    // last takeDirtyNodes pass that queued all readers
+
+        RangeGroup() : range(), liveReaders(0), stamp(0), expanded(0) {}
+    };
+
+public:
+    static const size_t BLOCK_SIZE = 64;
+    // Ranges of at most this many cells are indexed cell by cell
+    static const size_t SMALL_RANGE_CELLS = 64;
+
+private:
+    MyVector<DependencyNode> nodes;
+    MyVector<uint32_t> freeNodes;
+    PositionMap<uint32_t> nodeAt;
+    PositionMap<MyVector<uint32_t>> cellReaders;
+    MyVector<RangeGroup> groups;
+    MyVector<uint32_t> freeGroups;
+    PositionMap<MyVector<uint32_t>> groupsAt;       // groups by the first cell of their range
+    PositionMap<MyVector<uint32_t>> blockGroups;    // keyed by block row and column
+    MyVector<uint64_t> changed;                     // positions edited since the last recalculation
+    bool everythingDirty;
+    size_t stampCounter;
+
+    static bool isSmall(const Precedent& precedent);
+    static bool reads(const DependencyNode& node, const Precedent& range);
+    void unregister(uint32_t id);
+    void addReader(MyVector<uint32_t>& readers, uint32_t id);
+    void removeReader(MyVector<uint32_t>* readers, uint32_t id);
+    uint32_t findGroup(const Precedent& range);
+    uint32_t addGroup(const Precedent& range);
+    void releaseGroup(uint32_t group);
+    void compactGroup(RangeGroup& group);
+    void moveNodes(size_t index, bool inserted, bool alongRows);
+
+    // Appends the nodes that read the cell, each once. Given a pass, range
+    // groups already expanded in that pass are skipped.
+    void collectReaders(size_t row, size_t col, MyVector<uint32_t>& readers, size_t pass = 0);
+
+public:
+    DependencyGraph();
+
+    // Adds or replaces the node of a formula or reference cell
+    void setNode(size_t row, size_t col, const MyVector<Precedent>& precedents);
+    void removeNode(size_t row, size_t col);
+
+    // Rows or columns from index on moved one further, or one back when the
+    // one at index was removed; the nodes on a removed line must be gone
+    // already. Precedents stay put, as formulas keep their addresses.
+    void moveRows(size_t index, bool inserted);
+    void moveColumns(size_t index, bool inserted);
+
+    // Records that a cell changed; its readers are recomputed on the next recalculation
+    void markChanged(size_t row, size_t col);
+    // Every node is recomputed on the next recalculation
+    void markAllDirty();
+    bool hasPendingChanges() const;
+
+    // Fills order with the stale nodes in evaluation order, precedents first.
+    // order is grouped into levels: levels holds the start of each one plus the
+    // end of the last, and no node reads another node of its own level.
+    // Members of strongly connected components (cycles, including a node reading
+    // itself) go to cycles instead; nodes reading them follow in later levels.
+    void takeDirtyNodes(MyVector<uint32_t>& order, MyVector<size_t>& levels, MyVector<uint32_t>& cycles);
+
+    DependencyNode* findNode(size_t row, size_t col);
+    const DependencyNode* findNode(size_t row, size_t col) const;
+    DependencyNode& getNode(uint32_t id);
+    size_t getNodeCount() const;
+
+    // Visits every node as visit(node)
+    template<typename Visitor>
+    void forEachNode(Visitor visit) const;
+
+    void clear();
+};
+
+template<typename Visitor>
+void DependencyGraph::forEachNode(Visitor visit) const {
+    for (const DependencyNode& node : nodes) {
+        if (node.live) {
+            visit(node);
+        }
+    }
+}
@@ -3,66 +3,18 @@
 #include "BaseCell.h"
 #include "MyString.h"
 #include "MyVector.hpp"
+#include "FormulaProgram.h"
 
 class Table; // Forward declaration
 
-enum class FormulaType {
-    SUM,
-    AVERAGE,
-    MAX,
-    LEN,
-    CONCAT,
-    SUBSTR,
-    COUNT
-};
-
-struct FormulaParameter {
-    enum Type {
-        SINGLE_CELL,    
-        CELL_RANGE,     
-        INTEGER_VALUE,  
-        BOOLEAN_VALUE, 
-        STRING_VALUE    
-    };
-
-    Type type;
-
-    size_t row, col;
-
-    size_t startRow, startCol, endRow, endCol;
-
-    int intValue;
-    bool boolValue;
-    MyString stringValue;
-
-    FormulaParameter() : type(INTEGER_VALUE), row(0), col(0),
-        startRow(0), startCol(0), endRow(0), endCol(0),
-        intValue(0), boolValue(false) {}
-};
-
 class FormulaCell : public BaseCell {
 private:
-    FormulaType formulaType;
-    MyVector<FormulaParameter> parameters;
+    FormulaProgram program;     // compiled by FormulaParser
+    MyString source;            // the formula as written, without the leading '='
     Table* tablePtr;
-    mutable bool hasError;
-    mutable MyString errorMessage;
-
-    // Helper methods
-    double evaluateParameter(const FormulaParameter& param) const;
-    MyVector<double> getParameterValues(const FormulaParameter& param) const;
-    MyVector<MyString> getParameterStringValues(const FormulaParameter& param) const;
-    bool hasErrorInParameters() const;
-    double calculateSum() const;
-    double calculateAverage() const;
-    double calculateMax() const;
-    int calculateLen() const;
-    MyString calculateConcat() const;
-    MyString calculateSubstr() const;
-    int calculateCount() const;
 
 public:
-    FormulaCell(FormulaType type, const MyVector<FormulaParameter>& params);
+    FormulaCell(FormulaProgram&& program, const MyString& source);
     FormulaCell(const FormulaCell& other);
     FormulaCell& operator=(const FormulaCell& other);
     ~FormulaCell() = default;
@@ -70,12 +22,15 @@ public:
     void setTablePtr(Table* table);
     Table* getTablePtr() const;
 
+    // Runs the program once; toString and evaluate each take one half of this
+    FormulaResult calculate() const;
     MyString toString() const override;
     double evaluate() const override;
     MyString getType() const override;
+    CellKind getKind() const override;
     BaseCell* clone() const override;
 
     // Formula-specific 
-    FormulaType getFormulaType() const;
-    const MyVector<FormulaParameter>& getParameters() const;
+    const FormulaProgram& getProgram() const;
+    const MyString& getSource() const;
 };
\ No newline at end of file
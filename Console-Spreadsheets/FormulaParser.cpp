@@ -0,0 +1,748 @@
+#include "FormulaParser.h"
+#include <cstring>
+
+const size_t FormulaParser::MAX_NESTING;
+
+FormulaParser::FormulaParser(const char* source, size_t length, FormulaProgram& program)
+    : source(source), length(length), position(0), program(program),
+    depth(0), nesting(0), error(CellError::NONE), misused(false) {
+}
+
+CellError FormulaParser::compile(const char* source, size_t length, FormulaProgram& program) {
+    FormulaParser parser(source, length, program);
+
+    Operand result;
+    if (!parser.parseComparison(result)) {
+        return parser.error;
+    }
+    parser.skipSpaces();
+    if (parser.position != length) {
+        return CellError::SYNTAX;
+    }
+    parser.pushValue(result);
+
+    if (parser.misused) {
+        program = FormulaProgram();
+        program.emit(OpCode::FAIL);
+    }
+    return CellError::NONE;
+}
+
+bool FormulaParser::fail(CellError reason) {
+    if (error == CellError::NONE) {
+        error = reason;
+    }
+    return false;
+}
+
+void FormulaParser::skipSpaces() {
+    while (position < length && (source[position] == ' ' || source[position] == '\t')) {
+        position++;
+    }
+}
+
+bool FormulaParser::accept(char c) {
+    skipSpaces();
+    if (position < length && source[position] == c) {
+        position++;
+        return true;
+    }
+    return false;
+}
+
+void FormulaParser::grow() {
+    if (++depth > FormulaProgram::STACK_SIZE) {
+        misused = true;
+    }
+}
+
+void FormulaParser::shrink(size_t slots) {
+    depth = depth > slots ? depth - slots : 0;
+}
+
+// TEXT_RANGE and JOIN_RANGE build their text in the slot above the top
+void FormulaParser::reserveScratch() {
+    if (depth + 1 > FormulaProgram::STACK_SIZE) {
+        misused = true;
+    }
+}
+
+bool FormulaParser::parseComparison(Operand& result) {
+    if (!parseAdditive(result)) {
+        return false;
+    }
+
+    while (true) {
+        skipSpaces();
+        if (position >= length) {
+            return true;
+        }
+
+        OpCode op;
+        char c = source[position];
+        char next = position + 1 < length ? source[position + 1] : '\0';
+        if (c == '=') {
+            op = OpCode::EQUAL;
+        }
+        else if (c == '<' && next == '>') {
+            op = OpCode::NOT_EQUAL;
+        }
+        else if (c == '<') {
+            op = next == '=' ? OpCode::LESS_EQUAL : OpCode::LESS;
+        }
+        else if (c == '>') {
+            op = next == '=' ? OpCode::GREATER_EQUAL : OpCode::GREATER;
+        }
+        else {
+            return true;
+        }
+        position += op == OpCode::NOT_EQUAL || op == OpCode::LESS_EQUAL || op == OpCode::GREATER_EQUAL ? 2 : 1;
+
+        pushValue(result);
+        Operand right;
+        if (!parseAdditive(right)) {
+            return false;
+        }
+        pushValue(right);
+        program.emit(op);
+        shrink(1);
+    }
+}
+
+bool FormulaParser::parseAdditive(Operand& result) {
+    if (!parseTerm(result)) {
+        return false;
+    }
+
+    while (true) {
+        bool add = accept('+');
+        if (!add && !accept('-')) {
+            return true;
+        }
+
+        pushValue(result);
+        Operand right;
+        if (!parseTerm(right)) {
+            return false;
+        }
+        pushValue(right);
+        program.emit(add ? OpCode::ADD : OpCode::SUBTRACT);
+        shrink(1);
+    }
+}
+
+bool FormulaParser::parseTerm(Operand& result) {
+    if (!parseUnary(result)) {
+        return false;
+    }
+
+    while (true) {
+        bool multiply = accept('*');
+        if (!multiply && !accept('/')) {
+            return true;
+        }
+
+        pushValue(result);
+        Operand right;
+        if (!parseUnary(right)) {
+            return false;
+        }
+        pushValue(right);
+        program.emit(multiply ? OpCode::MULTIPLY : OpCode::DIVIDE);
+        shrink(1);
+    }
+}
+
+bool FormulaParser::parseUnary(Operand& result) {
+    // Every level of parentheses, call or power passes through here once
+    if (++nesting > MAX_NESTING) {
+        return fail(CellError::VALUE);
+    }
+
+    size_t negations = 0;
+    while (accept('-')) {
+        negations++;
+    }
+    if (!parsePower(result)) {
+        return false;
+    }
+
+    // Negative constants stay constants, SUBSTR and SUM take them as they are
+    if (result.kind == Operand::NUMBER) {
+        if (negations % 2 == 1) {
+            result.number = -result.number;
+        }
+    }
+    else if (negations > 0) {
+        pushValue(result);
+        for (size_t i = 0; i < negations; i++) {
+            program.emit(OpCode::NEGATE);
+        }
+    }
+
+    nesting--;
+    return true;
+}
+
+bool FormulaParser::parsePower(Operand& result) {
+    if (!parsePrimary(result)) {
+        return false;
+    }
+    if (!accept('^')) {
+        return true;
+    }
+
+    pushValue(result);
+    Operand exponent;
+    if (!parseUnary(exponent)) {
+        return false;
+    }
+    pushValue(exponent);
+    program.emit(OpCode::POWER);
+    shrink(1);
+    return true;
+}
+
+bool FormulaParser::parsePrimary(Operand& result) {
+    skipSpaces();
+    if (position >= length) {
+        return fail(CellError::SYNTAX);
+    }
+
+    char c = source[position];
+    if ((c >= '0' && c <= '9') || c == '.') {
+        return parseNumber(result);
+    }
+
+    if (c == '"') {
+        const char* text = source + position + 1;
+        const char* end = static_cast<const char*>(memchr(text, '"', length - position - 1));
+        if (end == nullptr) {
+            return fail(CellError::SYNTAX);
+        }
+        result.kind = Operand::TEXT;
+        result.text = text;
+        result.length = end - text;
+        position = end - source + 1;
+        return true;
+    }
+
+    if (c == '(') {
+        position++;
+        if (!parseComparison(result)) {
+            return false;
+        }
+        return accept(')') ? true : fail(CellError::SYNTAX);
+    }
+
+    if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))) {
+        return fail(CellError::SYNTAX);
+    }
+
+    const char* name = source + position;
+    size_t nameLength = 0;
+    while (position < length && ((source[position] >= 'A' && source[position] <= 'Z') ||
+        (source[position] >= 'a' && source[position] <= 'z') ||
+        (source[position] >= '0' && source[position] <= '9'))) {
+        position++;
+        nameLength++;
+    }
+
+    if (accept('(')) {
+        Function function;
+        if (!findFunction(name, nameLength, function)) {
+            return fail(CellError::SYNTAX);
+        }
+        return parseCall(function, result);
+    }
+
+    if (nameLength == 4 && memcmp(name, "true", 4) == 0) {
+        result.kind = Operand::BOOLEAN;
+        result.number = 1.0;
+        return true;
+    }
+    if (nameLength == 5 && memcmp(name, "false", 5) == 0) {
+        result.kind = Operand::BOOLEAN;
+        result.number = 0.0;
+        return true;
+    }
+
+    if (!parseReference(name, nameLength, result.startRow, result.startCol)) {
+        return false;
+    }
+    result.kind = Operand::CELL;
+    result.endRow = result.startRow;
+    result.endCol = result.startCol;
+    if (!accept(':')) {
+        return true;
+    }
+
+    skipSpaces();
+    const char* endName = source + position;
+    size_t endLength = 0;
+    while (position < length && ((source[position] >= 'A' && source[position] <= 'Z') ||
+        (source[position] >= '0' && source[position] <= '9'))) {
+        position++;
+        endLength++;
+    }
+    size_t endRow, endCol;
+    if (!parseReference(endName, endLength, endRow, endCol)) {
+        return false;
+    }
+
+    // Corners may be given in any order
+    result.kind = Operand::RANGE;
+    result.endRow = endRow > result.startRow ? endRow : result.startRow;
+    result.endCol = endCol > result.startCol ? endCol : result.startCol;
+    result.startRow = endRow < result.startRow ? endRow : result.startRow;
+    result.startCol = endCol < result.startCol ? endCol : result.startCol;
+    return true;
+}
+
+bool FormulaParser::parseNumber(Operand& result) {
+    double value = 0.0;
+    size_t digits = 0;
+    while (position < length && source[position] >= '0' && source[position] <= '9') {
+        value = value * 10.0 + (source[position++] - '0');
+        digits++;
+    }
+
+    if (position < length && source[position] == '.') {
+        position++;
+        double fraction = 0.0;
+        double scale = 1.0;
+        while (position < length && source[position] >= '0' && source[position] <= '9') {
+            fraction = fraction * 10.0 + (source[position++] - '0');
+            scale *= 10.0;
+            digits++;
+        }
+        value += fraction / scale;
+    }
+
+    if (digits == 0) {
+        return fail(CellError::SYNTAX);
+    }
+    result.kind = Operand::NUMBER;
+    result.number = value;
+    return true;
+}
+
+// Same rules as CellFactory::parseCellReference: one column letter and a row from 1
+bool FormulaParser::parseReference(const char* name, size_t nameLength, size_t& row, size_t& col) {
+    if (nameLength < 2 || nameLength > 10 || name[0] < 'A' || name[0] > 'Z' || name[1] < '1' || name[1] > '9') {
+        return fail(looksLikeReference(name, nameLength) ? CellError::REF : CellError::SYNTAX);
+    }
+
+    size_t rowNumber = 0;
+    for (size_t i = 1; i < nameLength; i++) {
+        if (name[i] < '0' || name[i] > '9') {
+            return fail(CellError::SYNTAX);
+        }
+        rowNumber = rowNumber * 10 + (name[i] - '0');
+    }
+
+    col = name[0] - 'A';
+    row = rowNumber - 1;
+    return true;
+}
+
+bool FormulaParser::looksLikeReference(const char* name, size_t nameLength) {
+    size_t i = 0;
+    while (i < nameLength && name[i] >= 'A' && name[i] <= 'Z') {
+        i++;
+    }
+    if (i == 0 || i == nameLength) {
+        return false;
+    }
+    while (i < nameLength && name[i] >= '0' && name[i] <= '9') {
+        i++;
+    }
+    return i == nameLength;
+}
+
+bool FormulaParser::findFunction(const char* name, size_t nameLength, Function& function) {
+    static const struct {
+        const char* name;
+        Function function;
+    } functions[] = {
+        { "SUM", Function::SUM },
+        { "AVERAGE", Function::AVERAGE },
+        { "MAX", Function::MAX },
+        { "LEN", Function::LEN },
+        { "CONCAT", Function::CONCAT },
+        { "SUBSTR", Function::SUBSTR },
+        { "COUNT", Function::COUNT },
+        { "MATCH", Function::MATCH },
+        { "VLOOKUP", Function::VLOOKUP },
+        { "XLOOKUP", Function::XLOOKUP },
+        { "SUMIF", Function::SUMIF },
+        { "COUNTIF", Function::COUNTIF },
+        { "AVERAGEIF", Function::AVERAGEIF },
+        { "SUMIFS", Function::SUMIFS },
+        { "COUNTIFS", Function::COUNTIFS },
+        { "AVERAGEIFS", Function::AVERAGEIFS }
+    };
+
+    for (const auto& entry : functions) {
+        if (strlen(entry.name) == nameLength && memcmp(entry.name, name, nameLength) == 0) {
+            function = entry.function;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FormulaParser::parseCall(Function function, Operand& result) {
+    // SUM and AVERAGE fold every argument into one slot as it is parsed;
+    // the other functions take a fixed list and emit once they have it
+    bool folds = function == Function::SUM || function == Function::AVERAGE;
+    if (folds) {
+        program.emit(OpCode::PUSH);
+        grow();
+    }
+
+    bool looksUp = function == Function::MATCH || function == Function::VLOOKUP || function == Function::XLOOKUP;
+    bool single = function == Function::SUMIF || function == Function::COUNTIF || function == Function::AVERAGEIF;
+    bool multiple = function == Function::SUMIFS || function == Function::COUNTIFS || function == Function::AVERAGEIFS;
+    size_t firstPair = function == Function::COUNTIFS ? 0 : 1;
+    Operand arguments[MAX_ARGUMENTS];
+    size_t count = 0;
+    if (!accept(')')) {
+        do {
+            Operand argument;
+            if (!parseComparison(argument)) {
+                return false;
+            }
+
+            if (folds) {
+                foldValue(argument);
+            }
+            else if (count < MAX_ARGUMENTS) {
+                // Only CONCAT's delimiter, SUBSTR's text, lookup keys, XLOOKUP's
+                // fallback and criteria may be computed; constant criteria are
+                // compiled with the formula
+                bool text = (function == Function::CONCAT && count == 1) ||
+                    (function == Function::SUBSTR && count == 0) || function == Function::LEN;
+                bool value = (looksUp && count == 0) || (function == Function::XLOOKUP && count == 3);
+                bool criterion = (single && count == 1) || (multiple && count > firstPair && (count - firstPair) % 2 == 1);
+                if (text) {
+                    pushText(argument);
+                }
+                else if (value || (criterion && (argument.kind == Operand::VALUE || argument.kind == Operand::CELL))) {
+                    pushValue(argument);
+                }
+                else if (argument.kind == Operand::VALUE) {
+                    misused = true;
+                }
+                arguments[count] = argument;
+            }
+            else if (argument.kind == Operand::VALUE) {
+                shrink(1);
+            }
+            count++;
+        } while (accept(','));
+
+        if (!accept(')')) {
+            return fail(CellError::SYNTAX);
+        }
+    }
+
+    result.kind = Operand::VALUE;
+    switch (function) {
+    case Function::SUM:
+        program.emit(OpCode::RESULT_SUM);
+        return true;
+    case Function::AVERAGE:
+        program.emit(OpCode::RESULT_AVERAGE);
+        return true;
+    case Function::MAX:
+    case Function::COUNT:
+        if (count != 1 || arguments[0].kind != Operand::RANGE) {
+            misused = true;
+            grow();
+            return true;
+        }
+        program.emit(OpCode::PUSH);
+        grow();
+        program.emit(function == Function::MAX ? OpCode::FOLD_RANGE : OpCode::COUNT_RANGE, addRange(arguments[0]));
+        program.emit(function == Function::MAX ? OpCode::RESULT_MAX : OpCode::RESULT_COUNT);
+        return true;
+    case Function::LEN:
+        if (count != 1 || arguments[0].kind == Operand::RANGE) {
+            misused = true;
+        }
+        program.emit(OpCode::RESULT_LENGTH);
+        return true;
+    case Function::CONCAT:
+        // The delimiter is on the stack, the join then uses it from the top slot
+        if (count != 2 || arguments[0].kind != Operand::RANGE) {
+            misused = true;
+            return true;
+        }
+        reserveScratch();
+        program.emit(OpCode::JOIN_RANGE, addRange(arguments[0]));
+        program.emit(OpCode::RESULT_TEXT);
+        return true;
+    case Function::SUBSTR: {
+        if (count != 3 || arguments[0].kind == Operand::RANGE ||
+            arguments[1].kind != Operand::NUMBER || arguments[2].kind != Operand::NUMBER) {
+            misused = true;
+            return true;
+        }
+        double start = arguments[1].number;
+        double take = arguments[2].number;
+        if (start < 0.0 || take <= 0.0 || start > 4294967295.0 || take > 4294967295.0 ||
+            start != static_cast<double>(static_cast<uint32_t>(start)) ||
+            take != static_cast<double>(static_cast<uint32_t>(take))) {
+            misused = true;
+            return true;
+        }
+        program.emit(OpCode::SUBSTR, static_cast<uint32_t>(start), static_cast<uint32_t>(take));
+        program.emit(OpCode::RESULT_TEXT);
+        return true;
+    }
+    case Function::MATCH: {
+        // The match type is 1 for the largest value not above the key, the
+        // default, 0 for the key itself and -1 for the smallest value not below
+        MatchMode mode = MatchMode::BELOW;
+        if (count == 3 && arguments[2].kind == Operand::NUMBER) {
+            mode = arguments[2].number == 0.0 ? MatchMode::EXACT
+                : (arguments[2].number == -1.0 ? MatchMode::ABOVE : (arguments[2].number == 1.0 ? MatchMode::BELOW : MatchMode::NONE));
+        }
+        if (count < 2 || count > 3 || !isLine(arguments[1]) || mode == MatchMode::NONE ||
+            (count == 3 && arguments[2].kind != Operand::NUMBER)) {
+            misused = true;
+            if (count == 0) {
+                grow();
+            }
+            return true;
+        }
+        program.emit(OpCode::MATCH, addRange(arguments[1], mode), static_cast<uint32_t>(mode));
+        return true;
+    }
+    case Function::VLOOKUP: {
+        // Searches the first column of the table and reads the match's row of
+        // the numbered column; approximate unless the last argument is false
+        const Operand& table = arguments[1];
+        MatchMode mode = MatchMode::BELOW;
+        if (count == 4 && (arguments[3].kind == Operand::NUMBER || arguments[3].kind == Operand::BOOLEAN)) {
+            mode = arguments[3].number != 0.0 ? MatchMode::BELOW : MatchMode::EXACT;
+        }
+        double column = arguments[2].number;
+        if (count < 3 || count > 4 || (table.kind != Operand::RANGE && table.kind != Operand::CELL) ||
+            arguments[2].kind != Operand::NUMBER || column < 1.0 ||
+            column > static_cast<double>(table.endCol - table.startCol + 1) ||
+            column != static_cast<double>(static_cast<size_t>(column)) ||
+            (count == 4 && arguments[3].kind != Operand::NUMBER && arguments[3].kind != Operand::BOOLEAN)) {
+            misused = true;
+            if (count == 0) {
+                grow();
+            }
+            return true;
+        }
+        size_t resultCol = table.startCol + static_cast<size_t>(column) - 1;
+        program.emit(OpCode::MATCH, program.addRange(table.startRow, table.startCol, table.endRow, table.startCol, mode),
+            static_cast<uint32_t>(mode));
+        program.emit(OpCode::PICK, program.addRange(table.startRow, resultCol, table.endRow, resultCol));
+        return true;
+    }
+    case Function::SUMIF:
+    case Function::COUNTIF:
+    case Function::AVERAGEIF:
+    case Function::SUMIFS:
+    case Function::COUNTIFS:
+    case Function::AVERAGEIFS:
+        emitConditional(function, arguments, count);
+        return true;
+    case Function::XLOOKUP: {
+        // Exact matches only; both ranges are lines of the same shape
+        const Operand& keys = arguments[1];
+        const Operand& values = arguments[2];
+        if (count < 3 || count > 4 || !isLine(keys) || !isLine(values) ||
+            keys.endRow - keys.startRow != values.endRow - values.startRow ||
+            keys.endCol - keys.startCol != values.endCol - values.startCol) {
+            misused = true;
+            if (count == 0) {
+                grow();
+            }
+            return true;
+        }
+        if (count == 3) {
+            program.emit(OpCode::MATCH, addRange(keys, MatchMode::EXACT), static_cast<uint32_t>(MatchMode::EXACT));
+            program.emit(OpCode::PICK, addRange(values));
+        }
+        else {
+            program.emit(OpCode::LOOKUP_OR, addRange(keys, MatchMode::EXACT), addRange(values));
+            shrink(1);
+        }
+        return true;
+    }
+    }
+    return true;
+}
+
+// SUMIF(range, criteria[, sum range]), COUNTIF and AVERAGEIF test one range
+// and fold another, by default the tested one; only the first cell of the sum
+// range counts, it takes the shape of the tested range. The *IFS forms take
+// the folded range first, then pairs of ranges of its shape and criteria.
+void FormulaParser::emitConditional(Function function, const Operand* arguments, size_t count) {
+    bool single = function == Function::SUMIF || function == Function::COUNTIF || function == Function::AVERAGEIF;
+    bool counts = function == Function::COUNTIF || function == Function::COUNTIFS;
+    size_t first = single || counts ? 0 : 1;
+
+    size_t computed = 0;
+    for (size_t i = first + 1; i < count; i += 2) {
+        if (arguments[i].kind == Operand::VALUE) {
+            computed++;
+        }
+    }
+
+    Operand folded = arguments[first];
+    bool valid = single
+        ? count == 2 || (count == 3 && !counts)
+        : count >= first + 2 && (count - first) % 2 == 0 && (count - first) / 2 <= FormulaProgram::MAX_CONDITIONS;
+    if (valid && single && count == 3) {
+        folded = arguments[2];
+        folded.endRow = folded.startRow + (arguments[0].endRow - arguments[0].startRow);
+        folded.endCol = folded.startCol + (arguments[0].endCol - arguments[0].startCol);
+    }
+    else if (valid && !single && !counts) {
+        folded = arguments[0];
+    }
+
+    for (size_t i = 0; i < count && valid; i++) {
+        // Ranges are the folded one and the first of each pair
+        if (i >= first && (i - first) % 2 == 1) {
+            continue;
+        }
+        const Operand& range = arguments[i];
+        valid = (range.kind == Operand::RANGE || range.kind == Operand::CELL) && (single ||
+            (range.endRow - range.startRow == folded.endRow - folded.startRow &&
+             range.endCol - range.startCol == folded.endCol - folded.startCol));
+    }
+    if (!valid) {
+        misused = true;
+        shrink(computed);
+        grow();
+        return;
+    }
+
+    size_t slot = 0;
+    for (size_t i = first; i + 1 < count; i += 2) {
+        const Operand& tested = arguments[i];
+        const Operand& test = arguments[i + 1];
+        if (test.kind == Operand::VALUE) {
+            program.emit(OpCode::IF_VALUE, addRange(tested), static_cast<uint32_t>(slot++));
+        }
+        else {
+            program.emit(OpCode::IF_CONST, addRange(tested), program.addCriteria(test.kind == Operand::TEXT
+                ? Criteria::parse(test.text, test.length)
+                : Criteria::fromNumber(test.number)));
+        }
+    }
+
+    if (counts) {
+        program.emit(OpCode::COUNT_IF, 0, static_cast<uint32_t>(computed));
+    }
+    else {
+        program.emit(OpCode::FOLD_IF, addRange(folded), static_cast<uint32_t>(computed));
+    }
+    shrink(computed);
+    grow();
+
+    if (counts) {
+        program.emit(OpCode::RESULT_COUNT);
+    }
+    else if (function == Function::SUMIF || function == Function::SUMIFS) {
+        // Unlike SUM, a conditional sum matching nothing is 0
+        program.emit(OpCode::FOLD_CONST, program.addNumber(0.0));
+        program.emit(OpCode::RESULT_SUM);
+    }
+    else {
+        program.emit(OpCode::RESULT_AVERAGE);
+    }
+}
+
+uint32_t FormulaParser::addRange(const Operand& operand, MatchMode search) {
+    return program.addRange(operand.startRow, operand.startCol, operand.endRow, operand.endCol, search);
+}
+
+bool FormulaParser::isLine(const Operand& operand) {
+    return (operand.kind == Operand::RANGE || operand.kind == Operand::CELL) &&
+        (operand.startRow == operand.endRow || operand.startCol == operand.endCol);
+}
+
+void FormulaParser::pushValue(Operand& operand) {
+    switch (operand.kind) {
+    case Operand::VALUE:
+        return;
+    case Operand::NUMBER:
+        program.emit(OpCode::PUSH_NUMBER, program.addNumber(operand.number), static_cast<uint32_t>(ResultFormat::DECIMAL));
+        break;
+    case Operand::BOOLEAN:
+        program.emit(OpCode::PUSH_NUMBER, program.addNumber(operand.number), static_cast<uint32_t>(ResultFormat::BOOLEAN));
+        break;
+    case Operand::TEXT:
+        program.emit(OpCode::PUSH_TEXT, program.addText(MyString(operand.text, operand.length)));
+        break;
+    case Operand::CELL:
+        program.emit(OpCode::PUSH_CELL, addRange(operand));
+        break;
+    case Operand::RANGE:
+        // Ranges are only read by functions
+        misused = true;
+        break;
+    }
+    operand.kind = Operand::VALUE;
+    grow();
+}
+
+void FormulaParser::pushText(Operand& operand) {
+    switch (operand.kind) {
+    case Operand::VALUE:
+        program.emit(OpCode::TEXT_VALUE);
+        return;
+    case Operand::NUMBER:
+    case Operand::BOOLEAN:
+        program.emit(OpCode::PUSH);
+        program.emit(OpCode::TEXT_CONST, program.addText(FormulaProgram::formatNumber(operand.number,
+            operand.kind == Operand::NUMBER ? ResultFormat::DECIMAL : ResultFormat::BOOLEAN)));
+        break;
+    case Operand::TEXT:
+        program.emit(OpCode::PUSH);
+        program.emit(OpCode::TEXT_CONST, program.addText(MyString(operand.text, operand.length)));
+        break;
+    case Operand::CELL:
+        program.emit(OpCode::PUSH);
+        program.emit(OpCode::TEXT_CELL, addRange(operand));
+        break;
+    case Operand::RANGE:
+        program.emit(OpCode::PUSH);
+        program.emit(OpCode::TEXT_RANGE, addRange(operand));
+        reserveScratch();
+        break;
+    }
+    grow();
+}
+
+void FormulaParser::foldValue(Operand& operand) {
+    switch (operand.kind) {
+    case Operand::VALUE:
+        program.emit(OpCode::FOLD_VALUE);
+        shrink(1);
+        break;
+    case Operand::NUMBER:
+    case Operand::BOOLEAN:
+        program.emit(OpCode::FOLD_CONST, program.addNumber(operand.number));
+        break;
+    case Operand::TEXT:
+        // Text constants take no part in numeric calculations
+        break;
+    case Operand::CELL:
+        program.emit(OpCode::FOLD_CELL, addRange(operand));
+        break;
+    case Operand::RANGE:
+        program.emit(OpCode::FOLD_RANGE, addRange(operand));
+        break;
+    }
+}
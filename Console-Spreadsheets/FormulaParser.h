@@ -0,0 +1,108 @@
+#pragma once
+
+#include "FormulaProgram.h"
+#include "CellKind.h"
+
+// Recursive descent compiler from formula text to a FormulaProgram. The text
+// is read once, left to right, and code is emitted as the grammar is matched;
+// no tree and no substrings are built. Literals and references stay pending
+// until their use is known, so SUM(A1:A9) still folds the range in place and
+// LEN(A1) reads the cell's text, while A1+1 pushes the cell's value.
+//
+//   comparison := additive {('=' | '<>' | '<' | '<=' | '>' | '>=') additive}
+//   additive   := term {('+' | '-') term}
+//   term       := unary {('*' | '/') unary}
+//   unary      := {'-'} power
+//   power      := primary ['^' unary]
+//   primary    := number | "text" | true | false | cell | cell ':' cell
+//               | '(' comparison ')' | NAME '(' [comparison {',' comparison}] ')'
+class FormulaParser {
+public:
+    // Formulas nesting deeper than this are rejected with #VALUE!
+    static const size_t MAX_NESTING = 64;
+
+    // Compiles source, the formula without its '='. Returns SYNTAX for text that
+    // is no formula and REF for malformed references; program is then unusable.
+    // Functions given arguments they cannot use compile to a program failing
+    // with #VALUE!, as do formulas needing more than the VM's stack.
+    static CellError compile(const char* source, size_t length, FormulaProgram& program);
+
+private:
+    enum class Function {
+        SUM,
+        AVERAGE,
+        MAX,
+        LEN,
+        CONCAT,
+        SUBSTR,
+        COUNT,
+        MATCH,
+        VLOOKUP,
+        XLOOKUP,
+        SUMIF,
+        COUNTIF,
+        AVERAGEIF,
+        SUMIFS,
+        COUNTIFS,
+        AVERAGEIFS
+    };
+
+    // Enough for the folded range and every range and criteria pair of SUMIFS
+    static const size_t MAX_ARGUMENTS = 2 * FormulaProgram::MAX_CONDITIONS + 1;
+
+    // A parsed operand. VALUE operands are on the stack already, the others
+    // emit nothing until an operator or a function decides how they are read.
+    struct Operand {
+        enum Kind { VALUE, NUMBER, BOOLEAN, TEXT, CELL, RANGE };
+
+        Kind kind;
+        double number;              // NUMBER and BOOLEAN
+        const char* text;           // TEXT, pointing into the source
+        size_t length;
+        size_t startRow, startCol, endRow, endCol;  // CELL and RANGE
+
+        Operand() : kind(VALUE), number(0.0), text(nullptr), length(0),
+            startRow(0), startCol(0), endRow(0), endCol(0) {}
+    };
+
+    const char* source;
+    size_t length;
+    size_t position;
+    FormulaProgram& program;
+    size_t depth;       // stack slots in use at this point of the program
+    size_t nesting;
+    CellError error;    // first error that stops the parse
+    bool misused;       // compiles to a failing program
+
+    FormulaParser(const char* source, size_t length, FormulaProgram& program);
+
+    bool fail(CellError reason);
+    void skipSpaces();
+    bool accept(char c);
+    void grow();
+    void shrink(size_t slots);
+    void reserveScratch();
+
+    bool parseComparison(Operand& result);
+    bool parseAdditive(Operand& result);
+    bool parseTerm(Operand& result);
+    bool parseUnary(Operand& result);
+    bool parsePower(Operand& result);
+    bool parsePrimary(Operand& result);
+    bool parseNumber(Operand& result);
+    bool parseReference(const char* name, size_t nameLength, size_t& row, size_t& col);
+    bool parseCall(Function function, Operand& result);
+    void emitConditional(Function function, const Operand* arguments, size_t count);
+
+    static bool findFunction(const char* name, size_t nameLength, Function& function);
+    static bool looksLikeReference(const char* name, size_t nameLength);
+
+    // Emit the operand as a value on the stack, as the text of a new slot,
+    // or fold it into the aggregate slot of SUM and AVERAGE
+    void pushValue(Operand& operand);
+    void pushText(Operand& operand);
+    void foldValue(Operand& operand);
+    uint32_t addRange(const Operand& operand, MatchMode search = MatchMode::NONE);
+    // A range or cell lookups can search: one row or one column
+    static bool isLine(const Operand& operand);
+};
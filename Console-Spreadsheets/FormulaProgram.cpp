@@ -0,0 +1,1101 @@
+#include "FormulaProgram.h"
+#include "AggregateKernels.h"
+#include "BufferedIO.h"
+#include "LookupIndex.h"
+#include "RangeAggregateIndex.h"
+#include "Table.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+const size_t FormulaProgram::STACK_SIZE;
+const size_t FormulaProgram::MAX_CONDITIONS;
+
+namespace {
+    // Running aggregate of the numbers folded so far, the value the slot was
+    // reduced to and its text. Slots formatted as TEXT hold their value in text.
+    struct StackSlot {
+        NumberAggregate numbers;
+        double value;
+        ResultFormat format;
+        bool hasText;
+        MyString text;
+
+        StackSlot() : value(0.0), format(ResultFormat::DECIMAL), hasText(false) {}
+
+        void reset() {
+            numbers = NumberAggregate();
+            value = 0.0;
+            format = ResultFormat::DECIMAL;
+            hasText = false;
+            text.clear();
+        }
+
+        void setNumber(double number, ResultFormat numberFormat) {
+            value = number;
+            format = numberFormat;
+            hasText = false;
+        }
+    };
+
+    // Condition of the next FOLD_IF or COUNT_IF; criteria is null for one
+    // computed into a stack slot
+    struct Condition {
+        const ProgramRange* range;
+        const Criteria* criteria;
+        uint32_t slot;
+    };
+
+    // Orders two values; numbers sort before texts
+    int compareValues(const StackSlot& left, const StackSlot& right) {
+        if (left.format == ResultFormat::TEXT || right.format == ResultFormat::TEXT) {
+            if (left.format != right.format) {
+                return left.format == ResultFormat::TEXT ? 1 : -1;
+            }
+            return left.text == right.text ? 0 : (left.text < right.text ? -1 : 1);
+        }
+        return left.value < right.value ? -1 : (left.value > right.value ? 1 : 0);
+    }
+
+    // Loads a cell's value into the slot; empty cells read as 0
+    CellError loadCell(const Table& table, size_t row, size_t col, StackSlot& slot) {
+        slot.reset();
+        CellError error = table.getCellError(row, col);
+        if (error != CellError::NONE) {
+            return error;
+        }
+
+        // References and formulas are typed by their cached value
+        CellKind kind = table.getCellKind(row, col);
+        if (kind == CellKind::REFERENCE || kind == CellKind::FORMULA) {
+            const DependencyNode* node = table.getCachedResult(row, col);
+            kind = node != nullptr ? node->kind : CellKind::EMPTY;
+        }
+        if (kind == CellKind::STRING) {
+            slot.text = table.getCellText(row, col);
+            slot.hasText = true;
+            slot.format = ResultFormat::TEXT;
+        }
+        else {
+            slot.setNumber(table.getCellNumber(row, col),
+                kind == CellKind::BOOL ? ResultFormat::BOOLEAN : ResultFormat::DECIMAL);
+        }
+        return CellError::NONE;
+    }
+
+    // Lookup ranges are one row or one column; a single row is searched across
+    bool searchesRows(const ProgramRange& range) {
+        return range.startRow != range.endRow;
+    }
+
+    // Cells along a lookup range, in the order MATCH numbers them
+    size_t lineLength(const ProgramRange& range) {
+        return searchesRows(range) ? range.endRow - range.startRow + 1 : range.endCol - range.startCol + 1;
+    }
+
+    // Finds the key in the range and sets position to the 0-based offset of the
+    // first matching cell. Texts only match texts and numbers, booleans included,
+    // only numbers; empty cells and errors never match.
+    bool findMatch(const Table& table, const ProgramRange& range, MatchMode mode, const StackSlot& key, size_t& position) {
+        if (table.getRowCount() == 0 || table.getColumnCount() == 0) {
+            return false;
+        }
+        size_t endRow = range.endRow < table.getRowCount() ? range.endRow : table.getRowCount() - 1;
+        size_t endCol = range.endCol < table.getColumnCount() ? range.endCol : table.getColumnCount() - 1;
+        if (range.startRow > endRow || range.startCol > endCol) {
+            return false;
+        }
+
+        LookupKey value;
+        value.isText = key.format == ResultFormat::TEXT;
+        value.number = value.isText ? 0.0 : key.value;
+        value.text = key.text.data();
+        value.length = key.text.length();
+
+        bool byRow = searchesRows(range);
+        bool found = false;
+        size_t row;
+        if (byRow && table.getLookupIndex().find(table.getStorage(), range.startCol, range.startRow, endRow, mode, value, found, row)) {
+            position = row - range.startRow;
+            return found;
+        }
+
+        // Without an index the cells are scanned in order, keeping the best match
+        const StringInterner& strings = table.getStorage().getStrings();
+        bool done = false;
+        double bestNumber = 0.0;
+        const char* bestText = nullptr;
+        size_t bestLength = 0;
+        table.getStorage().forEachStrip(range.startRow, range.startCol, endRow, endCol,
+            [&](size_t firstRow, size_t col, const CellPayload* payload, const CellKind* kinds,
+                uint64_t validMask, uint64_t /*numericMask*/, size_t count) {
+                for (size_t i = 0; i < count && !done; i++) {
+                    if (((validMask >> i) & 1) == 0) {
+                        continue;
+                    }
+
+                    CellKind kind = kinds[i];
+                    double number = 0.0;
+                    const char* text = nullptr;
+                    size_t length = 0;
+                    if (kind == CellKind::REFERENCE || kind == CellKind::FORMULA) {
+                        const DependencyNode* node = table.getCachedResult(firstRow + i, col);
+                        if (node == nullptr || node->error != CellError::NONE) {
+                            continue;
+                        }
+                        kind = node->kind;
+                        number = node->number;
+                        text = node->text.data();
+                        length = node->text.length();
+                    }
+                    else if (isNumericKind(kind)) {
+                        number = payload[i].number;
+                    }
+                    else if (kind == CellKind::STRING) {
+                        uint32_t id = static_cast<uint32_t>(payload[i].handle);
+                        text = strings.getText(id);
+                        length = strings.getLength(id);
+                    }
+                    if (kind == CellKind::EMPTY || kind == CellKind::ERROR_VALUE || (kind == CellKind::STRING) != value.isText) {
+                        continue;
+                    }
+
+                    int order = value.isText
+                        ? LookupIndex::compareText(text, length, value.text, value.length)
+                        : (number < value.number ? -1 : (number > value.number ? 1 : 0));
+                    if (mode == MatchMode::EXACT ? order != 0 : (mode == MatchMode::BELOW ? order > 0 : order < 0)) {
+                        continue;
+                    }
+                    if (found && mode != MatchMode::EXACT) {
+                        // Only a strictly closer value replaces the match, so ties keep the first cell
+                        int closer = value.isText
+                            ? LookupIndex::compareText(text, length, bestText, bestLength)
+                            : (number < bestNumber ? -1 : (number > bestNumber ? 1 : 0));
+                        if (mode == MatchMode::BELOW ? closer <= 0 : closer >= 0) {
+                            continue;
+                        }
+                    }
+
+                    found = true;
+                    done = mode == MatchMode::EXACT;
+                    bestNumber = number;
+                    bestText = text;
+                    bestLength = length;
+                    position = byRow ? firstRow + i - range.startRow : col - range.startCol;
+                }
+            });
+        return found;
+    }
+
+    // Folds the numbers among the masked rows [row, row + count) of the column
+    CellError foldMaskedRows(const Table& table, size_t row, size_t col, size_t count, uint64_t mask, NumberAggregate& numbers) {
+        CellError error = CellError::NONE;
+        table.getStorage().forEachStrip(row, col, row + count - 1, col,
+            [&](size_t firstRow, size_t stripCol, const CellPayload* payload, const CellKind* kinds,
+                uint64_t validMask, uint64_t numericMask, size_t laneCount) {
+                if (error != CellError::NONE) {
+                    return;
+                }
+                uint64_t lanes = mask >> (firstRow - row);
+                AggregateKernels::foldLanes(payload, numericMask & lanes, laneCount, numbers);
+
+                uint64_t others = validMask & ~numericMask & lanes;
+                for (size_t i = 0; i < laneCount && (others >> i) != 0 && error == CellError::NONE; i++) {
+                    if (((others >> i) & 1) == 0 || kinds[i] == CellKind::STRING) {
+                        continue;
+                    }
+                    if (kinds[i] == CellKind::ERROR_VALUE) {
+                        error = static_cast<CellError>(payload[i].handle);
+                        continue;
+                    }
+
+                    const DependencyNode* node = table.getCachedResult(firstRow + i, stripCol);
+                    if (node != nullptr) {
+                        error = node->error;
+                        if (node->kind != CellKind::STRING) {
+                            numbers.add(node->number);
+                        }
+                    }
+                }
+            });
+        return error;
+    }
+}
+
+// Whole numbers print as integers, anything else with two decimals. From
+// 2^52 on every double is whole and too long for the digit loop; printf
+// spells those out, infinities and NaN included.
+static MyString formatDecimal(double value) {
+    double magnitude = value < 0 ? -value : value;
+    if (!(magnitude < 4503599627370496.0)) {
+        char text[320];
+        snprintf(text, sizeof(text), "%.0f", value);
+        return MyString(text);
+    }
+
+    unsigned long long whole = static_cast<unsigned long long>(magnitude);
+    bool isWhole = static_cast<double>(whole) == magnitude;
+    unsigned long long hundredths = static_cast<unsigned long long>(magnitude * 100 + 0.5);
+
+    char buffer[32];
+    int index = 0;
+    if (!isWhole) {
+        whole = hundredths / 100;
+        buffer[index++] = '0' + static_cast<char>(hundredths % 10);
+        buffer[index++] = '0' + static_cast<char>(hundredths / 10 % 10);
+        buffer[index++] = '.';
+    }
+    do {
+        buffer[index++] = '0' + static_cast<char>(whole % 10);
+        whole /= 10;
+    } while (whole > 0);
+    if (value < 0) buffer[index++] = '-';
+
+    MyString result;
+    result.reserve(index);
+    while (index > 0) {
+        result.append(buffer[--index]);
+    }
+    return result;
+}
+
+FormulaProgram::FormulaProgram() {
+}
+
+void FormulaProgram::emit(OpCode op, uint32_t a, uint32_t b) {
+    Instruction instruction = { op, a, b };
+    code.push_back(instruction);
+}
+
+uint32_t FormulaProgram::addRange(size_t startRow, size_t startCol, size_t endRow, size_t endCol, MatchMode search) {
+    ProgramRange range = { startRow, startCol, endRow, endCol, search };
+    ranges.push_back(range);
+    return static_cast<uint32_t>(ranges.getSize() - 1);
+}
+
+uint32_t FormulaProgram::addNumber(double value) {
+    numbers.push_back(value);
+    return static_cast<uint32_t>(numbers.getSize() - 1);
+}
+
+uint32_t FormulaProgram::addText(const MyString& value) {
+    texts.push_back(value);
+    return static_cast<uint32_t>(texts.getSize() - 1);
+}
+
+uint32_t FormulaProgram::addCriteria(const Criteria& value) {
+    criteria.push_back(value);
+    return static_cast<uint32_t>(criteria.getSize() - 1);
+}
+
+void FormulaProgram::writeTo(BufferedWriter& out) const {
+    uint32_t counts[] = {
+        static_cast<uint32_t>(code.getSize()), static_cast<uint32_t>(ranges.getSize()),
+        static_cast<uint32_t>(numbers.getSize()), static_cast<uint32_t>(texts.getSize()),
+        static_cast<uint32_t>(criteria.getSize()), 0
+    };
+    out.write(counts, sizeof(counts));
+    for (const Instruction& instruction : code) {
+        out.writeValue(instruction);
+    }
+    for (const ProgramRange& range : ranges) {
+        out.writeValue(range);
+    }
+    for (double number : numbers) {
+        out.writeValue(number);
+    }
+    for (const MyString& text : texts) {
+        out.writeValue(static_cast<uint64_t>(text.length()));
+        out.write(text.data(), text.length());
+    }
+    for (const Criteria& test : criteria) {
+        test.writeTo(out);
+    }
+}
+
+bool FormulaProgram::readFrom(MemoryReader& in) {
+    uint32_t counts[6];
+    const char* bytes = in.take(sizeof(counts));
+    if (bytes == nullptr) {
+        return false;
+    }
+    memcpy(counts, bytes, sizeof(counts));
+
+    // Sizes are checked against the bytes left before anything is allocated
+    if (counts[0] > in.getRemaining() / sizeof(Instruction) || counts[1] > in.getRemaining() / sizeof(ProgramRange)
+        || counts[2] > in.getRemaining() / sizeof(double)) {
+        return false;
+    }
+
+    code.clear();
+    code.reserve(counts[0]);
+    for (uint32_t i = 0; i < counts[0]; i++) {
+        Instruction instruction;
+        in.readValue(instruction);
+        if (instruction.op > OpCode::RESULT_TEXT) {
+            return false;
+        }
+        code.push_back(instruction);
+    }
+
+    ranges.clear();
+    ranges.reserve(counts[1]);
+    for (uint32_t i = 0; i < counts[1]; i++) {
+        ProgramRange range;
+        if (!in.readValue(range) || range.search > MatchMode::ABOVE) {
+            return false;
+        }
+        ranges.push_back(range);
+    }
+
+    numbers.clear();
+    numbers.reserve(counts[2]);
+    for (uint32_t i = 0; i < counts[2]; i++) {
+        double number = 0.0;
+        in.readValue(number);
+        numbers.push_back(number);
+    }
+
+    texts.clear();
+    for (uint32_t i = 0; i < counts[3]; i++) {
+        uint64_t length = 0;
+        if (!in.readValue(length) || length > in.getRemaining()) {
+            return false;
+        }
+        texts.push_back(MyString(in.take(static_cast<size_t>(length)), static_cast<size_t>(length)));
+    }
+
+    criteria.clear();
+    for (uint32_t i = 0; i < counts[4]; i++) {
+        Criteria test;
+        if (!test.readFrom(in)) {
+            return false;
+        }
+        criteria.push_back(test);
+    }
+    return !in.hasFailed() && verify();
+}
+
+bool FormulaProgram::verify() const {
+    size_t depth = 0;
+    size_t conditionCount = 0;
+    size_t slotsNeeded = 0;     // slots the pending IF_VALUE conditions refer to
+    OpCode previous = OpCode::FAIL;
+
+    for (const Instruction& instruction : code) {
+        size_t needed = 0;      // slots the instruction reads
+        size_t pushed = 0;
+        size_t popped = 0;
+        size_t scratch = 0;     // slots written above the result without being pushed
+        bool range = false;     // a indexes ranges
+
+        switch (instruction.op) {
+        case OpCode::FAIL:
+            break;
+        case OpCode::PUSH:
+            pushed = 1;
+            break;
+        case OpCode::PUSH_NUMBER:
+            if (instruction.a >= numbers.getSize() || instruction.b > static_cast<uint32_t>(ResultFormat::TEXT)) {
+                return false;
+            }
+            pushed = 1;
+            break;
+        case OpCode::PUSH_TEXT:
+            if (instruction.a >= texts.getSize()) {
+                return false;
+            }
+            pushed = 1;
+            break;
+        case OpCode::PUSH_CELL:
+            range = true;
+            pushed = 1;
+            break;
+        case OpCode::FOLD_CONST:
+            if (instruction.a >= numbers.getSize()) {
+                return false;
+            }
+            needed = 1;
+            break;
+        case OpCode::TEXT_CONST:
+            if (instruction.a >= texts.getSize()) {
+                return false;
+            }
+            needed = 1;
+            break;
+        case OpCode::FOLD_CELL:
+        case OpCode::FOLD_RANGE:
+        case OpCode::COUNT_RANGE:
+        case OpCode::TEXT_CELL:
+            range = true;
+            needed = 1;
+            break;
+        case OpCode::TEXT_RANGE:
+        case OpCode::JOIN_RANGE:
+            // The text is built in the slot above the top
+            range = true;
+            needed = 1;
+            scratch = 1;
+            break;
+        case OpCode::PICK:
+            // Only a position MATCH found is picked
+            if (previous != OpCode::MATCH) {
+                return false;
+            }
+            range = true;
+            needed = 1;
+            break;
+        case OpCode::MATCH:
+            if (instruction.b > static_cast<uint32_t>(MatchMode::ABOVE)) {
+                return false;
+            }
+            range = true;
+            needed = 1;
+            break;
+        case OpCode::LOOKUP_OR:
+            if (instruction.b >= ranges.getSize()) {
+                return false;
+            }
+            range = true;
+            needed = 2;
+            popped = 1;
+            break;
+        case OpCode::TEXT_VALUE:
+        case OpCode::SUBSTR:
+        case OpCode::NEGATE:
+        case OpCode::RESULT_SUM:
+        case OpCode::RESULT_AVERAGE:
+        case OpCode::RESULT_MAX:
+        case OpCode::RESULT_LENGTH:
+        case OpCode::RESULT_COUNT:
+        case OpCode::RESULT_TEXT:
+            needed = 1;
+            break;
+        case OpCode::IF_CONST:
+        case OpCode::IF_VALUE:
+            if (conditionCount == MAX_CONDITIONS ||
+                (instruction.op == OpCode::IF_CONST && instruction.b >= criteria.getSize())) {
+                return false;
+            }
+            if (instruction.op == OpCode::IF_VALUE && instruction.b + 1 > slotsNeeded) {
+                slotsNeeded = instruction.b + 1;
+            }
+            conditionCount++;
+            range = true;
+            break;
+        case OpCode::FOLD_IF:
+        case OpCode::COUNT_IF:
+            if (conditionCount == 0 || slotsNeeded > instruction.b || instruction.b > conditionCount) {
+                return false;
+            }
+            range = instruction.op == OpCode::FOLD_IF;
+            needed = instruction.b;
+            popped = instruction.b;
+            pushed = 1;
+            conditionCount = 0;
+            slotsNeeded = 0;
+            break;
+        default:
+            // FOLD_VALUE, the binary operators and the comparisons
+            if (instruction.op > OpCode::RESULT_TEXT) {
+                return false;
+            }
+            needed = 2;
+            popped = 1;
+            break;
+        }
+
+        if ((range && instruction.a >= ranges.getSize()) || depth < needed || depth - popped + pushed > STACK_SIZE ||
+            depth + scratch > STACK_SIZE) {
+            return false;
+        }
+        depth = depth - popped + pushed;
+        previous = instruction.op;
+    }
+    return true;
+}
+
+const MyVector<ProgramRange>& FormulaProgram::getRanges() const {
+    return ranges;
+}
+
+MyString FormulaProgram::formatNumber(double value, ResultFormat format) {
+    switch (format) {
+    case ResultFormat::DECIMAL:
+        return formatDecimal(value);
+    case ResultFormat::INTEGER:
+        return formatDecimal(std::trunc(value));
+    case ResultFormat::BOOLEAN:
+        return ValueCell<bool>(value != 0.0).toString();
+    default:
+        return MyString("");
+    }
+}
+
+// The shortest of 15 or 17 significant digits that reads back unchanged, with
+// a fraction kept so that the text types as a decimal again
+MyString FormulaProgram::formatExact(double value) {
+    char text[40];
+    snprintf(text, sizeof(text), "%.15g", value);
+    if (strtod(text, nullptr) != value) {
+        snprintf(text, sizeof(text), "%.17g", value);
+    }
+    MyString result(text);
+    if (strpbrk(text, ".e") == nullptr) {
+        result.append('.');
+        result.append('0');
+    }
+    return result;
+}
+
+bool FormulaProgram::clipRange(const Table& table, const ProgramRange& range, size_t& endRow, size_t& endCol) {
+    if (table.getRowCount() == 0 || table.getColumnCount() == 0) {
+        return false;
+    }
+
+    endRow = range.endRow < table.getRowCount() ? range.endRow : table.getRowCount() - 1;
+    endCol = range.endCol < table.getColumnCount() ? range.endCol : table.getColumnCount() - 1;
+    return range.startRow <= endRow && range.startCol <= endCol;
+}
+
+CellError FormulaProgram::foldNumbers(const Table& table, size_t startRow, size_t startCol, size_t endRow, size_t endCol, NumberAggregate& numbers) {
+    // Literal numbers are reduced straight from the column strips by the vector
+    // kernels; the other lanes are checked for errors on the same visit and
+    // references and formulas contribute their cached numbers
+    CellError error = CellError::NONE;
+    table.getStorage().forEachStrip(startRow, startCol, endRow, endCol,
+        [&](size_t firstRow, size_t col, const CellPayload* payload, const CellKind* kinds,
+            uint64_t validMask, uint64_t numericMask, size_t count) {
+            if (error != CellError::NONE) {
+                return;
+            }
+            AggregateKernels::foldLanes(payload, numericMask, count, numbers);
+
+            uint64_t others = validMask & ~numericMask;
+            for (size_t i = 0; i < count && (others >> i) != 0 && error == CellError::NONE; i++) {
+                if (((others >> i) & 1) == 0 || kinds[i] == CellKind::STRING) {
+                    continue;
+                }
+                if (kinds[i] == CellKind::ERROR_VALUE) {
+                    error = static_cast<CellError>(payload[i].handle);
+                    continue;
+                }
+
+                const DependencyNode* node = table.getCachedResult(firstRow + i, col);
+                if (node != nullptr) {
+                    error = node->error;
+                    numbers.add(node->number);
+                }
+            }
+        });
+    return error;
+}
+
+CellError FormulaProgram::countValues(const Table& table, size_t startRow, size_t startCol, size_t endRow, size_t endCol, size_t& total) {
+    // Numbers always render non-empty, so only the other lanes need their text
+    const StringInterner& strings = table.getStorage().getStrings();
+    CellError error = CellError::NONE;
+    table.getStorage().forEachStrip(startRow, startCol, endRow, endCol,
+        [&](size_t firstRow, size_t col, const CellPayload* payload, const CellKind* kinds,
+            uint64_t validMask, uint64_t numericMask, size_t count) {
+            if (error != CellError::NONE) {
+                return;
+            }
+            total += AggregateKernels::countLanes(numericMask, count);
+
+            uint64_t rendered = validMask & ~numericMask;
+            for (size_t i = 0; i < count && (rendered >> i) != 0 && error == CellError::NONE; i++) {
+                if (((rendered >> i) & 1) == 0) {
+                    continue;
+                }
+
+                if (kinds[i] == CellKind::STRING) {
+                    if (strings.getLength(static_cast<uint32_t>(payload[i].handle)) > 0) {
+                        total++;
+                    }
+                }
+                else if (kinds[i] == CellKind::ERROR_VALUE) {
+                    error = static_cast<CellError>(payload[i].handle);
+                }
+                else {
+                    const DependencyNode* node = table.getCachedResult(firstRow + i, col);
+                    if (node != nullptr) {
+                        error = node->error;
+                        if (node->text.length() > 0) {
+                            total++;
+                        }
+                    }
+                }
+            }
+        });
+    return error;
+}
+
+CellError FormulaProgram::foldWhere(const Table& table, const ProgramRange* const* tested, const Criteria* const* tests,
+    size_t conditionCount, const ProgramRange* fold, NumberAggregate& numbers) {
+    // Every range is cut to the part of the shape that lies inside the table for all of them
+    size_t rows = tested[0]->endRow - tested[0]->startRow + 1;
+    size_t cols = tested[0]->endCol - tested[0]->startCol + 1;
+    for (size_t k = 0; k <= conditionCount; k++) {
+        const ProgramRange* range = k < conditionCount ? tested[k] : fold;
+        if (range == nullptr) {
+            continue;
+        }
+        size_t rowsInside = range->startRow < table.getRowCount() ? table.getRowCount() - range->startRow : 0;
+        size_t colsInside = range->startCol < table.getColumnCount() ? table.getColumnCount() - range->startCol : 0;
+        rows = rows < rowsInside ? rows : rowsInside;
+        cols = cols < colsInside ? cols : colsInside;
+    }
+
+    for (size_t col = 0; col < cols; col++) {
+        for (size_t row = 0; row < rows; row += 64) {
+            size_t count = rows - row < 64 ? rows - row : 64;
+            uint64_t mask = count == 64 ? ~0ULL : (1ULL << count) - 1;
+            for (size_t k = 0; k < conditionCount && mask != 0; k++) {
+                mask &= tests[k]->matchRows(table, tested[k]->startRow + row, tested[k]->startCol + col, count);
+            }
+            if (mask == 0) {
+                continue;
+            }
+
+            if (fold == nullptr) {
+                numbers.count += AggregateKernels::countLanes(mask, count);
+                continue;
+            }
+            CellError error = foldMaskedRows(table, fold->startRow + row, fold->startCol + col, count, mask, numbers);
+            if (error != CellError::NONE) {
+                return error;
+            }
+        }
+    }
+    return CellError::NONE;
+}
+
+CellError FormulaProgram::run(const Table* table, FormulaResult& result) const {
+    StackSlot stack[STACK_SIZE];
+    size_t depth = 0;
+    Condition conditions[MAX_CONDITIONS];
+    size_t conditionCount = 0;
+
+    for (const Instruction& instruction : code) {
+        StackSlot& top = stack[depth > 0 ? depth - 1 : 0];
+
+        switch (instruction.op) {
+        case OpCode::FAIL:
+            return CellError::VALUE;
+        case OpCode::PUSH:
+            stack[depth++].reset();
+            break;
+        case OpCode::PUSH_NUMBER:
+            stack[depth].reset();
+            stack[depth++].setNumber(numbers.atUnchecked(instruction.a), static_cast<ResultFormat>(instruction.b));
+            break;
+        case OpCode::PUSH_TEXT: {
+            StackSlot& slot = stack[depth++];
+            slot.reset();
+            slot.text = texts.atUnchecked(instruction.a);
+            slot.hasText = true;
+            slot.format = ResultFormat::TEXT;
+            break;
+        }
+        case OpCode::PUSH_CELL: {
+            const ProgramRange& cell = ranges.atUnchecked(instruction.a);
+            StackSlot& slot = stack[depth++];
+            if (table == nullptr) {
+                slot.reset();
+                break;
+            }
+            CellError error = loadCell(*table, cell.startRow, cell.startCol, slot);
+            if (error != CellError::NONE) {
+                return error;
+            }
+            break;
+        }
+        case OpCode::FOLD_CONST:
+            top.numbers.add(numbers.atUnchecked(instruction.a));
+            break;
+        case OpCode::FOLD_CELL: {
+            const ProgramRange& cell = ranges.atUnchecked(instruction.a);
+            if (table == nullptr) {
+                break;
+            }
+            CellError error = table->getCellError(cell.startRow, cell.startCol);
+            if (error != CellError::NONE) {
+                return error;
+            }
+            CellKind kind = table->getCellKind(cell.startRow, cell.startCol);
+            if (isNumericKind(kind) || kind == CellKind::REFERENCE || kind == CellKind::FORMULA) {
+                top.numbers.add(table->getCellNumber(cell.startRow, cell.startCol));
+            }
+            break;
+        }
+        case OpCode::FOLD_RANGE: {
+            const ProgramRange& range = ranges.atUnchecked(instruction.a);
+            size_t endRow, endCol;
+            if (table == nullptr || !clipRange(*table, range, endRow, endCol)) {
+                break;
+            }
+
+            // Indexed columns holding only literals are settled by their summary
+            const RangeAggregateIndex& index = table->getAggregateIndex();
+            if (!index.coversAny(range.startCol, endCol)) {
+                CellError error = foldNumbers(*table, range.startRow, range.startCol, endRow, endCol, top.numbers);
+                if (error != CellError::NONE) {
+                    return error;
+                }
+                break;
+            }
+            for (size_t col = range.startCol; col <= endCol; col++) {
+                ColumnSummary summary;
+                CellError error = CellError::NONE;
+                if (index.query(table->getStorage(), col, range.startRow, endRow, summary) &&
+                    summary.evaluated == 0 && summary.errors == 0) {
+                    top.numbers.merge(summary.numbers);
+                }
+                else {
+                    error = foldNumbers(*table, range.startRow, col, endRow, col, top.numbers);
+                }
+                if (error != CellError::NONE) {
+                    return error;
+                }
+            }
+            break;
+        }
+        case OpCode::FOLD_VALUE:
+            // Texts take no part in numeric calculations, like text constants
+            if (top.format != ResultFormat::TEXT) {
+                stack[depth - 2].numbers.add(top.value);
+            }
+            depth--;
+            break;
+        case OpCode::COUNT_RANGE: {
+            const ProgramRange& range = ranges.atUnchecked(instruction.a);
+            size_t endRow, endCol;
+            if (table == nullptr || !clipRange(*table, range, endRow, endCol)) {
+                break;
+            }
+
+            const RangeAggregateIndex& index = table->getAggregateIndex();
+            if (!index.coversAny(range.startCol, endCol)) {
+                CellError error = countValues(*table, range.startRow, range.startCol, endRow, endCol, top.numbers.count);
+                if (error != CellError::NONE) {
+                    return error;
+                }
+                break;
+            }
+            for (size_t col = range.startCol; col <= endCol; col++) {
+                ColumnSummary summary;
+                CellError error = CellError::NONE;
+                if (index.query(table->getStorage(), col, range.startRow, endRow, summary) &&
+                    summary.evaluated == 0 && summary.errors == 0) {
+                    top.numbers.count += summary.numbers.count + summary.texts;
+                }
+                else {
+                    error = countValues(*table, range.startRow, col, endRow, col, top.numbers.count);
+                }
+                if (error != CellError::NONE) {
+                    return error;
+                }
+            }
+            break;
+        }
+        case OpCode::TEXT_CONST:
+            top.text = texts.atUnchecked(instruction.a);
+            top.hasText = true;
+            break;
+        case OpCode::TEXT_CELL: {
+            const ProgramRange& cell = ranges.atUnchecked(instruction.a);
+            if (table == nullptr || table->getCellKind(cell.startRow, cell.startCol) == CellKind::EMPTY) {
+                break;
+            }
+            CellError error = table->getCellError(cell.startRow, cell.startCol);
+            if (error != CellError::NONE) {
+                return error;
+            }
+            top.text = table->getCellText(cell.startRow, cell.startCol);
+            top.hasText = true;
+            break;
+        }
+        case OpCode::TEXT_VALUE:
+            if (top.format != ResultFormat::TEXT) {
+                top.text = formatNumber(top.value, top.format);
+                top.hasText = true;
+            }
+            break;
+        case OpCode::TEXT_RANGE:
+        case OpCode::JOIN_RANGE: {
+            const ProgramRange& range = ranges.atUnchecked(instruction.a);
+            bool join = instruction.op == OpCode::JOIN_RANGE;
+            if (join && !top.hasText) {
+                return CellError::VALUE;
+            }
+
+            // Texts are visited row by row; the join is built in the next slot.
+            // Once TEXT_RANGE has its text the rest is only checked for errors.
+            StackSlot& joined = stack[depth];
+            joined.reset();
+            size_t endRow, endCol;
+            if (table != nullptr && clipRange(*table, range, endRow, endCol)) {
+                for (size_t row = range.startRow; row <= endRow; row++) {
+                    for (size_t col = range.startCol; col <= endCol; col++) {
+                        if (table->getCellKind(row, col) == CellKind::EMPTY) {
+                            continue;
+                        }
+                        CellError error = table->getCellError(row, col);
+                        if (error != CellError::NONE) {
+                            return error;
+                        }
+                        if (joined.hasText && !join) {
+                            continue;
+                        }
+                        MyString cellText = table->getCellText(row, col);
+                        if (cellText.length() == 0) {
+                            continue;
+                        }
+                        if (joined.hasText) {
+                            joined.text.append(top.text);
+                            joined.text.append(cellText);
+                        }
+                        else {
+                            joined.text = move(cellText);
+                            joined.hasText = true;
+                        }
+                    }
+                }
+            }
+
+            if (join && !joined.hasText) {
+                return CellError::VALUE;
+            }
+            if (joined.hasText) {
+                top.text = move(joined.text);
+                top.hasText = true;
+            }
+            break;
+        }
+        case OpCode::SUBSTR: {
+            if (!top.hasText) {
+                return CellError::VALUE;
+            }
+
+            size_t start = instruction.a;
+            size_t length = instruction.b;
+            if (start >= top.text.length() || start + length > top.text.length()) {
+                return CellError::VALUE;
+            }
+            top.text = MyString(top.text.data() + start, length);
+            break;
+        }
+        case OpCode::ADD:
+        case OpCode::SUBTRACT:
+        case OpCode::MULTIPLY:
+        case OpCode::DIVIDE:
+        case OpCode::POWER: {
+            StackSlot& left = stack[depth - 2];
+            if (left.format == ResultFormat::TEXT || top.format == ResultFormat::TEXT) {
+                return CellError::VALUE;
+            }
+
+            double value = 0.0;
+            switch (instruction.op) {
+            case OpCode::ADD:
+                value = left.value + top.value;
+                break;
+            case OpCode::SUBTRACT:
+                value = left.value - top.value;
+                break;
+            case OpCode::MULTIPLY:
+                value = left.value * top.value;
+                break;
+            case OpCode::DIVIDE:
+                if (top.value == 0.0) {
+                    return CellError::DIV_ZERO;
+                }
+                value = left.value / top.value;
+                break;
+            default:
+                value = pow(left.value, top.value);
+                break;
+            }
+            if (!isfinite(value)) {
+                return CellError::VALUE;
+            }
+            left.setNumber(value, ResultFormat::DECIMAL);
+            depth--;
+            break;
+        }
+        case OpCode::NEGATE:
+            if (top.format == ResultFormat::TEXT) {
+                return CellError::VALUE;
+            }
+            top.setNumber(-top.value, ResultFormat::DECIMAL);
+            break;
+        case OpCode::EQUAL:
+        case OpCode::NOT_EQUAL:
+        case OpCode::LESS:
+        case OpCode::LESS_EQUAL:
+        case OpCode::GREATER:
+        case OpCode::GREATER_EQUAL: {
+            StackSlot& left = stack[depth - 2];
+            int order = compareValues(left, top);
+            bool holds = false;
+            switch (instruction.op) {
+            case OpCode::EQUAL:
+                holds = order == 0;
+                break;
+            case OpCode::NOT_EQUAL:
+                holds = order != 0;
+                break;
+            case OpCode::LESS:
+                holds = order < 0;
+                break;
+            case OpCode::LESS_EQUAL:
+                holds = order <= 0;
+                break;
+            case OpCode::GREATER:
+                holds = order > 0;
+                break;
+            default:
+                holds = order >= 0;
+                break;
+            }
+            left.setNumber(holds ? 1.0 : 0.0, ResultFormat::BOOLEAN);
+            depth--;
+            break;
+        }
+        case OpCode::MATCH: {
+            size_t position;
+            if (table == nullptr || !findMatch(*table, ranges.atUnchecked(instruction.a),
+                static_cast<MatchMode>(instruction.b), top, position)) {
+                return CellError::NA;
+            }
+            top.setNumber(static_cast<double>(position + 1), ResultFormat::INTEGER);
+            break;
+        }
+        case OpCode::PICK: {
+            const ProgramRange& range = ranges.atUnchecked(instruction.a);
+            // Positions outside the range would read cells the formula does not depend on
+            if (!(top.value >= 1.0) || top.value > static_cast<double>(lineLength(range))) {
+                return CellError::REF;
+            }
+            size_t offset = static_cast<size_t>(top.value) - 1;
+            if (table == nullptr) {
+                top.reset();
+                break;
+            }
+            CellError error = searchesRows(range)
+                ? loadCell(*table, range.startRow + offset, range.startCol, top)
+                : loadCell(*table, range.startRow, range.startCol + offset, top);
+            if (error != CellError::NONE) {
+                return error;
+            }
+            break;
+        }
+        case OpCode::LOOKUP_OR: {
+            StackSlot& key = stack[depth - 2];
+            const ProgramRange& result = ranges.atUnchecked(instruction.b);
+            size_t offset;
+            if (table != nullptr && findMatch(*table, ranges.atUnchecked(instruction.a), MatchMode::EXACT, key, offset)) {
+                if (offset >= lineLength(result)) {
+                    return CellError::REF;
+                }
+                CellError error = searchesRows(result)
+                    ? loadCell(*table, result.startRow + offset, result.startCol, key)
+                    : loadCell(*table, result.startRow, result.startCol + offset, key);
+                if (error != CellError::NONE) {
+                    return error;
+                }
+            }
+            else {
+                key = move(top);
+            }
+            depth--;
+            break;
+        }
+        case OpCode::IF_CONST:
+        case OpCode::IF_VALUE: {
+            Condition& condition = conditions[conditionCount++];
+            condition.range = &ranges.atUnchecked(instruction.a);
+            condition.criteria = instruction.op == OpCode::IF_CONST ? &criteria.atUnchecked(instruction.b) : nullptr;
+            condition.slot = instruction.b;
+            break;
+        }
+        case OpCode::FOLD_IF:
+        case OpCode::COUNT_IF: {
+            // Criteria the formula computes are compiled once, before any range is read.
+            // There are at most as many as conditions, so they fit on the stack.
+            size_t base = depth - instruction.b;
+            Criteria compiled[MAX_CONDITIONS];
+            for (size_t k = 0; k < instruction.b; k++) {
+                const StackSlot& slot = stack[base + k];
+                compiled[k] = slot.format == ResultFormat::TEXT
+                    ? Criteria::parse(slot.text.data(), slot.text.length())
+                    : Criteria::fromNumber(slot.value);
+            }
+
+            const ProgramRange* tested[MAX_CONDITIONS];
+            const Criteria* tests[MAX_CONDITIONS];
+            for (size_t k = 0; k < conditionCount; k++) {
+                tested[k] = conditions[k].range;
+                tests[k] = conditions[k].criteria != nullptr ? conditions[k].criteria : &compiled[conditions[k].slot];
+            }
+            size_t testCount = conditionCount;
+            conditionCount = 0;
+
+            StackSlot& folded = stack[base];
+            folded.reset();
+            depth = base + 1;
+            if (table != nullptr) {
+                CellError error = foldWhere(*table, tested, tests, testCount,
+                    instruction.op == OpCode::FOLD_IF ? &ranges.atUnchecked(instruction.a) : nullptr, folded.numbers);
+                if (error != CellError::NONE) {
+                    return error;
+                }
+            }
+            break;
+        }
+        case OpCode::RESULT_SUM:
+        case OpCode::RESULT_AVERAGE:
+            if (top.numbers.count == 0) {
+                return CellError::VALUE;
+            }
+            top.setNumber(instruction.op == OpCode::RESULT_SUM
+                ? top.numbers.sum
+                : top.numbers.sum / static_cast<double>(top.numbers.count), ResultFormat::DECIMAL);
+            break;
+        case OpCode::RESULT_MAX:
+            if (top.numbers.count == 0) {
+                return CellError::VALUE;
+            }
+            top.setNumber(top.numbers.max, ResultFormat::INTEGER);
+            break;
+        case OpCode::RESULT_LENGTH:
+            top.setNumber(top.hasText ? static_cast<double>(top.text.length()) : 0.0, ResultFormat::INTEGER);
+            break;
+        case OpCode::RESULT_COUNT:
+            top.setNumber(static_cast<double>(top.numbers.count), ResultFormat::INTEGER);
+            break;
+        case OpCode::RESULT_TEXT:
+            top.format = ResultFormat::TEXT;
+            break;
+        }
+    }
+
+    if (depth != 1) {
+        return CellError::VALUE;
+    }
+
+    // Numbers are rendered once, at the end
+    StackSlot& value = stack[0];
+    if (value.format == ResultFormat::TEXT) {
+        result.text = move(value.text);
+        result.kind = CellKind::STRING;
+    }
+    else {
+        result.number = value.value;
+        result.text = formatNumber(value.value, value.format);
+        result.kind = value.format == ResultFormat::BOOLEAN ? CellKind::BOOL : CellKind::DOUBLE;
+    }
+    return CellError::NONE;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include "MyString.h"
+#include "MyVector.hpp"
+#include "CellKind.h"
+#include "Criteria.h"
+
+class Table; // Forward declaration
+struct NumberAggregate;
+class BufferedWriter;
+class MemoryReader;
+
+// Instructions of the formula VM. Every value lives in a stack slot holding a
+// running sum, max and count of the numbers folded into it, a scalar value
+// and one text. Every instruction reading cells fails with the first error
+// one of them shows.
+enum class OpCode : unsigned char {
+    FAIL,           // the formula is malformed, always #VALUE!
+    PUSH,           // pushes an empty slot
+    PUSH_NUMBER,    // a: number, b: ResultFormat; pushes a constant
+    PUSH_TEXT,      // a: text; pushes a constant text
+    PUSH_CELL,      // a: range; pushes the cell's value, empty cells read as 0
+    FOLD_CONST,     // a: number; folds a constant into the top slot
+    FOLD_CELL,      // a: range; folds the cell's number if it has one
+    FOLD_RANGE,     // a: range; folds every number in the range
+    FOLD_VALUE,     // pops a value and folds its number, if any, into the slot below
+    COUNT_RANGE,    // a: range; counts the cells that show something
+    TEXT_CONST,     // a: text; sets the top slot's text
+    TEXT_CELL,      // a: range; sets the top slot's text to the cell's, if not empty
+    TEXT_RANGE,     // a: range; sets the top slot's text to the first non-empty one
+    TEXT_VALUE,     // renders the top slot's value as its text
+    JOIN_RANGE,     // a: range; joins the non-empty texts using the top slot's text as delimiter
+    SUBSTR,         // a: start, b: length; cuts the top slot's text
+    ADD,            // binary operators pop two values and push the result
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    POWER,
+    NEGATE,
+    EQUAL,          // comparisons push a boolean
+    NOT_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL,
+    MATCH,          // a: range, b: MatchMode; replaces the key on top with its 1-based position, #N/A if absent
+    PICK,           // a: range; replaces the position on top with the value of the range's cell there
+    LOOKUP_OR,      // a: lookup range, b: result range; pops the fallback, replaces the key
+                    // below with the result at its match or with the fallback
+    IF_CONST,       // a: range, b: criteria; adds a condition for the next FOLD_IF or COUNT_IF
+    IF_VALUE,       // a: range, b: slot; adds a condition on the criterion in the b-th of the
+                    // slots the next FOLD_IF or COUNT_IF consumes
+    FOLD_IF,        // a: range, b: slots; pops b criteria and pushes a slot folding the
+                    // range's numbers where every condition holds, then drops the conditions
+    COUNT_IF,       // b: slots; the same, counting the positions where every condition holds
+    RESULT_SUM,     // the RESULT_ ops reduce the top slot to its value
+    RESULT_AVERAGE,
+    RESULT_MAX,
+    RESULT_LENGTH,
+    RESULT_COUNT,
+    RESULT_TEXT
+};
+
+struct Instruction {
+    OpCode op;
+    uint32_t a;
+    uint32_t b;
+};
+
+// How a lookup compares its key with the searched cells
+enum class MatchMode : unsigned char {
+    NONE,       // the range is not searched
+    EXACT,      // first cell equal to the key
+    BELOW,      // largest value not above the key
+    ABOVE       // smallest value not below the key
+};
+
+// Inclusive rectangle read by a formula; single cells are 1x1 ranges
+struct ProgramRange {
+    size_t startRow, startCol, endRow, endCol;
+    MatchMode search;   // how lookups search it, which tells the table what to index
+};
+
+// How the result of a program is rendered as text
+enum class ResultFormat : unsigned char {
+    DECIMAL,    // integers plainly, anything else with two decimals
+    INTEGER,    // truncated to an integer
+    BOOLEAN,    // true or false
+    TEXT
+};
+
+// What a formula shows: its rendered value and number, or an error
+struct FormulaResult {
+    MyString text;      // empty for errors
+    double number;      // 0 for texts and errors
+    CellKind kind;      // DOUBLE, BOOL or STRING
+    CellError error;
+
+    FormulaResult() : number(0.0), kind(CellKind::DOUBLE), error(CellError::NONE) {}
+};
+
+// A formula compiled once into bytecode. Running it needs no heap memory
+// beyond what the cells' texts take: the stack is a fixed array and the
+// compiler rejects formulas nesting deeper than it.
+class FormulaProgram {
+public:
+    static const size_t STACK_SIZE = 16;
+    // Range and criteria pairs one FOLD_IF or COUNT_IF may test
+    static const size_t MAX_CONDITIONS = 8;
+
+private:
+    MyVector<Instruction> code;
+    MyVector<ProgramRange> ranges;
+    MyVector<double> numbers;
+    MyVector<MyString> texts;
+    MyVector<Criteria> criteria;
+
+    static bool clipRange(const Table& table, const ProgramRange& range, size_t& endRow, size_t& endCol);
+    // Strip scans over one block of the range, used wherever no column index helps.
+    // Both visit each cell once and stop at the first error, which they return.
+    static CellError foldNumbers(const Table& table, size_t startRow, size_t startCol, size_t endRow, size_t endCol, NumberAggregate& numbers);
+    static CellError countValues(const Table& table, size_t startRow, size_t startCol, size_t endRow, size_t endCol, size_t& count);
+    // Folds the numbers of fold, or counts the positions when it is null, where
+    // every criteria holds for the cell at the same offset of its range. All
+    // ranges have one shape; the conditions are tested 64 rows at a time.
+    static CellError foldWhere(const Table& table, const ProgramRange* const* tested, const Criteria* const* tests,
+        size_t conditionCount, const ProgramRange* fold, NumberAggregate& numbers);
+    // Checks what run takes for granted: operand indexes, stack depths and
+    // condition counts. Compiled programs always pass.
+    bool verify() const;
+
+public:
+    FormulaProgram();
+
+    void emit(OpCode op, uint32_t a = 0, uint32_t b = 0);
+    uint32_t addRange(size_t startRow, size_t startCol, size_t endRow, size_t endCol, MatchMode search = MatchMode::NONE);
+    uint32_t addNumber(double value);
+    uint32_t addText(const MyString& value);
+    uint32_t addCriteria(const Criteria& value);
+
+    // Every cell and range the program reads, for dependency tracking
+    const MyVector<ProgramRange>& getRanges() const;
+
+    // Renders a number the way a result of the format shows
+    static MyString formatNumber(double value, ResultFormat format);
+    // Renders a number so that typing the text back in gives the same double
+    static MyString formatExact(double value);
+
+    // Executes the program and renders its value into result; returns the error
+    // the formula shows instead, or NONE
+    CellError run(const Table* table, FormulaResult& result) const;
+
+    // Snapshot form: the array sizes, the instructions, ranges and numbers as
+    // they lie in memory, then the texts and criteria. A program read back is
+    // verified before it can run.
+    void writeTo(BufferedWriter& out) const;
+    bool readFrom(MemoryReader& in);
+};
@@ -0,0 +1,551 @@
+#include "LookupIndex.h"
+#include <cstring>
+
+const size_t LookupIndex::MIN_INDEXED_ROWS;
+const uint32_t LookupIndex::NO_ROW;
+const uint32_t LookupIndex::TOMBSTONE;
+
+static uint64_t numberBits(double number) {
+    // -0 has to find 0
+    if (number == 0.0) {
+        number = 0.0;
+    }
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return bits;
+}
+
+static double bitsNumber(uint64_t bits) {
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    return number;
+}
+
+LookupIndex::LookupIndex() : pending(false) {
+}
+
+LookupIndex::~LookupIndex() {
+    clear();
+}
+
+uint64_t LookupIndex::hashKey(uint64_t key, unsigned char state) {
+    // splitmix64 finalizer; a number and a string id never share a key anyway
+    key ^= static_cast<uint64_t>(state) << 56;
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+    return key;
+}
+
+void LookupIndex::readRow(const CellStorage& cells, size_t row, size_t col, uint64_t& key, unsigned char& state) {
+    CellValue value = cells.getValue(row, col);
+    key = 0;
+    switch (value.kind) {
+    case CellKind::INT:
+        key = numberBits(static_cast<double>(value.intValue));
+        state = ROW_NUMBER;
+        break;
+    case CellKind::BOOL:
+        key = numberBits(value.boolValue ? 1.0 : 0.0);
+        state = ROW_NUMBER;
+        break;
+    case CellKind::DOUBLE:
+        key = numberBits(value.doubleValue);
+        state = ROW_NUMBER;
+        break;
+    case CellKind::STRING:
+        key = value.stringId;
+        state = ROW_TEXT;
+        break;
+    case CellKind::REFERENCE:
+    case CellKind::FORMULA:
+        state = ROW_EVALUATED;
+        break;
+    default:
+        state = ROW_NONE;
+        break;
+    }
+}
+
+bool LookupIndex::makeKey(const StringInterner& strings, const LookupKey& value, uint64_t& key, unsigned char& state) {
+    if (!value.isText) {
+        key = numberBits(value.number);
+        state = ROW_NUMBER;
+        return true;
+    }
+
+    // Texts no cell holds are not interned, and then nothing matches them
+    uint32_t id;
+    if (!strings.find(value.text, value.length, id)) {
+        return false;
+    }
+    key = id;
+    state = ROW_TEXT;
+    return true;
+}
+
+int LookupIndex::compareRows(const StringInterner& strings, const ColumnIndex& index, uint32_t left, uint32_t right) {
+    unsigned char leftState = index.states.atUnchecked(left);
+    unsigned char rightState = index.states.atUnchecked(right);
+    if (leftState != rightState) {
+        return leftState == ROW_NUMBER ? -1 : 1;
+    }
+
+    uint64_t leftKey = index.keys.atUnchecked(left);
+    uint64_t rightKey = index.keys.atUnchecked(right);
+    if (leftKey == rightKey) {
+        return 0;
+    }
+    if (leftState == ROW_NUMBER) {
+        return bitsNumber(leftKey) < bitsNumber(rightKey) ? -1 : 1;
+    }
+
+    uint32_t leftId = static_cast<uint32_t>(leftKey);
+    uint32_t rightId = static_cast<uint32_t>(rightKey);
+    return compareText(strings.getText(leftId), strings.getLength(leftId), strings.getText(rightId), strings.getLength(rightId));
+}
+
+int LookupIndex::compareToKey(const StringInterner& strings, const ColumnIndex& index, uint32_t row, const LookupKey& value) {
+    unsigned char state = index.states.atUnchecked(row);
+    if ((state == ROW_TEXT) != value.isText) {
+        return state == ROW_NUMBER ? -1 : 1;
+    }
+
+    uint64_t key = index.keys.atUnchecked(row);
+    if (state == ROW_NUMBER) {
+        double number = bitsNumber(key);
+        return number < value.number ? -1 : (number > value.number ? 1 : 0);
+    }
+
+    uint32_t id = static_cast<uint32_t>(key);
+    return compareText(strings.getText(id), strings.getLength(id), value.text, value.length);
+}
+
+// Returns the bucket heading the key's chain, or the first free bucket on its probe path
+size_t LookupIndex::findBucket(const ColumnIndex& index, uint64_t key, unsigned char state) {
+    size_t mask = index.buckets.getSize() - 1;
+    size_t slot = hashKey(key, state) & mask;
+    size_t firstFree = index.buckets.getSize();
+
+    while (true) {
+        uint32_t head = index.buckets.atUnchecked(slot);
+        if (head == NO_ROW) {
+            return firstFree < index.buckets.getSize() ? firstFree : slot;
+        }
+        if (head == TOMBSTONE) {
+            if (firstFree == index.buckets.getSize()) {
+                firstFree = slot;
+            }
+        }
+        else if (index.states.atUnchecked(head) == state && index.keys.atUnchecked(head) == key) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+void LookupIndex::rehash(ColumnIndex& index, size_t bucketCount) {
+    MyVector<uint32_t> old = move(index.buckets);
+    index.buckets.clear();
+    index.buckets.reserve(bucketCount);
+    for (size_t i = 0; i < bucketCount; i++) {
+        index.buckets.push_back(NO_ROW);
+    }
+
+    for (uint32_t head : old) {
+        if (head != NO_ROW && head != TOMBSTONE) {
+            index.buckets[findBucket(index, index.keys[head], index.states[head])] = head;
+        }
+    }
+    index.usedBuckets = index.chainCount;
+}
+
+// Puts a keyed row into its key's chain, which stays in row order
+void LookupIndex::link(ColumnIndex& index, uint32_t row) {
+    if ((index.usedBuckets + 1) * 2 > index.buckets.getSize()) {
+        size_t bucketCount = 16;
+        while (bucketCount < (index.chainCount + 1) * 4) {
+            bucketCount *= 2;
+        }
+        rehash(index, bucketCount);
+    }
+
+    size_t slot = findBucket(index, index.keys[row], index.states[row]);
+    uint32_t head = index.buckets[slot];
+    if (head == NO_ROW || head == TOMBSTONE) {
+        if (head == NO_ROW) {
+            index.usedBuckets++;
+        }
+        index.chainCount++;
+        index.buckets[slot] = row;
+        index.next[row] = NO_ROW;
+        return;
+    }
+
+    if (row < head) {
+        index.next[row] = head;
+        index.buckets[slot] = row;
+        return;
+    }
+    uint32_t previous = head;
+    while (index.next[previous] != NO_ROW && index.next[previous] < row) {
+        previous = index.next[previous];
+    }
+    index.next[row] = index.next[previous];
+    index.next[previous] = row;
+}
+
+void LookupIndex::unlink(ColumnIndex& index, uint32_t row) {
+    size_t slot = findBucket(index, index.keys[row], index.states[row]);
+    uint32_t head = index.buckets[slot];
+    if (head == row) {
+        if (index.next[row] == NO_ROW) {
+            index.buckets[slot] = TOMBSTONE;
+            index.chainCount--;
+        }
+        else {
+            index.buckets[slot] = index.next[row];
+        }
+        return;
+    }
+
+    uint32_t previous = head;
+    while (index.next[previous] != row) {
+        previous = index.next[previous];
+    }
+    index.next[previous] = index.next[row];
+}
+
+void LookupIndex::build(const CellStorage& cells, ColumnIndex& index, size_t col, size_t rowCount) {
+    index.rowCount = rowCount;
+    index.evaluated = 0;
+    index.keys.clear();
+    index.keys.resize(rowCount);
+    index.states.clear();
+    index.states.resize(rowCount);
+    index.next.clear();
+    index.buckets.clear();
+    index.usedBuckets = 0;
+    index.chainCount = 0;
+    index.sorted.clear();
+
+    cells.forEachStrip(0, col, rowCount - 1, col,
+        [&](size_t firstRow, size_t /*stripCol*/, const CellPayload* payload, const CellKind* kinds,
+            uint64_t validMask, uint64_t /*numericMask*/, size_t count) {
+            for (size_t i = 0; i < count && (validMask >> i) != 0; i++) {
+                if (((validMask >> i) & 1) == 0) {
+                    continue;
+                }
+                size_t row = firstRow + i;
+                if (isNumericKind(kinds[i])) {
+                    index.keys[row] = numberBits(payload[i].number);
+                    index.states[row] = ROW_NUMBER;
+                }
+                else if (kinds[i] == CellKind::STRING) {
+                    index.keys[row] = payload[i].handle;
+                    index.states[row] = ROW_TEXT;
+                }
+                else if (kinds[i] == CellKind::REFERENCE || kinds[i] == CellKind::FORMULA) {
+                    index.states[row] = ROW_EVALUATED;
+                    index.evaluated++;
+                }
+            }
+        });
+
+    if (index.hashWanted) {
+        index.next.resize(rowCount);
+        // Going up from the last row every row becomes the head of its chain
+        for (size_t row = rowCount; row > 0; row--) {
+            unsigned char state = index.states[row - 1];
+            if (state == ROW_NUMBER || state == ROW_TEXT) {
+                link(index, static_cast<uint32_t>(row - 1));
+            }
+        }
+    }
+
+    index.built = true;
+    index.sortedStale = index.sortedWanted;
+}
+
+// Bottom-up merge sort of the keyed rows; stable, so equal keys stay in row order
+void LookupIndex::sortRows(const StringInterner& strings, ColumnIndex& index) {
+    MyVector<uint32_t>& sorted = index.sorted;
+    sorted.clear();
+    for (size_t row = 0; row < index.rowCount; row++) {
+        unsigned char state = index.states[row];
+        if (state == ROW_NUMBER || state == ROW_TEXT) {
+            sorted.push_back(static_cast<uint32_t>(row));
+        }
+    }
+
+    size_t count = sorted.getSize();
+    MyVector<uint32_t> scratch;
+    scratch.resize(count);
+    uint32_t* from = sorted.begin();
+    uint32_t* to = scratch.begin();
+    for (size_t width = 1; width < count; width *= 2) {
+        for (size_t first = 0; first < count; first += width * 2) {
+            size_t middle = first + width < count ? first + width : count;
+            size_t last = first + width * 2 < count ? first + width * 2 : count;
+            size_t left = first, right = middle, out = first;
+            while (left < middle && right < last) {
+                to[out++] = compareRows(strings, index, from[right], from[left]) < 0 ? from[right++] : from[left++];
+            }
+            while (left < middle) {
+                to[out++] = from[left++];
+            }
+            while (right < last) {
+                to[out++] = from[right++];
+            }
+        }
+        uint32_t* swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != sorted.begin()) {
+        memcpy(sorted.begin(), from, count * sizeof(uint32_t));
+    }
+    index.sortedStale = false;
+}
+
+bool LookupIndex::findExact(const CellStorage& cells, const ColumnIndex& index, size_t startRow, size_t endRow,
+    const LookupKey& value, bool& found, size_t& row) {
+    found = false;
+    uint64_t key;
+    unsigned char state;
+    if (index.buckets.getSize() == 0 || !makeKey(cells.getStrings(), value, key, state)) {
+        return true;
+    }
+
+    uint32_t current = index.buckets[findBucket(index, key, state)];
+    if (current == NO_ROW || current == TOMBSTONE) {
+        return true;
+    }
+
+    // Rows before the range are skipped; should there be more of them than
+    // the range has rows, scanning the range is cheaper
+    size_t skipped = 0;
+    while (current != NO_ROW && current < startRow) {
+        if (++skipped > endRow - startRow + 1) {
+            return false;
+        }
+        current = index.next[current];
+    }
+    found = current != NO_ROW && current <= endRow;
+    row = current;
+    return true;
+}
+
+bool LookupIndex::findSorted(const CellStorage& cells, const ColumnIndex& index, size_t startRow, size_t endRow,
+    MatchMode mode, const LookupKey& value, bool& found, size_t& row) {
+    const StringInterner& strings = cells.getStrings();
+    const MyVector<uint32_t>& sorted = index.sorted;
+    unsigned char state = value.isText ? ROW_TEXT : ROW_NUMBER;
+    size_t budget = endRow - startRow + 1;
+    size_t steps = 0;
+    found = false;
+
+    if (mode == MatchMode::BELOW) {
+        // Past the last key not above the value, then down to the first row in range
+        size_t low = 0, high = sorted.getSize();
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (compareToKey(strings, index, sorted[middle], value) <= 0) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+
+        // Rows of one key come in descending order here, the last one kept is the first row
+        for (size_t i = low; i > 0; i--) {
+            uint32_t current = sorted[i - 1];
+            if (index.states[current] != state) {
+                break;
+            }
+            if (found && (current < startRow || compareRows(strings, index, current, static_cast<uint32_t>(row)) != 0)) {
+                break;
+            }
+            if (current >= startRow && current <= endRow) {
+                found = true;
+                row = current;
+            }
+            else if (!found && ++steps > budget) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // First key not below the value, then up to the first row in range
+    size_t low = 0, high = sorted.getSize();
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (compareToKey(strings, index, sorted[middle], value) < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    for (size_t i = low; i < sorted.getSize(); i++) {
+        uint32_t current = sorted[i];
+        if (index.states[current] != state) {
+            break;
+        }
+        if (current >= startRow && current <= endRow) {
+            found = true;
+            row = current;
+            break;
+        }
+        if (++steps > budget) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void LookupIndex::noteLookup(size_t col, size_t startRow, size_t endRow, MatchMode mode) {
+    if (endRow - startRow + 1 < MIN_INDEXED_ROWS || mode == MatchMode::NONE) {
+        return;
+    }
+
+    if (columns.getSize() <= col) {
+        columns.resize(col + 1);
+    }
+    if (columns[col] == nullptr) {
+        columns[col] = new ColumnIndex();
+    }
+
+    ColumnIndex& index = *columns[col];
+    if (mode == MatchMode::EXACT && !index.hashWanted) {
+        // Chains are threaded through the rows on a full build
+        index.hashWanted = true;
+        index.built = false;
+        pending = true;
+    }
+    else if (mode != MatchMode::EXACT && !index.sortedWanted) {
+        index.sortedWanted = true;
+        index.sortedStale = true;
+        pending = true;
+    }
+}
+
+void LookupIndex::prepare(const CellStorage& cells, size_t rowCount) {
+    if (!pending) {
+        return;
+    }
+
+    for (size_t col = 0; col < columns.getSize(); col++) {
+        ColumnIndex* index = columns[col];
+        if (index == nullptr || rowCount == 0) {
+            continue;
+        }
+        if (!index->built) {
+            build(cells, *index, col, rowCount);
+        }
+        if (index->sortedWanted && index->sortedStale) {
+            sortRows(cells.getStrings(), *index);
+        }
+    }
+    pending = false;
+}
+
+void LookupIndex::cellChanged(const CellStorage& cells, size_t row, size_t col) {
+    if (col >= columns.getSize() || columns[col] == nullptr || !columns[col]->built || row >= columns[col]->rowCount) {
+        return;
+    }
+
+    ColumnIndex& index = *columns[col];
+    uint32_t position = static_cast<uint32_t>(row);
+    unsigned char state = index.states[row];
+    if (state == ROW_EVALUATED) {
+        index.evaluated--;
+    }
+    else if (state != ROW_NONE && index.hashWanted) {
+        unlink(index, position);
+    }
+
+    readRow(cells, row, col, index.keys[row], index.states[row]);
+    state = index.states[row];
+    if (state == ROW_EVALUATED) {
+        index.evaluated++;
+    }
+    else if (state != ROW_NONE && index.hashWanted) {
+        link(index, position);
+    }
+
+    if (index.sortedWanted) {
+        index.sortedStale = true;
+        pending = true;
+    }
+}
+
+void LookupIndex::invalidate(size_t firstCol) {
+    for (size_t col = firstCol; col < columns.getSize(); col++) {
+        if (columns[col] != nullptr) {
+            columns[col]->built = false;
+            pending = true;
+        }
+    }
+}
+
+void LookupIndex::clear() {
+    for (ColumnIndex* index : columns) {
+        delete index;
+    }
+    columns.clear();
+    pending = false;
+}
+
+bool LookupIndex::find(const CellStorage& cells, size_t col, size_t startRow, size_t endRow, MatchMode mode,
+    const LookupKey& value, bool& found, size_t& row) const {
+    if (col >= columns.getSize() || columns[col] == nullptr || endRow - startRow + 1 < MIN_INDEXED_ROWS) {
+        return false;
+    }
+
+    const ColumnIndex& index = *columns[col];
+    if (!index.built || index.evaluated > 0 || endRow >= index.rowCount) {
+        return false;
+    }
+    if (mode == MatchMode::EXACT) {
+        return index.hashWanted && findExact(cells, index, startRow, endRow, value, found, row);
+    }
+    return index.sortedWanted && !index.sortedStale && findSorted(cells, index, startRow, endRow, mode, value, found, row);
+}
+
+size_t LookupIndex::getIndexedColumnCount() const {
+    size_t count = 0;
+    for (const ColumnIndex* index : columns) {
+        if (index != nullptr && index->built) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int LookupIndex::compareText(const char* left, size_t leftLength, const char* right, size_t rightLength) {
+    int order = memcmp(left, right, leftLength < rightLength ? leftLength : rightLength);
+    if (order != 0) {
+        return order;
+    }
+    return leftLength < rightLength ? -1 : (leftLength > rightLength ? 1 : 0);
+}
+
+size_t LookupIndex::getMemoryBytes() const {
+    size_t bytes = columns.getCapacity() * sizeof(ColumnIndex*);
+    for (const ColumnIndex* index : columns) {
+        if (index != nullptr) {
+            bytes += sizeof(ColumnIndex) +
+                index->keys.getCapacity() * sizeof(uint64_t) +
+                index->states.getCapacity() * sizeof(unsigned char) +
+                index->next.getCapacity() * sizeof(uint32_t) +
+                index->buckets.getCapacity() * sizeof(uint32_t) +
+                index->sorted.getCapacity() * sizeof(uint32_t);
+        }
+    }
+    return bytes;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include "CellStorage.h"
+#include "FormulaProgram.h"
+#include "MyVector.hpp"
+
+// Value a lookup searches for. Numbers and texts never match each other.
+struct LookupKey {
+    bool isText;
+    double number;
+    const char* text;
+    size_t length;
+};
+
+// Per-column search structures for the lookup functions. A column searched
+// for exact keys gets a hash table mapping each key to the chain of rows
+// holding it, in row order; one searched approximately also gets its rows
+// sorted by key. Both are built on first use, before a recalculation, so the
+// evaluation threads only ever read them. Edits update the hash chains in
+// place and mark the sorted rows stale for the next recalculation.
+// Columns holding references or formulas are left to a scan, their values
+// change without an edit of the column.
+class LookupIndex {
+public:
+    static const size_t MIN_INDEXED_ROWS = 64;     // shorter ranges are simply scanned
+
+private:
+    static const uint32_t NO_ROW = 0xFFFFFFFFu;
+    static const uint32_t TOMBSTONE = 0xFFFFFFFEu;
+
+    enum RowState : unsigned char {
+        ROW_NONE,       // empty or an error, never matches
+        ROW_NUMBER,     // keys[row] holds the bits of the number
+        ROW_TEXT,       // keys[row] holds the interned string id
+        ROW_EVALUATED   // reference or formula
+    };
+
+    struct ColumnIndex {
+        bool hashWanted;
+        bool sortedWanted;
+        bool built;
+        bool sortedStale;
+        size_t rowCount;
+        size_t evaluated;               // ROW_EVALUATED rows
+        MyVector<uint64_t> keys;        // by row
+        MyVector<unsigned char> states; // RowState by row
+        MyVector<uint32_t> next;        // next row with the same key
+        MyVector<uint32_t> buckets;     // open addressing, first row of each key's chain
+        size_t usedBuckets;             // chains plus tombstones
+        size_t chainCount;
+        MyVector<uint32_t> sorted;      // keyed rows by key, then row
+
+        ColumnIndex() : hashWanted(false), sortedWanted(false), built(false), sortedStale(false),
+            rowCount(0), evaluated(0), usedBuckets(0), chainCount(0) {}
+    };
+
+    MyVector<ColumnIndex*> columns;    // by logical column, null when never searched
+    bool pending;                       // some wanted structure is missing or stale
+
+    static uint64_t hashKey(uint64_t key, unsigned char state);
+    static void readRow(const CellStorage& cells, size_t row, size_t col, uint64_t& key, unsigned char& state);
+    static bool makeKey(const StringInterner& strings, const LookupKey& value, uint64_t& key, unsigned char& state);
+    // Orders keyed rows: numbers before texts, then by value
+    static int compareRows(const StringInterner& strings, const ColumnIndex& index, uint32_t left, uint32_t right);
+    static int compareToKey(const StringInterner& strings, const ColumnIndex& index, uint32_t row, const LookupKey& value);
+
+    static size_t findBucket(const ColumnIndex& index, uint64_t key, unsigned char state);
+    static void rehash(ColumnIndex& index, size_t bucketCount);
+    static void link(ColumnIndex& index, uint32_t row);
+    static void unlink(ColumnIndex& index, uint32_t row);
+    static void build(const CellStorage& cells, ColumnIndex& index, size_t col, size_t rowCount);
+    static void sortRows(const StringInterner& strings, ColumnIndex& index);
+
+    // Same contract as find
+    static bool findExact(const CellStorage& cells, const ColumnIndex& index, size_t startRow, size_t endRow,
+        const LookupKey& value, bool& found, size_t& row);
+    static bool findSorted(const CellStorage& cells, const ColumnIndex& index, size_t startRow, size_t endRow,
+        MatchMode mode, const LookupKey& value, bool& found, size_t& row);
+
+public:
+    LookupIndex();
+    ~LookupIndex();
+
+    LookupIndex(const LookupIndex&) = delete;
+    LookupIndex& operator=(const LookupIndex&) = delete;
+
+    // Records that a formula searches rows [startRow, endRow] of the column
+    void noteLookup(size_t col, size_t startRow, size_t endRow, MatchMode mode);
+    // Builds what noted lookups need; called before every recalculation
+    void prepare(const CellStorage& cells, size_t rowCount);
+    // Moves the cell's row to the chain of its new key, if its column is indexed
+    void cellChanged(const CellStorage& cells, size_t row, size_t col);
+    // Cells moved or the row count changed: the columns from firstCol on are
+    // built again on the next prepare, for the lookups noted on them so far
+    void invalidate(size_t firstCol);
+    // Drops every index
+    void clear();
+
+    // Searches rows [startRow, endRow] of the column. On true, found tells
+    // whether a row matched and row holds the first one that did. Returns
+    // false when the column has no usable index and has to be scanned.
+    bool find(const CellStorage& cells, size_t col, size_t startRow, size_t endRow, MatchMode mode,
+        const LookupKey& value, bool& found, size_t& row) const;
+
+    size_t getIndexedColumnCount() const;
+    size_t getMemoryBytes() const;
+
+    // Orders texts by their bytes, as the sorted rows are
+    static int compareText(const char* left, size_t leftLength, const char* right, size_t rightLength);
+};
@@ -1,36 +1,83 @@
 #include "MyString.h"
+#include <cstring>
+
+const size_t MyString::SSO_CAPACITY;
 
 void MyString::copyString(const char* source) {
-    if (source == nullptr) {
-        str = new char[1];
-        str[0] = '\0';
-        len = 0;
+    copyString(source, source == nullptr ? 0 : strlen(source));
+}
+
+void MyString::copyString(const char* source, size_t length) {
+    if (length <= SSO_CAPACITY) {
+        str = local;
+        cap = SSO_CAPACITY;
     }
     else {
-        len = strlen(source);
-        str = new char[len + 1];
-        strcpy_s(str, len + 1, source);
+        str = new char[length + 1];
+        cap = length;
+    }
+
+    len = length;
+    if (length > 0) {
+        memcpy(str, source, length);
     }
+    str[length] = '\0';
+}
+
+void MyString::moveFrom(MyString& other) {
+    if (other.isLocal()) {
+        memcpy(local, other.local, other.len + 1);
+        str = local;
+        cap = SSO_CAPACITY;
+    }
+    else {
+        // Steal the heap buffer and leave other as an empty short string
+        str = other.str;
+        cap = other.cap;
+        other.str = other.local;
+        other.cap = SSO_CAPACITY;
+    }
+
+    len = other.len;
+    other.len = 0;
+    other.local[0] = '\0';
 }
 
 void MyString::free() {
-    delete[] str;
-    str = nullptr;
+    if (!isLocal()) {
+        delete[] str;
+    }
+    str = local;
+    cap = SSO_CAPACITY;
     len = 0;
+    local[0] = '\0';
+}
+
+bool MyString::isLocal() const {
+    return str == local;
 }
 
 MyString::MyString() {
-	str = new char[1];
-	str[0] = '\0';
-	len = 0;
+    str = local;
+    len = 0;
+    cap = SSO_CAPACITY;
+    local[0] = '\0';
 }
 
 MyString::MyString(const char* string) {
 	copyString(string);
 }
 
+MyString::MyString(const char* string, size_t length) {
+    copyString(string, length);
+}
+
 MyString::MyString(const MyString& other) {
-    copyString(other.str);
+    copyString(other.str, other.len);
+}
+
+MyString::MyString(MyString&& other) noexcept {
+    moveFrom(other);
 }
 
 MyString::~MyString() {
@@ -42,60 +89,150 @@ size_t MyString::length() const {
     return len;
 }
 
+size_t MyString::capacity() const {
+    return cap;
+}
+
 const char* MyString::data() const {
     return str;
 }
 
+void MyString::reserve(size_t newCapacity) {
+    if (newCapacity <= cap) {
+        return;
+    }
+
+    char* buffer = new char[newCapacity + 1];
+    memcpy(buffer, str, len + 1);
+
+    if (!isLocal()) {
+        delete[] str;
+    }
+    str = buffer;
+    cap = newCapacity;
+}
+
+void MyString::clear() {
+    len = 0;
+    str[0] = '\0';
+}
+
+MyString& MyString::append(const char* string, size_t length) {
+    if (len + length > cap) {
+        // Grow geometrically so repeated appends stay amortized O(1)
+        size_t newCapacity = cap * 2;
+        if (newCapacity < len + length) {
+            newCapacity = len + length;
+        }
+
+        // The old buffer is freed only after copying, since string may point into it
+        char* buffer = new char[newCapacity + 1];
+        memcpy(buffer, str, len);
+        memcpy(buffer + len, string, length);
+        if (!isLocal()) {
+            delete[] str;
+        }
+        str = buffer;
+        cap = newCapacity;
+    }
+    else {
+        memmove(str + len, string, length);
+    }
+    len += length;
+    str[len] = '\0';
+    return *this;
+}
+
+MyString& MyString::append(const char* string) {
+    return append(string, strlen(string));
+}
+
+MyString& MyString::append(const MyString& string) {
+    return append(string.str, string.len);
+}
+
+MyString& MyString::append(char c) {
+    return append(&c, 1);
+}
+
 
 MyString& MyString::operator=(const char* other) {
     if (str != other) {
+        MyString copy(other);
         free();
-        copyString(other);
+        moveFrom(copy);
     }
     return *this;
 }
 
 MyString& MyString::operator=(const MyString& other) {
+    if (this != &other) {
+        if (other.len <= cap) {
+            // Reuse the current buffer
+            memcpy(str, other.str, other.len + 1);
+            len = other.len;
+        }
+        else {
+            free();
+            copyString(other.str, other.len);
+        }
+    }
+    return *this;
+}
+
+MyString& MyString::operator=(MyString&& other) noexcept {
     if (this != &other) {
         free();
-        copyString(other.str);
+        moveFrom(other);
     }
     return *this;
 }
 
+MyString& MyString::operator+=(const MyString& other) {
+    return append(other);
+}
+
+MyString& MyString::operator+=(const char* other) {
+    return append(other);
+}
+
+MyString& MyString::operator+=(char c) {
+    return append(c);
+}
+
 bool MyString::operator<(const MyString & other) const {
     return strcmp(str, other.str) < 0;
 }
 
 bool MyString::operator==(const MyString& other) const {
-    return strcmp(str, other.str) == 0;
+    return len == other.len && memcmp(str, other.str, len) == 0;
 }
 
 bool MyString::operator!=(const MyString& other) const {
-    return strcmp(str, other.str) != 0;
+    return !(*this == other);
 }
 
-MyString MyString::operator+(const MyString& other) const {
+MyString MyString::operator+(const MyString& other) const & {
     MyString result;
-    result.free(); 
-
-    result.len = len + other.len;
-    result.str = new char[result.len + 1];
-
-    strcpy_s(result.str, result.len + 1, str);
-    strcat_s(result.str, result.len + 1, other.str);
-
+    result.reserve(len + other.len);
+    result.append(str, len);
+    result.append(other.str, other.len);
     return result;
 }
 
+MyString MyString::operator+(const MyString& other) && {
+    append(other);
+    return MyString(std::move(*this));
+}
+
 ostream& operator<<(ostream& os, const MyString& string) {
     os << string.str;
     return os;
 }
 
 istream& operator>>(istream& is, MyString& string) {
-    char buffer[1024]; 
+    char buffer[1024];
     is >> buffer;
     string = buffer;
     return is;
-}
\ No newline at end of file
+}
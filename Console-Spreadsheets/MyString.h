@@ -4,32 +4,57 @@
 using namespace std;
 
 class MyString {
+public:
+    // Strings up to this length live inside the object and never touch the heap
+    static const size_t SSO_CAPACITY = 22;
+
 private:
-    char* str;
+    char* str;          // points at local for short strings, at a heap buffer otherwise
     size_t len;
+    size_t cap;         // characters that fit without reallocating, excluding '\0'
+    char local[SSO_CAPACITY + 1];
 
     void copyString(const char* source);
+    void copyString(const char* source, size_t length);
+    void moveFrom(MyString& other);
     void free();
+    bool isLocal() const;
 
 public:
     MyString();
     MyString(const char* string);
+    MyString(const char* string, size_t length);
     MyString(const MyString& string);
+    MyString(MyString&& string) noexcept;
 
     ~MyString();
 
     size_t length() const;
+    size_t capacity() const;
     const char* data() const;
     //char charAt(int index) const;
 
+    void reserve(size_t newCapacity);
+    void clear();
+    MyString& append(const char* string, size_t length);
+    MyString& append(const char* string);
+    MyString& append(const MyString& string);
+    MyString& append(char c);
+
     MyString& operator=(const char* str);
     MyString& operator=(const MyString& string);
+    MyString& operator=(MyString&& string) noexcept;
+    MyString& operator+=(const MyString& string);
+    MyString& operator+=(const char* string);
+    MyString& operator+=(char c);
 
     bool operator<(const MyString& string) const;
     bool operator==(const MyString& string) const;
     bool operator!=(const MyString& string) const;
 
-    MyString operator+(const MyString& string) const;
+    // The rvalue overload extends the left operand in place, so a + b + c allocates at most once per growth
+    MyString operator+(const MyString& string) const &;
+    MyString operator+(const MyString& string) &&;
 
     friend ostream& operator<<(ostream& os, const MyString& string);
     friend istream& operator>>(istream& is, MyString& string);
@@ -2,12 +2,18 @@
 #include <stdexcept>
 #include <iostream>
 #include <utility>
+#include <new>
 
 using namespace std;
 
+// Elements live in raw storage: slots past size are never constructed,
+// and every constructed element is destroyed exactly once
 template <typename T>
 class MyVector {
 public:
+	typedef T* iterator;
+	typedef const T* const_iterator;
+
 	MyVector();
 	MyVector(const MyVector& other);
 	MyVector(MyVector&& other) noexcept;
@@ -17,13 +23,35 @@ public:
 
 	void push_back(const T& element);
 	void push_back(T&& element);
+	template<typename... Args>
+	T& emplace_back(Args&&... args);
 	T pop_back();
 	void insert(const T& element, size_t position);
 	void insert(T&& element, size_t position);
+	// Inserts count copies of elements before position in a single shift
+	void insert(const T* elements, size_t count, size_t position);
+	void erase(size_t position);
+	// Removes the elements in [first, last)
+	void erase(size_t first, size_t last);
+
 	T& operator[](size_t index);
 	const T& operator[](size_t index) const;
+	// No bounds check, for hot loops that already know index < size
+	T& atUnchecked(size_t index);
+	const T& atUnchecked(size_t index) const;
+
+	iterator begin();
+	iterator end();
+	const_iterator begin() const;
+	const_iterator end() const;
+
 	size_t getSize() const;
 	size_t getCapacity() const;
+	bool isEmpty() const;
+	void reserve(size_t newCapacity);
+	// Default-constructs or destroys elements at the back until size == newSize
+	void resize(size_t newSize);
+	void shrink_to_fit();
 	void print() const;
 	void clear();
 private:
@@ -31,29 +59,49 @@ private:
 	size_t size;
 	size_t capacity;
 
+	static T* allocate(size_t count);
+	static void deallocate(T* block);
 	void copyFrom(const MyVector<T>& other);
 	void free();
-	void resize();
+	void reallocate(size_t newCapacity);
+	void grow(size_t required);
+	void openGap(size_t position, size_t count);
 };
 
+template<typename T>
+T* MyVector<T>::allocate(size_t count)
+{
+	if (count == 0)
+	{
+		return nullptr;
+	}
+	return static_cast<T*>(::operator new(count * sizeof(T)));
+}
+
+template<typename T>
+void MyVector<T>::deallocate(T* block)
+{
+	::operator delete(block);
+}
+
 template<typename T>
 void MyVector<T>::copyFrom(const MyVector<T>& other)
 {
-	size = other.size;
-	capacity = other.capacity;
+	size = 0;
+	capacity = other.size;
+	data = allocate(capacity);
 
-	data = new T[capacity];
-	for (size_t i = 0; i < size; i++)
+	for (size_t i = 0; i < other.size; i++)
 	{
-		data[i] = other.data[i];
+		new (data + i) T(other.data[i]);
+		size++;
 	}
 }
 
 template<typename T>
 void MyVector<T>::clear() {
-	// Properly destroy all elements first
 	for (size_t i = 0; i < size; i++) {
-		data[i].~T(); // Explicitly call destructor
+		data[i].~T();
 	}
 	size = 0;
 }
@@ -61,37 +109,59 @@ void MyVector<T>::clear() {
 template<typename T>
 void MyVector<T>::free()
 {
-	if (data != nullptr) {
-		// Clear all elements first
-		for (size_t i = 0; i < size; i++) {
-			data[i].~T(); // Explicitly destroy each element
-		}
-		delete[] data; 
-		data = nullptr;
-	}
-	size = 0;
+	clear();
+	deallocate(data);
+	data = nullptr;
 	capacity = 0;
 }
 
-
 template<typename T>
-void MyVector<T>::resize()
+void MyVector<T>::reallocate(size_t newCapacity)
 {
-	capacity *= 2;
-	T* temp = new T[capacity];
+	T* temp = allocate(newCapacity);
 
 	for (size_t i = 0; i < size; i++)
 	{
-		temp[i] = move(data[i]);
+		new (temp + i) T(move(data[i]));
+		data[i].~T();
 	}
 
-	delete[] data; 
+	deallocate(data);
 	data = temp;
+	capacity = newCapacity;
+}
+
+template<typename T>
+void MyVector<T>::grow(size_t required)
+{
+	if (required <= capacity)
+	{
+		return;
+	}
+
+	size_t newCapacity = capacity < 4 ? 4 : capacity * 2;
+	if (newCapacity < required)
+	{
+		newCapacity = required;
+	}
+	reallocate(newCapacity);
 }
 
+// Makes room for count elements at position; the gap is left unconstructed
 template<typename T>
-MyVector<T>::MyVector() : size(0), capacity(4) {
-	data = new T[capacity];
+void MyVector<T>::openGap(size_t position, size_t count)
+{
+	grow(size + count);
+
+	for (size_t i = size; i > position; i--)
+	{
+		new (data + i - 1 + count) T(move(data[i - 1]));
+		data[i - 1].~T();
+	}
+}
+
+template<typename T>
+MyVector<T>::MyVector() : data(nullptr), size(0), capacity(0) {
 }
 
 template<typename T>
@@ -150,22 +220,40 @@ void MyVector<T>::push_back(const T& element)
 {
 	if (size >= capacity)
 	{
-		resize();
+		// element may live inside this vector, so copy it before reallocating
+		T copy(element);
+		grow(size + 1);
+		new (data + size) T(move(copy));
 	}
-
-	data[size++] = element;
+	else
+	{
+		new (data + size) T(element);
+	}
+	size++;
 }
 
 // Move version of push_back
 template<typename T>
 void MyVector<T>::push_back(T&& element)
+{
+	emplace_back(move(element));
+}
+
+template<typename T>
+template<typename... Args>
+T& MyVector<T>::emplace_back(Args&&... args)
 {
 	if (size >= capacity)
 	{
-		resize();
+		T value(std::forward<Args>(args)...);
+		grow(size + 1);
+		new (data + size) T(move(value));
 	}
-
-	data[size++] = move(element);
+	else
+	{
+		new (data + size) T(std::forward<Args>(args)...);
+	}
+	return data[size++];
 }
 
 template<typename T>
@@ -177,57 +265,89 @@ T MyVector<T>::pop_back()
 	}
 	size--;
 	T result = move(data[size]);
-	data[size].~T(); // Explicitly destroy the moved-from object
+	data[size].~T();
 	return result;
 }
 
 template<typename T>
 void MyVector<T>::insert(const T& element, size_t index)
 {
-	if (index >= size)
+	T copy(element);
+	insert(move(copy), index);
+}
+
+// Move version of insert
+template<typename T>
+void MyVector<T>::insert(T&& element, size_t index)
+{
+	if (index > size)
 	{
-		throw std::out_of_range("Position must be less than size");
+		throw out_of_range("Position must not be greater than size");
 	}
 
-	if (size + 1 >= capacity)
+	T value(move(element));
+	openGap(index, 1);
+	new (data + index) T(move(value));
+	size++;
+}
+
+template<typename T>
+void MyVector<T>::insert(const T* elements, size_t count, size_t index)
+{
+	if (index > size)
+	{
+		throw out_of_range("Position must not be greater than size");
+	}
+	if (count == 0)
 	{
-		resize();
+		return;
 	}
 
-	// Shift elements to the right, starting from the end
-	for (size_t i = size; i > index; i--)
+	// Copy first so elements may point into this vector
+	MyVector<T> copies;
+	copies.reserve(count);
+	for (size_t i = 0; i < count; i++)
 	{
-		data[i] = move(data[i - 1]);
+		copies.push_back(elements[i]);
 	}
 
-	// Insert the new element
-	data[index] = element;
-	size++;
+	openGap(index, count);
+	for (size_t i = 0; i < count; i++)
+	{
+		new (data + index + i) T(move(copies.data[i]));
+	}
+	size += count;
 }
 
-// Move version of insert
 template<typename T>
-void MyVector<T>::insert(T&& element, size_t index)
+void MyVector<T>::erase(size_t index)
 {
-	if (index >= size)
+	erase(index, index + 1);
+}
+
+template<typename T>
+void MyVector<T>::erase(size_t first, size_t last)
+{
+	if (first > last || last > size)
 	{
-		throw out_of_range("Position must be less than size");
+		throw out_of_range("Erase range must lie within size");
 	}
 
-	if (size + 1 >= capacity)
+	size_t count = last - first;
+	if (count == 0)
 	{
-		resize();
+		return;
 	}
 
-	// Shift elements to the right, starting from the end
-	for (size_t i = size; i > index; i--)
+	for (size_t i = first; i + count < size; i++)
 	{
-		data[i] = move(data[i - 1]);
+		data[i] = move(data[i + count]);
 	}
-
-	// Insert the new element using move
-	data[index] = move(element);
-	size++;
+	for (size_t i = size - count; i < size; i++)
+	{
+		data[i].~T();
+	}
+	size -= count;
 }
 
 template<typename T>
@@ -252,6 +372,42 @@ const T& MyVector<T>::operator[](size_t index) const
 	return data[index];
 }
 
+template<typename T>
+T& MyVector<T>::atUnchecked(size_t index)
+{
+	return data[index];
+}
+
+template<typename T>
+const T& MyVector<T>::atUnchecked(size_t index) const
+{
+	return data[index];
+}
+
+template<typename T>
+typename MyVector<T>::iterator MyVector<T>::begin()
+{
+	return data;
+}
+
+template<typename T>
+typename MyVector<T>::iterator MyVector<T>::end()
+{
+	return data + size;
+}
+
+template<typename T>
+typename MyVector<T>::const_iterator MyVector<T>::begin() const
+{
+	return data;
+}
+
+template<typename T>
+typename MyVector<T>::const_iterator MyVector<T>::end() const
+{
+	return data + size;
+}
+
 template<typename T>
 size_t MyVector<T>::getSize() const
 {
@@ -264,6 +420,51 @@ size_t MyVector<T>::getCapacity() const
 	return capacity;
 }
 
+template<typename T>
+bool MyVector<T>::isEmpty() const
+{
+	return size == 0;
+}
+
+template<typename T>
+void MyVector<T>::reserve(size_t newCapacity)
+{
+	if (newCapacity > capacity)
+	{
+		reallocate(newCapacity);
+	}
+}
+
+template<typename T>
+void MyVector<T>::resize(size_t newSize)
+{
+	if (newSize < size)
+	{
+		erase(newSize, size);
+		return;
+	}
+
+	reserve(newSize);
+	while (size < newSize)
+	{
+		new (data + size) T();
+		size++;
+	}
+}
+
+template<typename T>
+void MyVector<T>::shrink_to_fit()
+{
+	if (size == 0)
+	{
+		free();
+	}
+	else if (size < capacity)
+	{
+		reallocate(size);
+	}
+}
+
 template<typename T>
 void MyVector<T>::print() const
 {
@@ -276,4 +477,4 @@ void MyVector<T>::print() const
 		cout << data[i] << " ";
 	}
 	cout << endl;
-}
\ No newline at end of file
+}
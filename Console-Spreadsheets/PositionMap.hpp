@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cstdint>
+#include "MyVector.hpp"
+
+// Open-addressing hash map from a (row, col) position to V
+template<typename V>
+class PositionMap {
+private:
+    enum class SlotState : unsigned char { EMPTY, USED, DELETED };
+
+    struct Slot {
+        uint64_t key;
+        SlotState state;
+        V value;
+
+        Slot() : key(0), state(SlotState::EMPTY), value() {}
+    };
+
+    MyVector<Slot> slots;
+    size_t count;
+    size_t usedSlots;   // live entries plus tombstones
+
+    static uint64_t hashKey(uint64_t key);
+    size_t findSlot(uint64_t key) const;
+    void rehash(size_t slotCount);
+
+public:
+    PositionMap();
+
+    static uint64_t makeKey(size_t row, size_t col);
+    static size_t keyRow(uint64_t key);
+    static size_t keyCol(uint64_t key);
+
+    V* find(size_t row, size_t col);
+    const V* find(size_t row, size_t col) const;
+    // Returns the value at the position, default-constructing it when missing
+    V& get(size_t row, size_t col);
+    void erase(size_t row, size_t col);
+    void clear();
+    size_t getSize() const;
+
+    // Visits every entry as visit(row, col, value)
+    template<typename Visitor>
+    void forEach(Visitor visit) const;
+};
+
+template<typename V>
+PositionMap<V>::PositionMap() : count(0), usedSlots(0) {
+}
+
+template<typename V>
+uint64_t PositionMap<V>::makeKey(size_t row, size_t col) {
+    return (static_cast<uint64_t>(row) << 32) | static_cast<uint32_t>(col);
+}
+
+template<typename V>
+size_t PositionMap<V>::keyRow(uint64_t key) {
+    return static_cast<size_t>(key >> 32);
+}
+
+template<typename V>
+size_t PositionMap<V>::keyCol(uint64_t key) {
+    return static_cast<size_t>(key & 0xFFFFFFFFu);
+}
+
+template<typename V>
+uint64_t PositionMap<V>::hashKey(uint64_t key) {
+    // splitmix64 finalizer, spreads neighbouring cells over the table
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+    return key;
+}
+
+// Returns the slot holding key, or the slot where it would be inserted
+template<typename V>
+size_t PositionMap<V>::findSlot(uint64_t key) const {
+    size_t mask = slots.getSize() - 1;
+    size_t index = static_cast<size_t>(hashKey(key)) & mask;
+    size_t firstFree = slots.getSize();
+
+    while (true) {
+        const Slot& slot = slots.atUnchecked(index);
+        if (slot.state == SlotState::EMPTY) {
+            return firstFree < slots.getSize() ? firstFree : index;
+        }
+        if (slot.state == SlotState::DELETED) {
+            if (firstFree == slots.getSize()) {
+                firstFree = index;
+            }
+        }
+        else if (slot.key == key) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+template<typename V>
+void PositionMap<V>::rehash(size_t slotCount) {
+    MyVector<Slot> old(move(slots));
+    slots = MyVector<Slot>();
+    slots.resize(slotCount);
+
+    size_t mask = slotCount - 1;
+    for (Slot& slot : old) {
+        if (slot.state != SlotState::USED) {
+            continue;
+        }
+
+        size_t index = static_cast<size_t>(hashKey(slot.key)) & mask;
+        while (slots.atUnchecked(index).state != SlotState::EMPTY) {
+            index = (index + 1) & mask;
+        }
+        Slot& target = slots.atUnchecked(index);
+        target.key = slot.key;
+        target.state = SlotState::USED;
+        target.value = move(slot.value);
+    }
+    usedSlots = count;
+}
+
+template<typename V>
+V* PositionMap<V>::find(size_t row, size_t col) {
+    if (count == 0) {
+        return nullptr;
+    }
+
+    Slot& slot = slots.atUnchecked(findSlot(makeKey(row, col)));
+    return slot.state == SlotState::USED ? &slot.value : nullptr;
+}
+
+template<typename V>
+const V* PositionMap<V>::find(size_t row, size_t col) const {
+    if (count == 0) {
+        return nullptr;
+    }
+
+    const Slot& slot = slots.atUnchecked(findSlot(makeKey(row, col)));
+    return slot.state == SlotState::USED ? &slot.value : nullptr;
+}
+
+template<typename V>
+V& PositionMap<V>::get(size_t row, size_t col) {
+    // Keep at most half of the slots used so probe chains stay short
+    if ((usedSlots + 1) * 2 > slots.getSize()) {
+        size_t slotCount = slots.getSize() < 16 ? 16 : slots.getSize();
+        while ((count + 1) * 4 > slotCount) {
+            slotCount *= 2;
+        }
+        rehash(slotCount);
+    }
+
+    uint64_t key = makeKey(row, col);
+    Slot& slot = slots.atUnchecked(findSlot(key));
+    if (slot.state != SlotState::USED) {
+        if (slot.state == SlotState::EMPTY) {
+            usedSlots++;
+        }
+        slot.key = key;
+        slot.state = SlotState::USED;
+        count++;
+    }
+    return slot.value;
+}
+
+template<typename V>
+void PositionMap<V>::erase(size_t row, size_t col) {
+    if (count == 0) {
+        return;
+    }
+
+    Slot& slot = slots.atUnchecked(findSlot(makeKey(row, col)));
+    if (slot.state == SlotState::USED) {
+        slot.state = SlotState::DELETED;
+        slot.value = V();
+        count--;
+    }
+}
+
+template<typename V>
+void PositionMap<V>::clear() {
+    slots.clear();
+    count = 0;
+    usedSlots = 0;
+}
+
+template<typename V>
+size_t PositionMap<V>::getSize() const {
+    return count;
+}
+
+template<typename V>
+template<typename Visitor>
+void PositionMap<V>::forEach(Visitor visit) const {
+    for (const Slot& slot : slots) {
+        if (slot.state == SlotState::USED) {
+            visit(keyRow(slot.key), keyCol(slot.key), slot.value);
+        }
+    }
+}
@@ -0,0 +1,275 @@
+#include "RangeAggregateIndex.h"
+
+const size_t RangeAggregateIndex::BLOCK_ROWS;
+const size_t RangeAggregateIndex::MIN_INDEXED_ROWS;
+const size_t RangeAggregateIndex::HOT_COLUMN_USES;
+
+RangeAggregateIndex::RangeAggregateIndex() {
+}
+
+RangeAggregateIndex::~RangeAggregateIndex() {
+    clear();
+}
+
+void RangeAggregateIndex::summarizeRows(const CellStorage& cells, size_t col, size_t startRow, size_t endRow, ColumnSummary& summary) {
+    const StringInterner& strings = cells.getStrings();
+
+    cells.forEachStrip(startRow, col, endRow, col,
+        [&](size_t /*firstRow*/, size_t /*stripCol*/, const CellPayload* payload, const CellKind* kinds,
+            uint64_t validMask, uint64_t numericMask, size_t count) {
+            AggregateKernels::foldLanes(payload, numericMask, count, summary.numbers);
+
+            uint64_t others = validMask & ~numericMask;
+            for (size_t i = 0; i < count && (others >> i) != 0; i++) {
+                if (((others >> i) & 1) == 0) {
+                    continue;
+                }
+                if (kinds[i] == CellKind::ERROR_VALUE) {
+                    summary.errors++;
+                }
+                else if (kinds[i] != CellKind::STRING) {
+                    summary.evaluated++;
+                }
+                else if (strings.getLength(static_cast<uint32_t>(payload[i].handle)) > 0) {
+                    summary.texts++;
+                }
+            }
+        });
+}
+
+void RangeAggregateIndex::build(const CellStorage& cells, size_t col, size_t rowCount) {
+    size_t leafCount = (rowCount + BLOCK_ROWS - 1) / BLOCK_ROWS;
+    size_t leafBase = 1;
+    while (leafBase < leafCount) {
+        leafBase *= 2;
+    }
+
+    ColumnTree* tree = new ColumnTree();
+    tree->leafBase = leafBase;
+    tree->rowCount = rowCount;
+    tree->nodes.resize(leafBase * 2);
+
+    for (size_t leaf = 0; leaf < leafCount; leaf++) {
+        size_t first = leaf * BLOCK_ROWS;
+        size_t last = first + BLOCK_ROWS - 1 < rowCount ? first + BLOCK_ROWS - 1 : rowCount - 1;
+        summarizeRows(cells, col, first, last, tree->nodes[leafBase + leaf]);
+    }
+    for (size_t node = leafBase - 1; node > 0; node--) {
+        tree->nodes[node] = tree->nodes[node * 2];
+        tree->nodes[node].merge(tree->nodes[node * 2 + 1]);
+    }
+
+    if (trees.getSize() <= col) {
+        trees.resize(col + 1);
+    }
+    trees[col] = tree;
+}
+
+bool RangeAggregateIndex::isLong(const Precedent& range) {
+    return range.endRow - range.startRow + 1 >= MIN_INDEXED_ROWS;
+}
+
+bool RangeAggregateIndex::readBefore(const MyVector<Precedent>& ranges, size_t index, size_t col) {
+    for (size_t i = 0; i < index; i++) {
+        const Precedent& range = ranges.atUnchecked(i);
+        if (isLong(range) && col >= range.startCol && col <= range.endCol) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void RangeAggregateIndex::noteReader(const CellStorage& cells, size_t rowCount, const MyVector<Precedent>& ranges) {
+    if (rowCount == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < ranges.getSize(); i++) {
+        const Precedent& range = ranges.atUnchecked(i);
+        if (!isLong(range)) {
+            continue;
+        }
+        if (rangeUses.getSize() <= range.endCol) {
+            rangeUses.resize(range.endCol + 1);
+        }
+        for (size_t col = range.startCol; col <= range.endCol; col++) {
+            if (readBefore(ranges, i, col)) {
+                continue;
+            }
+            if (++rangeUses[col] == HOT_COLUMN_USES && (col >= trees.getSize() || trees[col] == nullptr)) {
+                build(cells, col, rowCount);
+            }
+        }
+    }
+}
+
+void RangeAggregateIndex::dropReader(const MyVector<Precedent>& ranges) {
+    for (size_t i = 0; i < ranges.getSize(); i++) {
+        const Precedent& range = ranges.atUnchecked(i);
+        if (!isLong(range)) {
+            continue;
+        }
+        for (size_t col = range.startCol; col <= range.endCol && col < rangeUses.getSize(); col++) {
+            if (readBefore(ranges, i, col) || rangeUses[col] == 0 || --rangeUses[col] > 0) {
+                continue;
+            }
+            if (col < trees.getSize()) {
+                delete trees[col];
+                trees[col] = nullptr;
+            }
+        }
+    }
+}
+
+void RangeAggregateIndex::cellChanged(const CellStorage& cells, size_t row, size_t col) {
+    if (col >= trees.getSize() || trees[col] == nullptr || row >= trees[col]->rowCount) {
+        return;
+    }
+
+    ColumnTree* tree = trees[col];
+    size_t leaf = row / BLOCK_ROWS;
+    size_t first = leaf * BLOCK_ROWS;
+    size_t last = first + BLOCK_ROWS - 1 < tree->rowCount ? first + BLOCK_ROWS - 1 : tree->rowCount - 1;
+
+    size_t node = tree->leafBase + leaf;
+    tree->nodes[node] = ColumnSummary();
+    summarizeRows(cells, col, first, last, tree->nodes[node]);
+    for (node /= 2; node > 0; node /= 2) {
+        tree->nodes[node] = tree->nodes[node * 2];
+        tree->nodes[node].merge(tree->nodes[node * 2 + 1]);
+    }
+}
+
+void RangeAggregateIndex::settle(const CellStorage& cells, size_t col, size_t rowCount) {
+    size_t uses = col < rangeUses.getSize() ? rangeUses[col] : 0;
+    bool indexed = col < trees.getSize() && trees[col] != nullptr;
+    if (uses == 0 && indexed) {
+        delete trees[col];
+        trees[col] = nullptr;
+    }
+    else if (uses >= HOT_COLUMN_USES && !indexed && rowCount > 0) {
+        build(cells, col, rowCount);
+    }
+}
+
+void RangeAggregateIndex::rowsChanged(const CellStorage& cells, size_t rowCount, size_t firstRow) {
+    size_t leafCount = (rowCount + BLOCK_ROWS - 1) / BLOCK_ROWS;
+    for (size_t col = 0; col < trees.getSize(); col++) {
+        ColumnTree* tree = trees[col];
+        if (tree == nullptr) {
+            continue;
+        }
+        if (leafCount == 0 || leafCount > tree->leafBase) {
+            // The tree has no room for the rows, so it is built anew
+            delete tree;
+            trees[col] = nullptr;
+            settle(cells, col, rowCount);
+            continue;
+        }
+
+        tree->rowCount = rowCount;
+        for (size_t leaf = firstRow / BLOCK_ROWS; leaf < tree->leafBase; leaf++) {
+            ColumnSummary& summary = tree->nodes[tree->leafBase + leaf];
+            summary = ColumnSummary();
+            if (leaf < leafCount) {
+                size_t first = leaf * BLOCK_ROWS;
+                size_t last = first + BLOCK_ROWS - 1 < rowCount ? first + BLOCK_ROWS - 1 : rowCount - 1;
+                summarizeRows(cells, col, first, last, summary);
+            }
+        }
+        for (size_t node = tree->leafBase - 1; node > 0; node--) {
+            tree->nodes[node] = tree->nodes[node * 2];
+            tree->nodes[node].merge(tree->nodes[node * 2 + 1]);
+        }
+    }
+}
+
+void RangeAggregateIndex::columnsMoved(const CellStorage& cells, size_t rowCount, size_t index, bool inserted) {
+    if (index < trees.getSize()) {
+        if (inserted) {
+            trees.insert(nullptr, index);
+        }
+        else {
+            delete trees[index];
+            trees.erase(index);
+        }
+    }
+
+    // A column past index holds what its neighbour held, read by its own formulas
+    size_t end = trees.getSize() > rangeUses.getSize() ? trees.getSize() : rangeUses.getSize();
+    for (size_t col = index; col < end; col++) {
+        settle(cells, col, rowCount);
+    }
+}
+
+void RangeAggregateIndex::clear() {
+    for (ColumnTree* tree : trees) {
+        delete tree;
+    }
+    trees.clear();
+    rangeUses.clear();
+}
+
+bool RangeAggregateIndex::coversAny(size_t startCol, size_t endCol) const {
+    for (size_t col = startCol; col <= endCol && col < trees.getSize(); col++) {
+        if (trees[col] != nullptr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RangeAggregateIndex::query(const CellStorage& cells, size_t col, size_t startRow, size_t endRow, ColumnSummary& summary) const {
+    if (col >= trees.getSize() || trees[col] == nullptr || endRow - startRow + 1 < MIN_INDEXED_ROWS) {
+        return false;
+    }
+
+    const ColumnTree* tree = trees[col];
+    if (endRow >= tree->rowCount) {
+        return false;
+    }
+
+    // Whole blocks come from the tree, the ragged ends are scanned
+    size_t firstLeaf = (startRow + BLOCK_ROWS - 1) / BLOCK_ROWS;
+    size_t endLeaf = (endRow + 1) / BLOCK_ROWS;
+    if (firstLeaf >= endLeaf) {
+        summarizeRows(cells, col, startRow, endRow, summary);
+        return true;
+    }
+
+    if (startRow < firstLeaf * BLOCK_ROWS) {
+        summarizeRows(cells, col, startRow, firstLeaf * BLOCK_ROWS - 1, summary);
+    }
+    for (size_t left = tree->leafBase + firstLeaf, right = tree->leafBase + endLeaf; left < right; left /= 2, right /= 2) {
+        if (left & 1) {
+            summary.merge(tree->nodes[left++]);
+        }
+        if (right & 1) {
+            summary.merge(tree->nodes[--right]);
+        }
+    }
+    if (endLeaf * BLOCK_ROWS <= endRow) {
+        summarizeRows(cells, col, endLeaf * BLOCK_ROWS, endRow, summary);
+    }
+    return true;
+}
+
+size_t RangeAggregateIndex::getIndexedColumnCount() const {
+    size_t count = 0;
+    for (const ColumnTree* tree : trees) {
+        if (tree != nullptr) {
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t RangeAggregateIndex::getMemoryBytes() const {
+    size_t bytes = trees.getCapacity() * sizeof(ColumnTree*) + rangeUses.getCapacity() * sizeof(size_t);
+    for (const ColumnTree* tree : trees) {
+        if (tree != nullptr) {
+            bytes += sizeof(ColumnTree) + tree->nodes.getCapacity() * sizeof(ColumnSummary);
+        }
+    }
+    return bytes;
+}
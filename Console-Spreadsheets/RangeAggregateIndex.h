@@ -0,0 +1,85 @@
+#pragma once
+
+#include "AggregateKernels.h"
+#include "CellStorage.h"
+#include "DependencyGraph.h"
+#include "MyVector.hpp"
+
+// What a block of rows in one column holds, as far as range formulas care
+struct ColumnSummary {
+    NumberAggregate numbers;    // INT, BOOL and DOUBLE cells
+    size_t texts;               // non-empty strings
+    size_t evaluated;           // references and formulas, whose values live elsewhere
+    size_t errors;              // ERROR_VALUE cells
+
+    ColumnSummary() : texts(0), evaluated(0), errors(0) {}
+
+    void merge(const ColumnSummary& other) {
+        numbers.merge(other.numbers);
+        texts += other.texts;
+        evaluated += other.evaluated;
+        errors += other.errors;
+    }
+};
+
+// Optional per-column segment trees answering range folds in O(log n).
+// Leaves summarize BLOCK_ROWS rows, the strip height of a tile, so a tree
+// costs little memory and partial blocks at the ends of a range are scanned.
+// A column gets a tree once HOT_COLUMN_USES formulas read it through long
+// ranges, and loses it when the last of them is gone.
+class RangeAggregateIndex {
+public:
+    static const size_t BLOCK_ROWS = 64;
+    static const size_t MIN_INDEXED_ROWS = 256;    // shorter ranges are simply scanned
+    static const size_t HOT_COLUMN_USES = 4;
+
+private:
+    struct ColumnTree {
+        MyVector<ColumnSummary> nodes;  // nodes[1] is the root, leaves start at leafBase
+        size_t leafBase;
+        size_t rowCount;
+    };
+
+    MyVector<ColumnTree*> trees;    // by logical column, null when not indexed
+    MyVector<size_t> rangeUses;     // by logical column, formulas reading it through a long range
+
+    static void summarizeRows(const CellStorage& cells, size_t col, size_t startRow, size_t endRow, ColumnSummary& summary);
+    static bool isLong(const Precedent& range);
+    // Whether an earlier long range of the same formula already reads the column
+    static bool readBefore(const MyVector<Precedent>& ranges, size_t index, size_t col);
+    void build(const CellStorage& cells, size_t col, size_t rowCount);
+    // Gives the column a tree when it is hot and takes it when nothing reads it
+    void settle(const CellStorage& cells, size_t col, size_t rowCount);
+
+public:
+    RangeAggregateIndex();
+    ~RangeAggregateIndex();
+
+    RangeAggregateIndex(const RangeAggregateIndex&) = delete;
+    RangeAggregateIndex& operator=(const RangeAggregateIndex&) = delete;
+
+    // Counts a formula once for every column its long ranges read, and
+    // indexes the columns that became hot
+    void noteReader(const CellStorage& cells, size_t rowCount, const MyVector<Precedent>& ranges);
+    // Takes back what noteReader counted for the same ranges; a column no
+    // formula reads any more loses its tree
+    void dropReader(const MyVector<Precedent>& ranges);
+    // Refreshes the leaf holding the cell, if its column is indexed
+    void cellChanged(const CellStorage& cells, size_t row, size_t col);
+    // Rows from firstRow on moved, came or went: the trees summarize them
+    // again, over rowCount rows
+    void rowsChanged(const CellStorage& cells, size_t rowCount, size_t firstRow);
+    // A column was inserted or removed at index. The trees move with their
+    // columns while the use counts stay with the addresses formulas read.
+    void columnsMoved(const CellStorage& cells, size_t rowCount, size_t index, bool inserted);
+    // Drops every tree and use count
+    void clear();
+
+    bool coversAny(size_t startCol, size_t endCol) const;
+    // Summarizes rows [startRow, endRow] of an indexed column. Returns false
+    // for columns without a tree and ranges too short to gain from one.
+    bool query(const CellStorage& cells, size_t col, size_t startRow, size_t endRow, ColumnSummary& summary) const;
+
+    size_t getIndexedColumnCount() const;
+    size_t getMemoryBytes() const;
+};
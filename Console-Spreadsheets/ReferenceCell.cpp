@@ -35,38 +35,38 @@ void ReferenceCell::setTablePtr(Table* table) {
     tablePtr = table;
 }
 
-BaseCell* ReferenceCell::getReferencedCell() const {
+bool ReferenceCell::hasReferencedCell() const {
     if (tablePtr == nullptr) {
-        return nullptr;
+        return false;
     }
 
-    return tablePtr->getCell(targetRow, targetCol);
+    return tablePtr->getCellKind(targetRow, targetCol) != CellKind::EMPTY;
 }
 
 MyString ReferenceCell::toString() const {
-    BaseCell* referencedCell = getReferencedCell();
-
-    if (referencedCell == nullptr) {
+    if (!hasReferencedCell()) {
         return MyString("#REF!"); 
     }
 
-    return referencedCell->toString();
+    return tablePtr->getCellText(targetRow, targetCol);
 }
 
 double ReferenceCell::evaluate() const {
-    BaseCell* referencedCell = getReferencedCell();
-
-    if (referencedCell == nullptr) {
+    if (!hasReferencedCell()) {
         return 0.0; 
     }
 
-    return referencedCell->evaluate();
+    return tablePtr->getCellNumber(targetRow, targetCol);
 }
 
 MyString ReferenceCell::getType() const {
     return MyString("ReferenceCell");
 }
 
+CellKind ReferenceCell::getKind() const {
+    return CellKind::REFERENCE;
+}
+
 BaseCell* ReferenceCell::clone() const {
     return new ReferenceCell(*this);
 }
\ No newline at end of file
@@ -27,8 +27,9 @@ public:
     MyString toString() const override;
     double evaluate() const override;
     MyString getType() const override;
+    CellKind getKind() const override;
     BaseCell* clone() const override;
 
 private:
-    BaseCell* getReferencedCell() const;
+    bool hasReferencedCell() const;
 };
@@ -0,0 +1,168 @@
+#include "StringInterner.h"
+#include <cstring>
+
+const uint32_t StringInterner::NO_ID;
+const uint32_t StringInterner::TOMBSTONE;
+
+StringInterner::StringInterner(CellPool& pool) : pool(pool), liveCount(0), usedBuckets(0) {
+}
+
+uint32_t StringInterner::hashText(const char* text, size_t length) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<unsigned char>(text[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Returns the bucket holding the text, or the first free bucket on its probe path
+size_t StringInterner::findBucket(const char* text, size_t length, uint32_t hash) const {
+    size_t mask = buckets.getSize() - 1;
+    size_t index = hash & mask;
+    size_t firstFree = buckets.getSize();
+
+    while (true) {
+        uint32_t id = buckets.atUnchecked(index);
+        if (id == NO_ID) {
+            return firstFree < buckets.getSize() ? firstFree : index;
+        }
+        if (id == TOMBSTONE) {
+            if (firstFree == buckets.getSize()) {
+                firstFree = index;
+            }
+        }
+        else {
+            const Entry& entry = entries.atUnchecked(id);
+            if (entry.hash == hash && entry.length == length && memcmp(entry.text, text, length) == 0) {
+                return index;
+            }
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+void StringInterner::rehash(size_t bucketCount) {
+    buckets.clear();
+    buckets.resize(bucketCount);
+    for (size_t i = 0; i < bucketCount; i++) {
+        buckets.atUnchecked(i) = NO_ID;
+    }
+
+    size_t mask = bucketCount - 1;
+    for (size_t id = 0; id < entries.getSize(); id++) {
+        const Entry& entry = entries.atUnchecked(id);
+        if (entry.refs == 0) {
+            continue;
+        }
+
+        size_t index = entry.hash & mask;
+        while (buckets.atUnchecked(index) != NO_ID) {
+            index = (index + 1) & mask;
+        }
+        buckets.atUnchecked(index) = static_cast<uint32_t>(id);
+    }
+    usedBuckets = liveCount;
+}
+
+uint32_t StringInterner::intern(const char* text, size_t length) {
+    // Keep at most half of the buckets used so probe chains stay short
+    if ((usedBuckets + 1) * 2 > buckets.getSize()) {
+        size_t bucketCount = buckets.getSize() < 16 ? 16 : buckets.getSize();
+        while ((liveCount + 1) * 2 > bucketCount / 2) {
+            bucketCount *= 2;
+        }
+        rehash(bucketCount);
+    }
+
+    uint32_t hash = hashText(text, length);
+    size_t index = findBucket(text, length, hash);
+    uint32_t found = buckets[index];
+    if (found != NO_ID && found != TOMBSTONE) {
+        entries[found].refs++;
+        return found;
+    }
+
+    Entry entry;
+    entry.text = static_cast<char*>(pool.allocate(length + 1, PoolClass::STRING));
+    memcpy(entry.text, text, length);
+    entry.text[length] = '\0';
+    entry.length = length;
+    entry.hash = hash;
+    entry.refs = 1;
+
+    uint32_t id;
+    if (freeIds.getSize() > 0) {
+        id = freeIds.pop_back();
+        entries[id] = entry;
+    }
+    else {
+        id = static_cast<uint32_t>(entries.getSize());
+        entries.push_back(entry);
+    }
+
+    if (found == NO_ID) {
+        usedBuckets++;
+    }
+    buckets[index] = id;
+    liveCount++;
+    return id;
+}
+
+void StringInterner::release(uint32_t id) {
+    Entry& entry = entries[id];
+    if (--entry.refs > 0) {
+        return;
+    }
+
+    size_t index = findBucket(entry.text, entry.length, entry.hash);
+    buckets[index] = TOMBSTONE;
+
+    pool.release(entry.text, entry.length + 1, PoolClass::STRING);
+    entry.text = nullptr;
+    entry.length = 0;
+    freeIds.push_back(id);
+    liveCount--;
+}
+
+void StringInterner::retain(uint32_t id) {
+    entries[id].refs++;
+}
+
+bool StringInterner::find(const char* text, size_t length, uint32_t& id) const {
+    if (buckets.getSize() == 0) {
+        return false;
+    }
+
+    uint32_t found = buckets[findBucket(text, length, hashText(text, length))];
+    if (found == NO_ID || found == TOMBSTONE) {
+        return false;
+    }
+    id = found;
+    return true;
+}
+
+const char* StringInterner::getText(uint32_t id) const {
+    return entries[id].text;
+}
+
+size_t StringInterner::getLength(uint32_t id) const {
+    return entries[id].length;
+}
+
+size_t StringInterner::getCount() const {
+    return liveCount;
+}
+
+size_t StringInterner::getIdBound() const {
+    return entries.getSize();
+}
+
+void StringInterner::clear() {
+    entries.clear();
+    freeIds.clear();
+    buckets.clear();
+    liveCount = 0;
+    usedBuckets = 0;
+}
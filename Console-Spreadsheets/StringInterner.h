@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include "MyVector.hpp"
+#include "CellPool.h"
+
+// Deduplicated, reference-counted text for string cells. Equal strings share
+// one id, so cells compare by id and each distinct text is stored once.
+class StringInterner {
+private:
+    static const uint32_t NO_ID = 0xFFFFFFFFu;
+    static const uint32_t TOMBSTONE = 0xFFFFFFFEu;
+
+    struct Entry {
+        char* text;
+        size_t length;
+        uint32_t hash;
+        size_t refs;      // 0 marks a free entry
+    };
+
+    CellPool& pool;
+    MyVector<Entry> entries;
+    MyVector<uint32_t> freeIds;
+    MyVector<uint32_t> buckets;  // open addressing, NO_ID for empty slots
+    size_t liveCount;
+    size_t usedBuckets;          // live entries plus tombstones
+
+    static uint32_t hashText(const char* text, size_t length);
+    size_t findBucket(const char* text, size_t length, uint32_t hash) const;
+    void rehash(size_t bucketCount);
+
+public:
+    explicit StringInterner(CellPool& pool);
+    StringInterner(const StringInterner& other) = delete;
+    StringInterner& operator=(const StringInterner& other) = delete;
+
+    // Returns the id of the text and takes one reference on it
+    uint32_t intern(const char* text, size_t length);
+    void release(uint32_t id);
+    // Takes one more reference on an id some cell already holds
+    void retain(uint32_t id);
+    // Id of the text if some cell holds it; takes no reference
+    bool find(const char* text, size_t length, uint32_t& id) const;
+
+    const char* getText(uint32_t id) const;
+    size_t getLength(uint32_t id) const;
+    size_t getCount() const;
+    // Every id handed out so far is below this bound
+    size_t getIdBound() const;
+
+    // Forgets every entry; the bytes belong to the pool and go with its reset
+    void clear();
+};
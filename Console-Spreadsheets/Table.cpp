@@ -1,51 +1,335 @@
 #include "Table.h"
+#include "FormulaCell.h"
+#include "AggregateKernels.h"
+#include "BufferedIO.h"
+#include "CsvScanner.h"
 #include <iostream>
 #include <string>
+#include <cstring>
 
 const int defRows = 3;
 const int defCols = 3;
 
-extern int stringToInt(const char* str);
-extern bool stringContains(const char* haystack, const char* needle);
+// Levels smaller than this are not worth waking the workers for
+const size_t parallelLevelSize = 256;
+// Consecutive nodes per stolen chunk
+const size_t recalculationGrain = 64;
+// Files smaller than this are streamed on the calling thread
+const size_t parallelLoadBytes = 4 << 20;
+// Bytes of cell records per parsing task, and tasks per thread merged at a time
+const size_t loadChunkBytes = 1 << 20;
+const size_t loadChunksPerThread = 4;
+
+namespace {
+    enum class FileRecord { NONE, ROWS, COLS, AUTOFIT, SYMBOLS, CELL, CELL_ERROR };
+
+    // Header records of a table file, defaults for the missing ones
+    struct FileHeader {
+        size_t rows = 5;
+        size_t cols = 5;
+        bool autoFit = true;
+        int symbols = 10;
+    };
+
+    bool hasPrefix(const char* line, size_t length, const char* prefix) {
+        size_t prefixLength = strlen(prefix);
+        return length >= prefixLength && memcmp(line, prefix, prefixLength) == 0;
+    }
 
-Table::Table() : numRows(defRows), numCols(defCols), autoFit(true), visibleCellSymbols(7) {
-    for (size_t i = 0; i < numRows; i++) {
-        MyVector<unique_ptr<BaseCell>> row;
-        for (size_t j = 0; j < numCols; j++) {
-            unique_ptr<BaseCell> emptyCell = nullptr;
-            row.push_back(move(emptyCell));
+    // Dispatches on the first byte, then checks the one tag it can start
+    FileRecord classifyRecord(const char* line, size_t length) {
+        if (length == 0) {
+            return FileRecord::NONE;
+        }
+        switch (line[0]) {
+        case 'R':
+            return hasPrefix(line, length, "ROWS:") ? FileRecord::ROWS : FileRecord::NONE;
+        case 'C':
+            if (hasPrefix(line, length, "CELL:")) {
+                return FileRecord::CELL;
+            }
+            return hasPrefix(line, length, "COLS:") ? FileRecord::COLS : FileRecord::NONE;
+        case 'A':
+            return hasPrefix(line, length, "AUTOFIT:") ? FileRecord::AUTOFIT : FileRecord::NONE;
+        case 'S':
+            return hasPrefix(line, length, "SYMBOLS:") ? FileRecord::SYMBOLS : FileRecord::NONE;
+        case 'E':
+            return hasPrefix(line, length, "ERROR:") ? FileRecord::CELL_ERROR : FileRecord::NONE;
+        default:
+            return FileRecord::NONE;
         }
-        cells.push_back(move(row));
     }
-}
 
-Table::Table(size_t rows, size_t cols) : numRows(rows), numCols(cols), autoFit(true), visibleCellSymbols(7) {
-    for (size_t i = 0; i < numRows; i++) {
-        MyVector<unique_ptr<BaseCell>> row;
-        for (size_t j = 0; j < numCols; j++) {
-            unique_ptr<BaseCell> emptyCell = nullptr;
-            row.push_back(move(emptyCell));
+    void readHeader(FileRecord record, const char* line, size_t length, FileHeader& header) {
+        const char* end = line + length;
+        const char* cursor;
+        size_t value;
+        switch (record) {
+        case FileRecord::ROWS:
+            cursor = line + 5;
+            LineReader::parseUnsigned(cursor, end, header.rows);
+            break;
+        case FileRecord::COLS:
+            cursor = line + 5;
+            LineReader::parseUnsigned(cursor, end, header.cols);
+            break;
+        case FileRecord::AUTOFIT:
+            header.autoFit = hasPrefix(line + 8, length - 8, "true");
+            break;
+        case FileRecord::SYMBOLS:
+            cursor = line + 8;
+            LineReader::parseUnsigned(cursor, end, value);
+            header.symbols = static_cast<int>(value);
+            break;
+        default:
+            break;
         }
-        cells.push_back(move(row));
     }
-}
 
-Table::Table(size_t rows, size_t cols, bool autoFit, int visibleCellSymbols)
-    : numRows(rows), numCols(cols), autoFit(autoFit), visibleCellSymbols(visibleCellSymbols) {
-    for (size_t i = 0; i < numRows; i++) {
-        MyVector<unique_ptr<BaseCell>> row;
-        for (size_t j = 0; j < numCols; j++) {
-            unique_ptr<BaseCell> emptyCell = nullptr;
-            row.push_back(move(emptyCell));
+    // Binary snapshots start with this, so open tells them from text files
+    const char snapshotMagic[8] = { 'C', 'S', 'S', 'N', 'A', 'P', '\0', '\x1a' };
+    // Bump when the header, the block layout, CellKind, CellError or the formula bytecode changes
+    const uint32_t snapshotVersion = 2;
+    const uint32_t snapshotByteOrder = 0x01020304;
+    const size_t blockCells = CellStorage::TILE_SIZE * CellStorage::TILE_SIZE;
+
+    // Start of a snapshot. It is followed, each part 8-byte aligned, by the
+    // string heap (textCount + 1 offsets, then the bytes), the blocks and the
+    // formulas. A block is its first row and column, its valid bitmaps and the
+    // payload and kind strips of its occupied columns, as CellStorage keeps
+    // them in a tile, with strings as heap indexes and formulas left out. A
+    // formula is its row and column, its compiled program and its source.
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;     // snapshotByteOrder in the writer's byte order
+        uint32_t tileSize;
+        uint32_t payloadSize;
+        uint64_t rows, cols;
+        int32_t autoFit;
+        int32_t symbols;
+        uint64_t textCount;
+        uint64_t textBytes;
+        uint64_t blockCount;
+        uint64_t formulaCount;
+    };
+
+    // Calls visit(slot) for every valid slot of a block
+    template<typename Visitor>
+    void forEachSlot(const uint64_t* valid, Visitor visit) {
+        for (size_t c = 0; c < CellStorage::TILE_SIZE; c++) {
+            for (size_t r = 0; r < CellStorage::TILE_SIZE; r++) {
+                if ((valid[c] >> r) & 1) {
+                    visit(c * CellStorage::TILE_SIZE + r);
+                }
+            }
         }
-        cells.push_back(move(row));
     }
-}
 
-void Table::initializeCell(size_t row, size_t col) {
-    if (isValidPosition(row, col) && cells[row][col] == nullptr) {
-        cells[row][col] = CellFactory::createCell(MyString(""));
+    // Splits row,col,value of a CELL or ERROR record, data being past the tag
+    bool parseCellRecord(const char* data, const char* end, size_t& row, size_t& col, const char*& value) {
+        const char* cursor = data;
+        if (!LineReader::parseUnsigned(cursor, end, row) || cursor == end || *cursor != ',') {
+            return false;
+        }
+        cursor++;
+        if (!LineReader::parseUnsigned(cursor, end, col) || cursor == end || *cursor != ',') {
+            return false;
+        }
+        value = cursor + 1;
+        return true;
+    }
+
+    // A CSV field typed on a worker; its text points into the mapped file
+    struct CsvCell {
+        size_t row;         // counted from the first record of its chunk
+        size_t col;
+        CellKind kind;      // literal kind, FORMULA for fields starting with '=', or ERROR_VALUE
+        int intValue;
+        bool boolValue;
+        double doubleValue;
+        CellError error;
+        bool escaped;       // still holds doubled quotes, typed once they are undone
+        const char* text;
+        size_t length;
+
+        CsvCell() : row(0), col(0), kind(CellKind::EMPTY), intValue(0), boolValue(false), doubleValue(0.0),
+            error(CellError::NONE), escaped(false), text(nullptr), length(0) {}
+    };
+
+    // The records starting in one fixed-size chunk of a CSV file
+    struct CsvChunk {
+        MyVector<CsvCell> cells;
+        size_t records = 0;
+        size_t columns = 0;
+        size_t quotes = 0;
+        bool startsQuoted = false;  // the chunk's first byte lies within a quoted field
+    };
+
+    // Types the content of a field with the rules of typed-in input, except
+    // that the texts of errors, as export writes them, read as those errors
+    void typeCsvField(const char* text, size_t length, CsvCell& cell) {
+        if (length > 1 && text[0] == '=') {
+            cell.kind = CellKind::FORMULA;
+            cell.text = text;
+            cell.length = length;
+            return;
+        }
+        if (length > 1 && text[0] == '#' && parseErrorText(text, length, cell.error)) {
+            cell.kind = CellKind::ERROR_VALUE;
+            return;
+        }
+        cell.kind = CellFactory::parseLiteral(text, length, cell.intValue, cell.boolValue, cell.doubleValue, cell.text, cell.length);
+    }
+
+    // Quotes around a field only protect its bytes; what they hold is typed
+    // like typed-in input, so "42" is a number and ""42"" quoted is a text
+    void parseCsvChunk(const char* data, const char* start, const char* chunkEnd, const char* end, char delimiter, CsvChunk& chunk) {
+        chunk.cells.clear();
+        chunk.records = 0;
+        chunk.columns = 0;
+
+        // A record belongs to the chunk it starts in, so a later chunk skips
+        // to the first line end at or after the byte before it
+        bool quoted = chunk.startsQuoted;
+        if (start > data) {
+            start--;
+            quoted = quoted != (*start == '"');
+        }
+        CsvScanner scanner(start, end, delimiter, quoted);
+        if (start != data && !scanner.skipRecord()) {
+            return;
+        }
+
+        while (scanner.getPosition() < chunkEnd) {
+            size_t col = 0;
+            bool last = false;
+            const char* field;
+            size_t length;
+            while (!last && scanner.next(field, length, last)) {
+                bool wasQuoted, hasEscapes;
+                CsvScanner::unquote(field, length, wasQuoted, hasEscapes);
+                if (length > 0) {
+                    CsvCell& cell = chunk.cells.emplace_back();
+                    cell.row = chunk.records;
+                    cell.col = col;
+                    if (hasEscapes) {
+                        cell.escaped = true;
+                        cell.text = field;
+                        cell.length = length;
+                    }
+                    else {
+                        typeCsvField(field, length, cell);
+                    }
+                }
+                col++;
+            }
+            if (col == 0) {
+                break;
+            }
+            chunk.records++;
+            if (col > chunk.columns) {
+                chunk.columns = col;
+            }
+        }
+    }
+
+    // Writes a text so that importing it gives the same text back: one that
+    // would read as another kind gets the quotes of a typed-in text, and the
+    // field is quoted for CSV when it holds a delimiter, quote or line end
+    void writeCsvText(BufferedWriter& file, const char* text, size_t length, char delimiter) {
+        CsvCell typed;
+        typeCsvField(text, length, typed);
+        bool marked = typed.kind != CellKind::STRING || typed.length != length;
+
+        bool quoted = marked;
+        for (size_t i = 0; i < length && !quoted; i++) {
+            quoted = text[i] == delimiter || text[i] == '"' || text[i] == '\n' || text[i] == '\r';
+        }
+
+        file.writeText(quoted ? (marked ? "\"\"\"" : "\"") : "");
+        const char* cursor = text;
+        const char* end = text + length;
+        while (cursor < end) {
+            const char* quote = quoted ? static_cast<const char*>(memchr(cursor, '"', end - cursor)) : nullptr;
+            const char* stop = quote != nullptr ? quote + 1 : end;
+            file.write(cursor, stop - cursor);
+            if (quote != nullptr) {
+                file.writeText("\"");
+            }
+            cursor = stop;
+        }
+        file.writeText(quoted ? (marked ? "\"\"\"" : "\"") : "");
     }
+
+    // A saved value stays on its line: backslashes, line feeds and carriage
+    // returns are written as \\, \n and \r, and with quotes set also quotes as \"
+    void writeSavedText(BufferedWriter& file, const char* text, size_t length, bool quotes) {
+        const char* start = text;
+        for (size_t i = 0; i < length; i++) {
+            const char* escape;
+            switch (text[i]) {
+            case '\\': escape = "\\\\"; break;
+            case '\n': escape = "\\n"; break;
+            case '\r': escape = "\\r"; break;
+            case '"': escape = quotes ? "\\\"" : nullptr; break;
+            default: escape = nullptr; break;
+            }
+            if (escape != nullptr) {
+                file.write(start, text + i - start);
+                file.writeText(escape);
+                start = text + i + 1;
+            }
+        }
+        file.write(start, text + length - start);
+    }
+
+    // Undoes writeSavedText; a backslash before any other character stays
+    MyString readSavedText(const char* value, size_t length) {
+        if (memchr(value, '\\', length) == nullptr) {
+            return MyString(value, length);
+        }
+
+        MyString text;
+        text.reserve(length);
+        for (size_t i = 0; i < length; i++) {
+            char c = value[i];
+            if (c == '\\' && i + 1 < length) {
+                switch (value[i + 1]) {
+                case '\\': c = '\\'; i++; break;
+                case '"': c = '"'; i++; break;
+                case 'n': c = '\n'; i++; break;
+                case 'r': c = '\r'; i++; break;
+                default: break;
+                }
+            }
+            text.append(c);
+        }
+        return text;
+    }
+
+    // Runs task(i) for every i in [0, count), on the workers when there are any
+    template<typename Task>
+    void runTasks(WorkStealingPool* pool, size_t count, Task& task) {
+        if (pool != nullptr) {
+            pool->parallelFor(count, 1, task);
+            return;
+        }
+        for (size_t i = 0; i < count; i++) {
+            task(i);
+        }
+    }
+}
+
+// Cells live in sparse tiles, so a new table allocates nothing up front
+Table::Table() : numRows(defRows), numCols(defCols), autoFit(true), visibleCellSymbols(7), recalculating(false) {
+}
+
+Table::Table(size_t rows, size_t cols) : numRows(rows), numCols(cols), autoFit(true), visibleCellSymbols(7), recalculating(false) {
+}
+
+Table::Table(size_t rows, size_t cols, bool autoFit, int visibleCellSymbols)
+    : numRows(rows), numCols(cols), autoFit(autoFit), visibleCellSymbols(visibleCellSymbols), recalculating(false) {
 }
 
 bool Table::isValidPosition(size_t row, size_t col) const {
@@ -58,35 +342,290 @@ void Table::setCell(size_t row, size_t col, const MyString& input) {
         return;
     }
 
-    // Check for circular reference BEFORE creating the cell
     if (input.length() > 1 && input.data()[0] == '=') {
-        size_t refLength = input.length() - 1;
-        char* refBuffer = new char[refLength + 1];
-        for (size_t i = 0; i < refLength; i++) {
-            refBuffer[i] = input.data()[i + 1];
-        }
-        refBuffer[refLength] = '\0';
-        MyString reference(refBuffer);
-        delete[] refBuffer;
+        MyString reference(input.data() + 1, input.length() - 1);
 
+        // Plain references are stored inline, no cell object is built. Cycles of
+        // any length are found by the dependency graph on the next recalculation.
         size_t targetRow, targetCol;
         if (CellFactory::parseCellReference(reference, targetRow, targetCol)) {
-            if (targetRow == row && targetCol == col) {
-                cells[row][col] = make_unique<ValueCell<MyString>>(MyString("#CIRCULAR!"));
-                return;
+            // The inline target holds 32-bit coordinates; anything past them is no cell at all
+            if (targetRow > UINT32_MAX || targetCol > UINT32_MAX) {
+                cells.setError(row, col, CellError::REF);
+            }
+            else {
+                cells.setReference(row, col, targetRow, targetCol);
             }
+            cellChanged(row, col);
+            return;
+        }
+
+        CellError error = CellError::NONE;
+        BaseCell* cell = CellFactory::createExpressionCell(input, this, &cells.getPool(), error);
+        if (cell == nullptr) {
+            cells.setError(row, col, error);
+        }
+        else {
+            cells.setObject(row, col, CellKind::FORMULA, cell);
+        }
+        cellChanged(row, col);
+        return;
+    }
+
+    // Literals are stored by value in the typed column strips
+    int intValue = 0;
+    bool boolValue = false;
+    double doubleValue = 0.0;
+    MyString stringValue;
+
+    CellKind kind = CellFactory::parseLiteral(input, intValue, boolValue, doubleValue, stringValue);
+    storeLiteral(row, col, kind, intValue, boolValue, doubleValue, stringValue);
+    cellChanged(row, col);
+}
+
+void Table::storeLiteral(size_t row, size_t col, CellKind kind, int intValue, bool boolValue, double doubleValue, const MyString& stringValue) {
+    switch (kind) {
+    case CellKind::INT:
+        cells.setInt(row, col, intValue);
+        break;
+    case CellKind::BOOL:
+        cells.setBool(row, col, boolValue);
+        break;
+    case CellKind::DOUBLE:
+        cells.setDouble(row, col, doubleValue);
+        break;
+    case CellKind::STRING:
+        cells.setString(row, col, stringValue);
+        break;
+    default:
+        cells.erase(row, col);
+        break;
+    }
+}
+
+// Every edit of a cell goes through here once the storage holds the new content
+void Table::cellChanged(size_t row, size_t col) {
+    aggregates.cellChanged(cells, row, col);
+    lookups.cellChanged(cells, row, col);
+    trackDependencies(row, col);
+}
+
+// Keeps the graph node of the cell in step with its content and queues its readers
+void Table::trackDependencies(size_t row, size_t col) {
+    // The ranges of the formula the cell held no longer read their columns
+    const DependencyNode* previous = dependencies.findNode(row, col);
+    if (previous != nullptr) {
+        aggregates.dropReader(previous->precedents);
+    }
+
+    CellValue value = cells.getValue(row, col);
+    if (value.kind != CellKind::REFERENCE && value.kind != CellKind::FORMULA) {
+        dependencies.removeNode(row, col);
+        dependencies.markChanged(row, col);
+        return;
+    }
+
+    MyVector<Precedent> precedents;
+    if (value.kind == CellKind::REFERENCE) {
+        Precedent target = { value.target.row, value.target.col, value.target.row, value.target.col };
+        precedents.push_back(target);
+    }
+    else {
+        const FormulaCell* formula = static_cast<const FormulaCell*>(cells.getObject(row, col));
+        for (const ProgramRange& range : formula->getProgram().getRanges()) {
+            // Ranges are clipped to the table like the formula itself does
+            size_t endRow = range.endRow < numRows ? range.endRow : numRows - 1;
+            size_t endCol = range.endCol < numCols ? range.endCol : numCols - 1;
+            if (numRows > 0 && numCols > 0 && range.startRow <= endRow && range.startCol <= endCol) {
+                Precedent precedent = { range.startRow, range.startCol, endRow, endCol };
+                precedents.push_back(precedent);
+                if (range.search != MatchMode::NONE) {
+                    lookups.noteLookup(range.startCol, range.startRow, endRow, range.search);
+                }
+            }
+        }
+    }
+
+    aggregates.noteReader(cells, numRows, precedents);
+    dependencies.setNode(row, col, precedents);
+    dependencies.markChanged(row, col);
+}
+
+// Loaded cells are all new, so every node is registered afresh
+void Table::rebuildDependencies() {
+    dependencies.clear();
+    aggregates.clear();
+    lookups.clear();
+    cells.forEachCell([&](size_t row, size_t col) {
+        CellKind kind = cells.getKind(row, col);
+        if (kind == CellKind::REFERENCE || kind == CellKind::FORMULA) {
+            trackDependencies(row, col);
+        }
+    });
+    dependencies.markAllDirty();
+}
+
+// Unregisters the nodes on rows or columns [first, last], whose cells leave the table
+void Table::dropNodes(bool alongRows, size_t first, size_t last) {
+    MyVector<uint64_t> leaving;
+    dependencies.forEachNode([&](const DependencyNode& node) {
+        size_t line = alongRows ? node.row : node.col;
+        if (line >= first && line <= last) {
+            leaving.push_back(PositionMap<uint32_t>::makeKey(node.row, node.col));
+        }
+    });
+
+    for (uint64_t key : leaving) {
+        size_t row = PositionMap<uint32_t>::keyRow(key);
+        size_t col = PositionMap<uint32_t>::keyCol(key);
+        aggregates.dropReader(dependencies.findNode(row, col)->precedents);
+        dependencies.removeNode(row, col);
+    }
+}
 
-            BaseCell* targetCell = getCell(targetRow, targetCol);
-            if (targetCell && targetCell->getType() == MyString("ReferenceCell")) {
-                ReferenceCell* refCell = static_cast<ReferenceCell*>(targetCell);
-                if (refCell->getTargetRow() == row && refCell->getTargetCol() == col) {
-                    cells[row][col] = make_unique<ValueCell<MyString>>(MyString("#CIRCULAR!"));
+// Formulas keep their addresses across structural edits, so a node only needs
+// work if it reads a row or column from changedFrom on, whose content changed,
+// or if a range of its formula reaches past the smaller of the old and new
+// bound and is clipped differently now
+void Table::refreshNodes(bool alongRows, size_t changedFrom, size_t oldBound) {
+    size_t newBound = alongRows ? numRows : numCols;
+    size_t edge = oldBound < newBound ? oldBound : newBound;
+
+    MyVector<uint64_t> clipped;
+    MyVector<uint64_t> stale;
+    dependencies.forEachNode([&](const DependencyNode& node) {
+        uint64_t key = PositionMap<uint32_t>::makeKey(node.row, node.col);
+        if (cells.getKind(node.row, node.col) == CellKind::FORMULA) {
+            const FormulaCell* formula = static_cast<const FormulaCell*>(cells.getObject(node.row, node.col));
+            for (const ProgramRange& range : formula->getProgram().getRanges()) {
+                if ((alongRows ? range.endRow : range.endCol) >= edge) {
+                    clipped.push_back(key);
                     return;
                 }
             }
         }
+        for (const Precedent& precedent : node.precedents) {
+            if ((alongRows ? precedent.endRow : precedent.endCol) >= changedFrom) {
+                stale.push_back(key);
+                return;
+            }
+        }
+    });
+
+    for (uint64_t key : clipped) {
+        trackDependencies(PositionMap<uint32_t>::keyRow(key), PositionMap<uint32_t>::keyCol(key));
+    }
+    for (uint64_t key : stale) {
+        dependencies.markChanged(PositionMap<uint32_t>::keyRow(key), PositionMap<uint32_t>::keyCol(key));
+    }
+}
+
+// The cells from row or column index on moved by one and the bounds with
+// them; the nodes on a removed line are gone already
+void Table::linesMoved(size_t index, bool alongRows, bool inserted) {
+    if (alongRows) {
+        dependencies.moveRows(index, inserted);
+        aggregates.rowsChanged(cells, numRows, index);
+        lookups.invalidate(0);
+        refreshNodes(true, index, inserted ? numRows - 1 : numRows + 1);
+    }
+    else {
+        dependencies.moveColumns(index, inserted);
+        aggregates.columnsMoved(cells, numRows, index, inserted);
+        lookups.invalidate(index);
+        refreshNodes(false, index, inserted ? numCols - 1 : numCols + 1);
+    }
+}
+
+// Recomputes the stale nodes precedents first; formulas then read their inputs from the cache
+void Table::refreshCache() const {
+    if (recalculating || !dependencies.hasPendingChanges()) {
+        return;
+    }
+
+    recalculating = true;
+    lookups.prepare(cells, numRows);
+    MyVector<uint32_t> order;
+    MyVector<size_t> levels;
+    MyVector<uint32_t> cycles;
+    dependencies.takeDirtyNodes(order, levels, cycles);
+
+    // Cells on a cycle are settled first, the nodes reading them come in later levels
+    for (uint32_t id : cycles) {
+        DependencyNode& node = dependencies.getNode(id);
+        node.text.clear();
+        node.number = 0.0;
+        node.error = CellError::CIRCULAR;
+    }
+
+    for (size_t level = 0; level + 1 < levels.getSize(); level++) {
+        size_t first = levels[level];
+        size_t count = levels[level + 1] - first;
+
+        // Nodes of one level never read each other, so any interleaving gives the same results
+        if (recalculationPool && count >= parallelLevelSize) {
+            auto evaluate = [&](size_t i) { evaluateNode(order.atUnchecked(first + i)); };
+            recalculationPool->parallelFor(count, recalculationGrain, evaluate);
+        }
+        else {
+            for (size_t i = 0; i < count; i++) {
+                evaluateNode(order.atUnchecked(first + i));
+            }
+        }
     }
-    cells[row][col] = CellFactory::createCell(input, this);
+    recalculating = false;
+}
+
+// Only writes the node's own cache, so nodes of one level may run on different threads
+void Table::evaluateNode(uint32_t id) const {
+    DependencyNode& node = dependencies.getNode(id);
+    CellValue value = cells.getValue(node.row, node.col);
+
+    if (value.kind == CellKind::FORMULA) {
+        // One run of the program yields the number, the text and the error state
+        const FormulaCell* formula = static_cast<const FormulaCell*>(cells.getObject(node.row, node.col));
+        FormulaResult result = formula->calculate();
+        node.text = move(result.text);
+        node.number = result.number;
+        node.kind = result.kind;
+        node.error = result.error;
+        return;
+    }
+
+    // References pass their target's value or error on
+    node.error = getCellKind(value.target.row, value.target.col) == CellKind::EMPTY
+        ? CellError::REF
+        : getCellError(value.target.row, value.target.col);
+    if (node.error != CellError::NONE) {
+        node.text.clear();
+        node.number = 0.0;
+    }
+    else {
+        node.text = getCellText(value.target.row, value.target.col);
+        node.number = getCellNumber(value.target.row, value.target.col);
+        node.kind = getCellKind(value.target.row, value.target.col);
+        if (node.kind == CellKind::REFERENCE || node.kind == CellKind::FORMULA) {
+            const DependencyNode* target = getCachedResult(value.target.row, value.target.col);
+            node.kind = target != nullptr ? target->kind : CellKind::EMPTY;
+        }
+    }
+}
+
+void Table::recalculate() {
+    refreshCache();
+}
+
+void Table::setRecalculationThreads(size_t threadCount) {
+    if (threadCount <= 1) {
+        recalculationPool.reset();
+    }
+    else if (!recalculationPool || recalculationPool->getThreadCount() != threadCount) {
+        recalculationPool.reset(new WorkStealingPool(threadCount));
+    }
+}
+
+size_t Table::getRecalculationThreads() const {
+    return recalculationPool ? recalculationPool->getThreadCount() : 1;
 }
 
 BaseCell* Table::getCell(size_t row, size_t col) const {
@@ -94,7 +633,107 @@ BaseCell* Table::getCell(size_t row, size_t col) const {
         return nullptr;
     }
 
-    return cells[row][col].get();
+    return cells.getObject(row, col);
+}
+
+CellKind Table::getCellKind(size_t row, size_t col) const {
+    if (!isValidPosition(row, col)) {
+        return CellKind::EMPTY;
+    }
+
+    return cells.getKind(row, col);
+}
+
+MyString Table::getCellText(size_t row, size_t col) const {
+    if (!isValidPosition(row, col)) {
+        return MyString("");
+    }
+
+    CellValue value = cells.getValue(row, col);
+    switch (value.kind) {
+    case CellKind::INT:
+        return ValueCell<int>(value.intValue).toString();
+    case CellKind::BOOL:
+        return ValueCell<bool>(value.boolValue).toString();
+    case CellKind::DOUBLE:
+        return FormulaProgram::formatNumber(value.doubleValue, ResultFormat::DECIMAL);
+    case CellKind::STRING: {
+        const StringInterner& strings = cells.getStrings();
+        return MyString(strings.getText(value.stringId), strings.getLength(value.stringId));
+    }
+    case CellKind::REFERENCE:
+    case CellKind::FORMULA: {
+        const DependencyNode* node = getCachedResult(row, col);
+        if (node == nullptr) {
+            return MyString("");
+        }
+        return node->error != CellError::NONE ? MyString(getErrorText(node->error)) : node->text;
+    }
+    case CellKind::ERROR_VALUE:
+        return MyString(getErrorText(value.error));
+    default:
+        return MyString("");
+    }
+}
+
+double Table::getCellNumber(size_t row, size_t col) const {
+    if (!isValidPosition(row, col)) {
+        return 0.0;
+    }
+
+    CellValue value = cells.getValue(row, col);
+    switch (value.kind) {
+    case CellKind::INT:
+        return static_cast<double>(value.intValue);
+    case CellKind::BOOL:
+        return value.boolValue ? 1.0 : 0.0;
+    case CellKind::DOUBLE:
+        return value.doubleValue;
+    case CellKind::REFERENCE:
+    case CellKind::FORMULA: {
+        refreshCache();
+        const DependencyNode* node = dependencies.findNode(row, col);
+        return node != nullptr ? node->number : 0.0;
+    }
+    default:
+        return 0.0;
+    }
+}
+
+CellError Table::getCellError(size_t row, size_t col) const {
+    if (!isValidPosition(row, col)) {
+        return CellError::NONE;
+    }
+
+    CellValue value = cells.getValue(row, col);
+    switch (value.kind) {
+    case CellKind::ERROR_VALUE:
+        return value.error;
+    case CellKind::REFERENCE:
+    case CellKind::FORMULA: {
+        const DependencyNode* node = getCachedResult(row, col);
+        return node != nullptr ? node->error : CellError::NONE;
+    }
+    default:
+        return CellError::NONE;
+    }
+}
+
+const DependencyNode* Table::getCachedResult(size_t row, size_t col) const {
+    refreshCache();
+    return dependencies.findNode(row, col);
+}
+
+const RangeAggregateIndex& Table::getAggregateIndex() const {
+    return aggregates;
+}
+
+const LookupIndex& Table::getLookupIndex() const {
+    return lookups;
+}
+
+const CellStorage& Table::getStorage() const {
+    return cells;
 }
 
 size_t Table::getRowCount() const {
@@ -123,21 +762,11 @@ int Table::getVisibleCellSymbols() const {
 
 
 void Table::addRow() {
-    MyVector<unique_ptr<BaseCell>> newRow;
-    for (size_t col = 0; col < numCols; col++) {
-        unique_ptr<BaseCell> emptyCell = nullptr;
-        newRow.push_back(move(emptyCell));
-    }
-    cells.push_back(move(newRow));
-    numRows++;
+    resize(numRows + 1, numCols);
 }
 
 void Table::addColumn() {
-    for (size_t row = 0; row < numRows; row++) {
-        unique_ptr<BaseCell> emptyCell = nullptr;
-        cells[row].push_back(move(emptyCell));
-    }
-    numCols++;
+    resize(numRows, numCols + 1);
 }
 
 void Table::insertRow(size_t index) {
@@ -146,14 +775,9 @@ void Table::insertRow(size_t index) {
         return;
     }
 
-    MyVector<unique_ptr<BaseCell>> newRow;
-    for (size_t col = 0; col < numCols; col++) {
-        unique_ptr<BaseCell> emptyCell = nullptr;
-        newRow.push_back(move(emptyCell));
-    }
-
-    cells.insert(move(newRow), index);
+    cells.insertRow(index);
     numRows++;
+    linesMoved(index, true, true);
 }
 
 void Table::insertColumn(size_t index) {
@@ -162,11 +786,9 @@ void Table::insertColumn(size_t index) {
         return;
     }
 
-    for (size_t row = 0; row < numRows; row++) {
-        unique_ptr<BaseCell> emptyCell = nullptr;
-        cells[row].insert(move(emptyCell), index);
-    }
+    cells.insertColumn(index);
     numCols++;
+    linesMoved(index, false, true);
 }
 
 void Table::removeRow(size_t index) {
@@ -180,12 +802,10 @@ void Table::removeRow(size_t index) {
         return;
     }
 
-    for (size_t i = index; i < numRows - 1; i++) {
-        cells[i] = move(cells[i + 1]);
-    }
-
-    cells.pop_back();
+    dropNodes(true, index, index);
+    cells.removeRow(index);
     numRows--;
+    linesMoved(index, true, false);
 }
 
 void Table::removeColumn(size_t index) {
@@ -199,37 +819,53 @@ void Table::removeColumn(size_t index) {
         return;
     }
 
-    for (size_t row = 0; row < numRows; row++) {
-        for (size_t col = index; col < numCols - 1; col++) {
-            cells[row][col] = move(cells[row][col + 1]);
-        }
-        cells[row].pop_back();
-    }
+    dropNodes(false, index, index);
+    cells.removeColumn(index);
     numCols--;
+    linesMoved(index, false, false);
 }
 
 void Table::resize(size_t newRows, size_t newCols) {
-    if (newRows > numRows) {
-        while (numRows < newRows) {
-            addRow();
-        }
+    // Shrinking never goes below one row or column
+    if (newRows < numRows && newRows < 1) {
+        newRows = 1;
     }
-    else if (newRows < numRows) {
-        while (numRows > newRows && numRows > 1) {
-            removeRow(numRows - 1);
-        }
+    if (newCols < numCols && newCols < 1) {
+        newCols = 1;
     }
 
-    if (newCols > numCols) {
-        while (numCols < newCols) {
-            addColumn();
-        }
+    // Growing only moves the bounds; cells are allocated when written
+    size_t oldRows = numRows;
+    size_t oldCols = numCols;
+    if (newRows < oldRows) {
+        dropNodes(true, newRows, oldRows);
     }
-    else if (newCols < numCols) {
-        while (numCols > newCols && numCols > 1) {
-            removeColumn(numCols - 1);
-        }
+    if (newCols < oldCols) {
+        dropNodes(false, newCols, oldCols);
     }
+    if (newRows < oldRows || newCols < oldCols) {
+        cells.truncate(newRows, newCols);
+    }
+
+    numRows = newRows;
+    numCols = newCols;
+
+    // Nothing moved, so only the cells past the smaller bound differ
+    if (newRows != oldRows) {
+        size_t edge = newRows < oldRows ? newRows : oldRows;
+        aggregates.rowsChanged(cells, numRows, edge);
+        lookups.invalidate(0);
+        refreshNodes(true, edge, oldRows);
+    }
+    if (newCols != oldCols) {
+        size_t edge = newCols < oldCols ? newCols : oldCols;
+        lookups.invalidate(edge);
+        refreshNodes(false, edge, oldCols);
+    }
+}
+
+void Table::reserve(size_t rows, size_t cols) {
+    cells.reserve(rows, cols);
 }
 
 MyVector<size_t> Table::calculateColumnWidths() const {
@@ -269,8 +905,8 @@ MyVector<size_t> Table::calculateColumnWidths() const {
 
         for (size_t row = 0; row < numRows; row++) {
             MyString cellContent;
-            if (cells[row][col] != nullptr) {
-                cellContent = cells[row][col]->toString();
+            if (cells.getKind(row, col) != CellKind::EMPTY) {
+                cellContent = getCellText(row, col);
             }
             else {
                 cellContent = MyString(""); 
@@ -295,29 +931,22 @@ MyVector<size_t> Table::calculateColumnWidths() const {
 
 MyString Table::formatCellContent(const MyString& content, size_t width) const {
     size_t contentLength = content.length();
+    MyString result;
+    result.reserve(width);
 
     if (contentLength >= width) {
         if (width <= 3) {
-            MyString result;
             for (size_t i = 0; i < width; i++) {
-                result = result + MyString(".");
+                result.append('.');
             }
-            return result;
         }
         else {
-            MyString result;
-            for (size_t i = 0; i < width - 3; i++) {
-                char buffer[2];
-                buffer[0] = content.data()[i];
-                buffer[1] = '\0';
-                result = result + MyString(buffer);
-            }
-            result = result + MyString("...");
-            return result;
+            result.append(content.data(), width - 3);
+            result.append("...", 3);
         }
+        return result;
     }
 
-    MyString result = content;
     size_t spacesToAdd = width - contentLength;
 
     // Add spaces to center the content 
@@ -326,12 +955,14 @@ MyString Table::formatCellContent(const MyString& content, size_t width) const {
 
     // left padding
     for (size_t i = 0; i < leftSpaces; i++) {
-        result = MyString(" ") + result;
+        result.append(' ');
     }
 
+    result.append(content);
+
     // right padding
     for (size_t i = 0; i < rightSpaces; i++) {
-        result = result + MyString(" ");
+        result.append(' ');
     }
 
     return result;
@@ -353,8 +984,8 @@ void Table::display() const {
     MyString rowHeaderSpaces;
     MyString rowHeaderDashes;
     for (size_t i = 0; i < rowHeaderWidth; i++) {
-        rowHeaderSpaces = rowHeaderSpaces + MyString(" ");
-        rowHeaderDashes = rowHeaderDashes + MyString("-");
+        rowHeaderSpaces.append(' ');
+        rowHeaderDashes.append('-');
     }
 
     cout << rowHeaderSpaces << "|";
@@ -391,8 +1022,9 @@ void Table::display() const {
     cout << rowHeaderDashes << "|";
     for (size_t col = 0; col < numCols; col++) {
         MyString colSeparator;
+        colSeparator.reserve(columnWidths[col]);
         for (size_t i = 0; i < columnWidths[col]; i++) {
-            colSeparator = colSeparator + MyString("-");
+            colSeparator.append('-');
         }
         cout << colSeparator << "|";
     }
@@ -404,8 +1036,8 @@ void Table::display() const {
 
         for (size_t col = 0; col < numCols; col++) {
             MyString cellContent;
-            if (cells[row][col] != nullptr) {
-                cellContent = cells[row][col]->toString();
+            if (cells.getKind(row, col) != CellKind::EMPTY) {
+                cellContent = getCellText(row, col);
             }
             else {
                 cellContent = MyString(" ");
@@ -419,150 +1051,737 @@ void Table::display() const {
         cout << rowHeaderDashes << "|";
         for (size_t col = 0; col < numCols; col++) {
             MyString colSeparator;
+            colSeparator.reserve(columnWidths[col]);
             for (size_t i = 0; i < columnWidths[col]; i++) {
-                colSeparator = colSeparator + MyString("-");
+                colSeparator.append('-');
             }
             cout << colSeparator << "|";
         }
         cout << endl;
     }
 }
+void Table::displayMemoryStats() const {
+    const CellPool& pool = cells.getPool();
+
+    cout << "Cells: " << cells.getCellCount() << " in " << cells.getTileCount() << " tiles" << endl;
+    cout << "Formula cells: " << pool.getBlocksInUse(PoolClass::FORMULA_CELL)
+        << " (" << pool.getBytesInUse(PoolClass::FORMULA_CELL) << " bytes)" << endl;
+    cout << "Distinct strings: " << cells.getStrings().getCount()
+        << " (" << pool.getBytesInUse(PoolClass::STRING) << " bytes)" << endl;
+    cout << "Pool reserved: " << pool.getReservedBytes() << " bytes" << endl;
+    cout << "Range indexes: " << aggregates.getIndexedColumnCount() << " columns ("
+        << aggregates.getMemoryBytes() << " bytes)" << endl;
+    cout << "Lookup indexes: " << lookups.getIndexedColumnCount() << " columns ("
+        << lookups.getMemoryBytes() << " bytes)" << endl;
+    cout << "Aggregation kernels: " << AggregateKernels::getKernelName() << endl;
+}
+
 Table::~Table() {
     cout << "Table destructor starting..." << endl;
 
-    // Properly clear each row
-    for (size_t i = 0; i < cells.getSize(); i++) {
-        // Reset all unique_ptrs first
-        for (size_t j = 0; j < cells[i].getSize(); j++) {
-            cells[i][j].reset(); 
-        }
-    }
+    // Releases every allocated tile together with its cells
+    cells.clear();
 
     cout << "Table destructor ending..." << endl;
 }
 
-// Simple implementation of Table file operations
+// Cells are written in the form they are typed in, so a load gives back the
+// same kinds: strings quoted, references and formulas as their source. Nothing
+// is evaluated.
 bool Table::saveToFile(const MyString& filename) {
-    std::ofstream file(filename.data());
+    BufferedWriter file(filename.data());
 
-    if (!file.is_open()) {
+    if (!file.isOpen()) {
         cout << "ERROR: Could not create file: " << filename.data() << endl;
         return false;
     }
 
     // Write table dimensions
-    file << "ROWS:" << numRows << endl;
-    file << "COLS:" << numCols << endl;
-    file << "AUTOFIT:" << (autoFit ? "true" : "false") << endl;
-    file << "SYMBOLS:" << visibleCellSymbols << endl;
-
-    // Write each non-empty cell
-    for (size_t row = 0; row < numRows; row++) {
-        for (size_t col = 0; col < numCols; col++) {
-            if (cells[row][col] != nullptr) {
-                MyString cellValue = cells[row][col]->toString();
+    file.writeText("ROWS:");
+    file.writeInteger(static_cast<long long>(numRows));
+    file.writeText("\nCOLS:");
+    file.writeInteger(static_cast<long long>(numCols));
+    file.writeText(autoFit ? "\nAUTOFIT:true\nSYMBOLS:" : "\nAUTOFIT:false\nSYMBOLS:");
+    file.writeInteger(visibleCellSymbols);
+    file.writeText("\n");
+
+    // Write each non-empty cell, visiting only the allocated tiles
+    const StringInterner& strings = cells.getStrings();
+    cells.forEachCell([&](size_t row, size_t col) {
+        if (row >= numRows || col >= numCols) {
+            return;
+        }
 
-                // Format: CELL:row,col,value
-                file << "CELL:" << row << "," << col << "," << cellValue.data() << endl;
-            }
+        // Format: CELL:row,col,value or ERROR:row,col,text, with texts and
+        // formula sources escaped to stay on the line
+        CellValue value = cells.getValue(row, col);
+        file.writeText(value.kind == CellKind::ERROR_VALUE ? "ERROR:" : "CELL:");
+        file.writeInteger(static_cast<long long>(row));
+        file.writeText(",");
+        file.writeInteger(static_cast<long long>(col));
+        file.writeText(",");
+
+        switch (value.kind) {
+        case CellKind::INT:
+            file.writeInteger(value.intValue);
+            break;
+        case CellKind::BOOL:
+            file.writeText(value.boolValue ? "true" : "false");
+            break;
+        case CellKind::STRING:
+            file.writeText("\"");
+            writeSavedText(file, strings.getText(value.stringId), strings.getLength(value.stringId), true);
+            file.writeText("\"");
+            break;
+        case CellKind::REFERENCE: {
+            char column = static_cast<char>('A' + value.target.col);
+            file.writeText("=");
+            file.write(&column, 1);
+            file.writeInteger(static_cast<long long>(value.target.row) + 1);
+            break;
         }
-    }
+        case CellKind::FORMULA: {
+            const MyString& source = static_cast<const FormulaCell*>(cells.getObject(row, col))->getSource();
+            file.writeText("=");
+            writeSavedText(file, source.data(), source.length(), false);
+            break;
+        }
+        case CellKind::ERROR_VALUE:
+            file.writeText(getErrorText(value.error));
+            break;
+        case CellKind::DOUBLE: {
+            MyString text = FormulaProgram::formatExact(value.doubleValue);
+            file.write(text.data(), text.length());
+            break;
+        }
+        default: {
+            MyString text = getCellText(row, col);
+            file.write(text.data(), text.length());
+            break;
+        }
+        }
+        file.writeText("\n");
+    });
 
-    file.close();
+    if (!file.finish()) {
+        cout << "ERROR: Could not write file: " << filename.data() << endl;
+        return false;
+    }
     cout << "Table saved to " << filename.data() << endl;
     return true;
 }
 
 bool Table::loadFromFile(const MyString& filename) {
-    std::ifstream file(filename.data());
+    {
+        MappedFile mapped(filename.data());
+        bool isSnapshot = mapped.isOpen() && mapped.getSize() >= sizeof(snapshotMagic)
+            && memcmp(mapped.getData(), snapshotMagic, sizeof(snapshotMagic)) == 0;
+        // Large text files are parsed on the recalculation workers
+        bool parallel = !isSnapshot && recalculationPool && mapped.isOpen() && mapped.getSize() >= parallelLoadBytes;
+        if (isSnapshot || parallel) {
+            if (!(isSnapshot ? loadSnapshot(mapped) : loadMapped(mapped))) {
+                return false;
+            }
+            cout << "Table loaded from " << filename.data() << endl;
+            return true;
+        }
+    }
+
+    LineReader reader(filename.data());
 
-    if (!file.is_open()) {
+    if (!reader.isOpen()) {
         cout << "ERROR: Could not open file: " << filename.data() << endl;
         return false;
     }
 
-    size_t newRows = 5, newCols = 5;  // defaults
-    bool newAutoFit = true;
-    int newSymbols = 10;
+    // One pass: the header records come first, as saveToFile writes them, and
+    // the table is set up when the first cell record arrives
+    FileHeader header;
+    bool started = false;
+    char* line;
+    size_t length;
+    while (reader.next(line, length)) {
+        FileRecord record = classifyRecord(line, length);
+        if (record != FileRecord::CELL && record != FileRecord::CELL_ERROR) {
+            readHeader(record, line, length, header);
+            continue;
+        }
 
-    char line[1000];
-    while (file.getline(line, 1000)) {
-        if (stringContains(line, "ROWS:")) {
-            newRows = stringToInt(line + 5);
+        if (!started) {
+            if (!startLoading(header.rows, header.cols, header.autoFit, header.symbols)) {
+                return false;
+            }
+            started = true;
         }
-        else if (stringContains(line, "COLS:")) {
-            newCols = stringToInt(line + 5);
+        loadCellRecord(line + (record == FileRecord::CELL_ERROR ? 6 : 5), line + length, record == FileRecord::CELL_ERROR);
+    }
+
+    if (!started && !startLoading(header.rows, header.cols, header.autoFit, header.symbols)) {
+        return false;
+    }
+
+    cout << "Table loaded from " << filename.data() << endl;
+    return true;
+}
+
+// Same records as the stream: the header is read on this thread, then the
+// cell records are cut into chunks at line ends. A batch of chunks at a time
+// is parsed in parallel, each into its own buffer, and the buffers are merged
+// in file order, so a later record still wins.
+bool Table::loadMapped(const MappedFile& file) {
+    const char* cursor = file.getData();
+    const char* end = cursor + file.getSize();
+
+    FileHeader header;
+    while (cursor < end) {
+        const char* newline = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+        const char* lineEnd = newline != nullptr ? newline : end;
+        size_t length = lineEnd - cursor;
+        if (length > 0 && cursor[length - 1] == '\r') {
+            length--;
         }
-        else if (stringContains(line, "AUTOFIT:")) {
-            newAutoFit = stringContains(line, "true");
+
+        FileRecord record = classifyRecord(cursor, length);
+        if (record == FileRecord::CELL || record == FileRecord::CELL_ERROR) {
+            break;
+        }
+        readHeader(record, cursor, length, header);
+        cursor = newline != nullptr ? newline + 1 : end;
+    }
+
+    if (!startLoading(header.rows, header.cols, header.autoFit, header.symbols)) {
+        return false;
+    }
+
+    size_t bytes = end - cursor;
+    size_t chunkCount = bytes / loadChunkBytes + 1;
+    MyVector<const char*> bounds;
+    bounds.reserve(chunkCount + 1);
+    bounds.push_back(cursor);
+    for (size_t i = 1; i < chunkCount; i++) {
+        const char* split = cursor + bytes / chunkCount * i;
+        if (split < bounds[i - 1]) {
+            split = bounds[i - 1];
         }
-        else if (stringContains(line, "SYMBOLS:")) {
-            newSymbols = stringToInt(line + 8);
+        const char* newline = static_cast<const char*>(memchr(split, '\n', end - split));
+        bounds.push_back(newline != nullptr ? newline + 1 : end);
+    }
+    bounds.push_back(end);
+
+    size_t batchSize = recalculationPool->getThreadCount() * loadChunksPerThread;
+    MyVector<MyVector<LoadedCell>> parsed;
+    parsed.resize(batchSize);
+
+    for (size_t first = 0; first < chunkCount; first += batchSize) {
+        size_t count = chunkCount - first < batchSize ? chunkCount - first : batchSize;
+        auto parse = [&](size_t i) {
+            parsed[i].clear();
+            parseLoadChunk(bounds[first + i], bounds[first + i + 1], parsed[i]);
+        };
+        recalculationPool->parallelFor(count, 1, parse);
+
+        for (size_t i = 0; i < count; i++) {
+            for (size_t j = 0; j < parsed[i].getSize(); j++) {
+                const LoadedCell& cell = parsed[i].atUnchecked(j);
+                if (cell.kind == CellKind::FORMULA) {
+                    setCell(cell.row, cell.col, cell.text);
+                    continue;
+                }
+                if (cell.kind == CellKind::ERROR_VALUE) {
+                    cells.setError(cell.row, cell.col, cell.error);
+                }
+                else {
+                    storeLiteral(cell.row, cell.col, cell.kind, cell.intValue, cell.boolValue, cell.doubleValue, cell.text);
+                }
+                cellChanged(cell.row, cell.col);
+            }
+        }
+    }
+    return true;
+}
+
+// Runs on a worker: only reads the bounds and parses, the table is left untouched
+void Table::parseLoadChunk(const char* start, const char* end, MyVector<LoadedCell>& parsed) const {
+    const char* cursor = start;
+    while (cursor < end) {
+        const char* newline = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+        const char* lineEnd = newline != nullptr ? newline : end;
+        const char* line = cursor;
+        cursor = newline != nullptr ? newline + 1 : end;
+
+        if (lineEnd > line && lineEnd[-1] == '\r') {
+            lineEnd--;
+        }
+        FileRecord record = classifyRecord(line, lineEnd - line);
+        if (record != FileRecord::CELL && record != FileRecord::CELL_ERROR) {
+            continue;
+        }
+
+        size_t row, col;
+        const char* value;
+        if (!parseCellRecord(line + (record == FileRecord::CELL_ERROR ? 6 : 5), lineEnd, row, col, value) ||
+            row >= numRows || col >= numCols) {
+            continue;
+        }
+
+        LoadedCell& cell = parsed.emplace_back();
+        cell.row = row;
+        cell.col = col;
+        size_t valueLength = lineEnd - value;
+        if (record == FileRecord::CELL_ERROR && parseErrorText(value, valueLength, cell.error)) {
+            cell.kind = CellKind::ERROR_VALUE;
+        }
+        else if (valueLength > 1 && value[0] == '=') {
+            cell.kind = CellKind::FORMULA;
+            cell.text = readSavedText(value, valueLength);
+        }
+        else {
+            cell.kind = CellFactory::parseLiteral(readSavedText(value, valueLength), cell.intValue, cell.boolValue, cell.doubleValue, cell.text);
+        }
+    }
+}
+
+bool Table::saveSnapshot(const MyString& filename) {
+    BufferedWriter out(filename.data());
+    if (!out.isOpen()) {
+        cout << "ERROR: Could not create file: " << filename.data() << endl;
+        return false;
+    }
+
+    MyVector<CellPayload> payload;
+    MyVector<CellKind> kinds;
+    payload.resize(blockCells);
+    kinds.resize(blockCells);
+    uint64_t valid[CellStorage::TILE_SIZE];
+
+    // Copies a block with its formulas left out; false when nothing else remains
+    auto readBlock = [&](size_t firstRow, size_t firstCol) {
+        if (!cells.copyBlock(firstRow, firstCol, &payload[0], &kinds[0], valid)) {
+            return false;
+        }
+        bool any = false;
+        for (size_t c = 0; c < CellStorage::TILE_SIZE; c++) {
+            for (size_t r = 0; r < CellStorage::TILE_SIZE; r++) {
+                size_t slot = c * CellStorage::TILE_SIZE + r;
+                if (((valid[c] >> r) & 1) && kinds[slot] == CellKind::FORMULA) {
+                    valid[c] &= ~(1ULL << r);
+                    kinds[slot] = CellKind::EMPTY;
+                    payload[slot].handle = 0;
+                }
+            }
+            any = any || valid[c] != 0;
+        }
+        return any;
+    };
+
+    // First pass: the blocks written and the texts they use, numbered in order of first use
+    MyVector<uint32_t> textIndex;   // by interned id, 0 when unused, else heap index + 1
+    MyVector<uint32_t> textIds;     // interned ids in heap order
+    textIndex.resize(cells.getStrings().getIdBound());
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    for (size_t firstRow = 0; firstRow < numRows; firstRow += CellStorage::TILE_SIZE) {
+        for (size_t firstCol = 0; firstCol < numCols; firstCol += CellStorage::TILE_SIZE) {
+            if (!readBlock(firstRow, firstCol)) {
+                continue;
+            }
+            header.blockCount++;
+            forEachSlot(valid, [&](size_t slot) {
+                if (kinds[slot] != CellKind::STRING) {
+                    return;
+                }
+                uint32_t id = static_cast<uint32_t>(payload[slot].handle);
+                if (textIndex[id] == 0) {
+                    textIds.push_back(id);
+                    textIndex[id] = static_cast<uint32_t>(textIds.getSize());
+                    header.textBytes += cells.getStrings().getLength(id);
+                }
+            });
         }
     }
 
-    file.close();
+    MyVector<size_t> formulaRows, formulaCols;
+    cells.forEachCell([&](size_t row, size_t col) {
+        if (row < numRows && col < numCols && cells.getKind(row, col) == CellKind::FORMULA) {
+            formulaRows.push_back(row);
+            formulaCols.push_back(col);
+        }
+    });
+
+    memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    header.version = snapshotVersion;
+    header.byteOrder = snapshotByteOrder;
+    header.tileSize = static_cast<uint32_t>(CellStorage::TILE_SIZE);
+    header.payloadSize = static_cast<uint32_t>(sizeof(CellPayload));
+    header.rows = numRows;
+    header.cols = numCols;
+    header.autoFit = autoFit ? 1 : 0;
+    header.symbols = visibleCellSymbols;
+    header.textCount = textIds.getSize();
+    header.formulaCount = formulaRows.getSize();
+    out.writeValue(header);
+
+    uint64_t offset = 0;
+    out.writeValue(offset);
+    for (uint32_t id : textIds) {
+        offset += cells.getStrings().getLength(id);
+        out.writeValue(offset);
+    }
+    for (uint32_t id : textIds) {
+        out.write(cells.getStrings().getText(id), cells.getStrings().getLength(id));
+    }
+    out.align(8);
 
-    // Resize table
-    if (newRows > 0 && newCols > 0) {
-        resize(newRows, newCols);
-        autoFit = newAutoFit;
-        visibleCellSymbols = newSymbols;
+    // Second pass writes the same blocks, strings renumbered to heap indexes
+    for (size_t firstRow = 0; firstRow < numRows; firstRow += CellStorage::TILE_SIZE) {
+        for (size_t firstCol = 0; firstCol < numCols; firstCol += CellStorage::TILE_SIZE) {
+            if (!readBlock(firstRow, firstCol)) {
+                continue;
+            }
+            forEachSlot(valid, [&](size_t slot) {
+                if (kinds[slot] == CellKind::STRING) {
+                    payload[slot].handle = textIndex[static_cast<uint32_t>(payload[slot].handle)] - 1;
+                }
+            });
+            out.writeValue(static_cast<uint64_t>(firstRow));
+            out.writeValue(static_cast<uint64_t>(firstCol));
+            out.write(valid, sizeof(valid));
+            for (size_t c = 0; c < CellStorage::TILE_SIZE; c++) {
+                if (valid[c] != 0) {
+                    out.write(&payload[c * CellStorage::TILE_SIZE], sizeof(CellPayload) * CellStorage::TILE_SIZE);
+                }
+            }
+            for (size_t c = 0; c < CellStorage::TILE_SIZE; c++) {
+                if (valid[c] != 0) {
+                    out.write(&kinds[c * CellStorage::TILE_SIZE], sizeof(CellKind) * CellStorage::TILE_SIZE);
+                }
+            }
+        }
+    }
 
-        // Load cells in second pass
-        return loadCellsFromFile(filename);
+    for (size_t i = 0; i < formulaRows.getSize(); i++) {
+        const FormulaCell* formula = static_cast<const FormulaCell*>(cells.getObject(formulaRows[i], formulaCols[i]));
+        out.writeValue(static_cast<uint64_t>(formulaRows[i]));
+        out.writeValue(static_cast<uint64_t>(formulaCols[i]));
+        formula->getProgram().writeTo(out);
+        out.writeValue(static_cast<uint64_t>(formula->getSource().length()));
+        out.write(formula->getSource().data(), formula->getSource().length());
     }
 
-    return false;
+    if (!out.finish()) {
+        cout << "ERROR: Could not write file: " << filename.data() << endl;
+        return false;
+    }
+    cout << "Table saved to " << filename.data() << endl;
+    return true;
 }
 
-bool Table::loadCellsFromFile(const MyString& filename) {
-    std::ifstream file(filename.data());
-    if (!file.is_open()) return false;
+// The blocks go into the tiles with one copy each, only strings are renumbered;
+// the formula programs are read back without parsing
+bool Table::loadSnapshot(const MappedFile& file) {
+    MemoryReader in(file.getData(), file.getSize());
+    SnapshotHeader header;
+    if (!in.readValue(header) || header.version != snapshotVersion || header.byteOrder != snapshotByteOrder
+        || header.tileSize != CellStorage::TILE_SIZE || header.payloadSize != sizeof(CellPayload)) {
+        cout << "ERROR: Unsupported snapshot version" << endl;
+        return false;
+    }
+    size_t rows = static_cast<size_t>(header.rows);
+    size_t cols = static_cast<size_t>(header.cols);
+    if (!startLoading(rows, cols, header.autoFit != 0, header.symbols)) {
+        return false;
+    }
 
-    char line[1000];
-    while (file.getline(line, 1000)) {
-        if (stringContains(line, "CELL:")) {
-            // Parse: CELL:row,col,value
-            // Simple manual parsing
-            char* data = line + 5; // Skip "CELL:"
+    auto readCells = [&]() {
+        if (header.textCount >= in.getRemaining() / sizeof(uint64_t)) {
+            return false;
+        }
+        const uint64_t* offsets = reinterpret_cast<const uint64_t*>(in.take(sizeof(uint64_t) * (header.textCount + 1)));
+        const char* bytes = in.take(static_cast<size_t>(header.textBytes));
+        in.align(file.getData(), 8);
+        if (in.hasFailed()) {
+            return false;
+        }
 
-            // Find first comma
-            int comma1 = -1;
-            for (int i = 0; data[i]; i++) {
-                if (data[i] == ',') {
-                    comma1 = i;
-                    break;
+        MyVector<uint32_t> textIds;
+        textIds.reserve(static_cast<size_t>(header.textCount));
+        bool loaded = true;
+        for (size_t i = 0; i < header.textCount && loaded; i++) {
+            loaded = offsets[i] <= offsets[i + 1] && offsets[i + 1] <= header.textBytes;
+            if (loaded) {
+                textIds.push_back(cells.internText(bytes + offsets[i], static_cast<size_t>(offsets[i + 1] - offsets[i])));
+            }
+        }
+
+        size_t headBytes = (2 + CellStorage::TILE_SIZE) * sizeof(uint64_t);
+        size_t stripBytes = CellStorage::TILE_SIZE * (sizeof(CellPayload) + sizeof(CellKind));
+        for (size_t b = 0; b < header.blockCount && loaded; b++) {
+            const uint64_t* position = reinterpret_cast<const uint64_t*>(in.take(headBytes));
+            if (position == nullptr) {
+                loaded = false;
+                break;
+            }
+            const uint64_t* valid = position + 2;
+            size_t strips = 0;
+            for (size_t c = 0; c < CellStorage::TILE_SIZE; c++) {
+                strips += valid[c] != 0 ? 1 : 0;
+            }
+            const CellPayload* payload = reinterpret_cast<const CellPayload*>(in.take(strips * stripBytes));
+            if (payload == nullptr) {
+                loaded = false;
+                break;
+            }
+            const CellKind* kinds = reinterpret_cast<const CellKind*>(payload + strips * CellStorage::TILE_SIZE);
+            if (position[0] >= rows || position[1] >= cols) {
+                loaded = false;
+                break;
+            }
+
+            // Nothing may lie past the table's edge in its last blocks
+            size_t firstRow = static_cast<size_t>(position[0]);
+            size_t firstCol = static_cast<size_t>(position[1]);
+            size_t rowsInside = rows - firstRow;
+            uint64_t rowMask = rowsInside >= CellStorage::TILE_SIZE ? ~0ULL : (1ULL << rowsInside) - 1;
+            for (size_t c = 0; c < CellStorage::TILE_SIZE; c++) {
+                if ((valid[c] & ~rowMask) != 0 || (valid[c] != 0 && firstCol + c >= cols)) {
+                    loaded = false;
                 }
             }
-            if (comma1 == -1) continue;
+            loaded = loaded && cells.loadBlock(firstRow, firstCol, valid, payload, kinds, textIds);
+        }
+
+        // The cells hold their own references now
+        for (uint32_t id : textIds) {
+            cells.releaseText(id);
+        }
 
-            // Find second comma
-            int comma2 = -1;
-            for (int i = comma1 + 1; data[i]; i++) {
-                if (data[i] == ',') {
-                    comma2 = i;
+        for (size_t f = 0; f < header.formulaCount && loaded; f++) {
+            uint64_t row = 0, col = 0;
+            uint64_t sourceLength = 0;
+            FormulaProgram program;
+            if (!in.readValue(row) || !in.readValue(col) || row >= rows || col >= cols || !program.readFrom(in)
+                || !in.readValue(sourceLength) || sourceLength > in.getRemaining()) {
+                return false;
+            }
+            MyString source(in.take(static_cast<size_t>(sourceLength)), static_cast<size_t>(sourceLength));
+            FormulaCell* formula = cells.getPool().create<FormulaCell>(PoolClass::FORMULA_CELL, std::move(program), source);
+            formula->setTablePtr(this);
+            cells.setObject(static_cast<size_t>(row), static_cast<size_t>(col), CellKind::FORMULA, formula);
+        }
+        return loaded;
+    };
+
+    if (!readCells()) {
+        cout << "ERROR: Corrupt snapshot" << endl;
+        startLoading(rows, cols, autoFit, visibleCellSymbols);
+        return false;
+    }
+
+    rebuildDependencies();
+    return true;
+}
+
+// The file describes the whole table, so the old cells and their pool go at once
+bool Table::startLoading(size_t rows, size_t cols, bool newAutoFit, int newSymbols) {
+    if (rows == 0 || cols == 0) {
+        return false;
+    }
+
+    cells.clear();
+    dependencies.clear();
+    aggregates.clear();
+    lookups.clear();
+    reserve(rows, cols);
+    resize(rows, cols);
+    // Every loaded node is new anyway, so the cells need not be queued one by one
+    dependencies.markAllDirty();
+    autoFit = newAutoFit;
+    visibleCellSymbols = newSymbols;
+    return true;
+}
+
+// Malformed records are skipped
+void Table::loadCellRecord(const char* data, const char* end, bool isError) {
+    size_t row, col;
+    const char* value;
+    if (!parseCellRecord(data, end, row, col, value) || row >= numRows || col >= numCols) {
+        return;
+    }
+
+    CellError error;
+    size_t valueLength = static_cast<size_t>(end - value);
+    if (isError && parseErrorText(value, valueLength, error)) {
+        cells.setError(row, col, error);
+        cellChanged(row, col);
+    }
+    else {
+        setCell(row, col, readSavedText(value, valueLength));
+    }
+}
+
+// The file is read through a mapping in fixed-size chunks, a batch of chunks
+// at a time. The quotes of each chunk are counted first, which tells every
+// chunk whether it starts inside a quoted field; then the chunks are parsed
+// in parallel and merged in file order.
+bool Table::importCsv(const MyString& filename, char delimiter) {
+    MappedFile file(filename.data());
+    if (!file.isOpen()) {
+        // Only an empty file opens without a mapping
+        std::ifstream probe(filename.data());
+        if (!probe.is_open()) {
+            cout << "ERROR: Could not open file: " << filename.data() << endl;
+            return false;
+        }
+    }
+
+    if (!startLoading(1, 1, autoFit, visibleCellSymbols)) {
+        return false;
+    }
+
+    const char* data = file.getData();
+    size_t size = file.getSize();
+    size_t chunkCount = (size + loadChunkBytes - 1) / loadChunkBytes;
+    size_t batchSize = (recalculationPool ? recalculationPool->getThreadCount() : 1) * loadChunksPerThread;
+    MyVector<CsvChunk> chunks;
+    chunks.resize(batchSize);
+    MyVector<char> unescaped;
+
+    bool quoted = false;
+    size_t rows = 0;
+    for (size_t first = 0; first < chunkCount; first += batchSize) {
+        size_t count = chunkCount - first < batchSize ? chunkCount - first : batchSize;
+        auto chunkStart = [&](size_t i) {
+            return data + (first + i) * loadChunkBytes;
+        };
+        auto chunkEnd = [&](size_t i) {
+            return (first + i + 1) * loadChunkBytes < size ? chunkStart(i + 1) : data + size;
+        };
+
+        auto countQuotes = [&](size_t i) {
+            chunks[i].quotes = CsvScanner::countQuotes(chunkStart(i), chunkEnd(i));
+        };
+        runTasks(recalculationPool.get(), count, countQuotes);
+        for (size_t i = 0; i < count; i++) {
+            chunks[i].startsQuoted = quoted;
+            quoted = quoted != (chunks[i].quotes % 2 == 1);
+        }
+
+        auto parse = [&](size_t i) {
+            parseCsvChunk(data, chunkStart(i), chunkEnd(i), data + size, delimiter, chunks[i]);
+        };
+        runTasks(recalculationPool.get(), count, parse);
+
+        for (size_t i = 0; i < count; i++) {
+            const CsvChunk& chunk = chunks[i];
+            // The bounds grow as records arrive, so formulas can be set; their
+            // ranges are registered against the final bounds below
+            numRows = rows + chunk.records > numRows ? rows + chunk.records : numRows;
+            numCols = chunk.columns > numCols ? chunk.columns : numCols;
+
+            for (size_t j = 0; j < chunk.cells.getSize(); j++) {
+                CsvCell cell = chunk.cells.atUnchecked(j);
+                size_t row = rows + cell.row;
+                if (cell.escaped) {
+                    unescaped.resize(cell.length);
+                    typeCsvField(&unescaped[0], CsvScanner::unescape(cell.text, cell.length, &unescaped[0]), cell);
+                }
+                switch (cell.kind) {
+                case CellKind::FORMULA:
+                    setCell(row, cell.col, MyString(cell.text, cell.length));
+                    continue;
+                case CellKind::INT:
+                    cells.setInt(row, cell.col, cell.intValue);
+                    break;
+                case CellKind::BOOL:
+                    cells.setBool(row, cell.col, cell.boolValue);
+                    break;
+                case CellKind::DOUBLE:
+                    cells.setDouble(row, cell.col, cell.doubleValue);
+                    break;
+                case CellKind::STRING:
+                    cells.setString(row, cell.col, cell.text, cell.length);
+                    break;
+                case CellKind::ERROR_VALUE:
+                    cells.setError(row, cell.col, cell.error);
                     break;
+                default:
+                    continue;
                 }
+                cellChanged(row, cell.col);
             }
-            if (comma2 == -1) continue;
+            rows += chunk.records;
+        }
+    }
 
-            // Extract row, col, value
-            data[comma1] = '\0';
-            data[comma2] = '\0';
+    rebuildDependencies();
+    cout << "Table imported from " << filename.data() << endl;
+    return true;
+}
 
-            size_t row = stringToInt(data);
-            size_t col = stringToInt(data + comma1 + 1);
-            MyString value(data + comma2 + 1);
+// Written a row at a time, with the values the cells show: texts quoted,
+// formulas and references by their results
+bool Table::exportCsv(const MyString& filename, char delimiter) const {
+    BufferedWriter file(filename.data());
+    if (!file.isOpen()) {
+        cout << "ERROR: Could not create file: " << filename.data() << endl;
+        return false;
+    }
+
+    refreshCache();
+    const StringInterner& strings = cells.getStrings();
+    for (size_t row = 0; row < numRows; row++) {
+        for (size_t col = 0; col < numCols; col++) {
+            if (col > 0) {
+                file.write(&delimiter, 1);
+            }
 
-            // Set the cell
-            if (row < numRows && col < numCols) {
-                setCell(row, col, value);
+            CellValue value = cells.getValue(row, col);
+            switch (value.kind) {
+            case CellKind::INT:
+                file.writeInteger(value.intValue);
+                break;
+            case CellKind::BOOL:
+                file.writeText(value.boolValue ? "true" : "false");
+                break;
+            case CellKind::STRING:
+                writeCsvText(file, strings.getText(value.stringId), strings.getLength(value.stringId), delimiter);
+                break;
+            case CellKind::REFERENCE:
+            case CellKind::FORMULA: {
+                const DependencyNode* node = dependencies.findNode(row, col);
+                if (node == nullptr) {
+                    break;
+                }
+                if (node->error != CellError::NONE) {
+                    file.writeText(getErrorText(node->error));
+                }
+                else if (node->kind == CellKind::STRING) {
+                    writeCsvText(file, node->text.data(), node->text.length(), delimiter);
+                }
+                else {
+                    file.write(node->text.data(), node->text.length());
+                }
+                break;
+            }
+            case CellKind::ERROR_VALUE:
+                file.writeText(getErrorText(value.error));
+                break;
+            case CellKind::DOUBLE: {
+                MyString text = FormulaProgram::formatExact(value.doubleValue);
+                file.write(text.data(), text.length());
+                break;
+            }
+            default:
+                break;
             }
         }
+        file.writeText("\n");
     }
 
-    file.close();
-    cout << "Table loaded from " << filename.data() << endl;
+    if (!file.finish()) {
+        cout << "ERROR: Could not write file: " << filename.data() << endl;
+        return false;
+    }
+    cout << "Table exported to " << filename.data() << endl;
     return true;
-}
\ No newline at end of file
+}
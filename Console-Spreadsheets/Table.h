@@ -6,21 +6,62 @@
 #include "MyVector.hpp"
 #include "BaseCell.h"
 #include "CellFactory.h"
+#include "CellStorage.h"
+#include "DependencyGraph.h"
+#include "LookupIndex.h"
+#include "RangeAggregateIndex.h"
+#include "WorkStealingPool.h"
 #include "MyString.h"
 
+class MappedFile; // Forward declaration
+
 class Table {
 private:
-    MyVector<MyVector<std::unique_ptr<BaseCell>>> cells;
+    // A cell record the parallel loader parsed on a worker
+    struct LoadedCell {
+        size_t row, col;
+        CellKind kind;      // literal kind, FORMULA for formulas and references, or ERROR_VALUE
+        int intValue;
+        bool boolValue;
+        double doubleValue;
+        CellError error;
+        MyString text;      // string literal or formula source
+
+        LoadedCell() : row(0), col(0), kind(CellKind::EMPTY), intValue(0), boolValue(false), doubleValue(0.0), error(CellError::NONE) {}
+    };
+
+    CellStorage cells;
     size_t numRows;
     size_t numCols;
     bool autoFit;
     int visibleCellSymbols;
+    // Formula and reference results are cached per node and recomputed only when stale
+    mutable DependencyGraph dependencies;
+    mutable bool recalculating;
+    // Segment trees over the columns long range formulas keep reading
+    RangeAggregateIndex aggregates;
+    // Hash and sorted indexes over the columns lookup functions search; built before a recalculation
+    mutable LookupIndex lookups;
+    // Workers for large recalculation levels; null runs everything on the calling thread
+    std::unique_ptr<WorkStealingPool> recalculationPool;
 
-    void initializeCell(size_t row, size_t col);
     bool isValidPosition(size_t row, size_t col) const;
     MyVector<size_t> calculateColumnWidths() const;
     MyString formatCellContent(const MyString& content, size_t width) const;
-    bool loadCellsFromFile(const MyString& filename);
+    void storeLiteral(size_t row, size_t col, CellKind kind, int intValue, bool boolValue, double doubleValue, const MyString& stringValue);
+    bool startLoading(size_t rows, size_t cols, bool newAutoFit, int newSymbols);
+    bool loadMapped(const MappedFile& file);
+    bool loadSnapshot(const MappedFile& file);
+    void parseLoadChunk(const char* start, const char* end, MyVector<LoadedCell>& parsed) const;
+    void loadCellRecord(const char* data, const char* end, bool isError);
+    void cellChanged(size_t row, size_t col);
+    void trackDependencies(size_t row, size_t col);
+    void rebuildDependencies();
+    void dropNodes(bool alongRows, size_t first, size_t last);
+    void refreshNodes(bool alongRows, size_t changedFrom, size_t oldBound);
+    void linesMoved(size_t index, bool alongRows, bool inserted);
+    void refreshCache() const;
+    void evaluateNode(uint32_t id) const;
 
 public:
     Table();
@@ -29,8 +70,26 @@ public:
     ~Table();
 
     void setCell(size_t row, size_t col, const MyString& input);
+
+    // Only references and formulas are backed by objects; literals return nullptr
     BaseCell* getCell(size_t row, size_t col) const;
 
+    CellKind getCellKind(size_t row, size_t col) const;
+    MyString getCellText(size_t row, size_t col) const;
+    double getCellNumber(size_t row, size_t col) const;
+    // Error the cell shows, NONE for values; a tag test, nothing is rendered
+    CellError getCellError(size_t row, size_t col) const;
+    // Cached result of a formula or reference cell, null for any other cell
+    const DependencyNode* getCachedResult(size_t row, size_t col) const;
+    // Recomputes every formula and reference affected by edits since the last call
+    void recalculate();
+    // Threads used for recalculation, the calling one included
+    void setRecalculationThreads(size_t threadCount);
+    size_t getRecalculationThreads() const;
+    const CellStorage& getStorage() const;
+    const RangeAggregateIndex& getAggregateIndex() const;
+    const LookupIndex& getLookupIndex() const;
+
     size_t getRowCount() const;
     size_t getColumnCount() const;
 
@@ -41,6 +100,8 @@ public:
     void removeRow(size_t index);
     void removeColumn(size_t index);
     void resize(size_t newRows, size_t newCols);
+    // Capacity hint only; the visible shape is unchanged
+    void reserve(size_t rows, size_t cols);
 
     void setAutoFit(bool autoFit);
     void setVisibleCellSymbols(int symbols);
@@ -48,7 +109,16 @@ public:
     int getVisibleCellSymbols() const;
 
     void display() const;
+    void displayMemoryStats() const;
 
     bool saveToFile(const MyString& filename);
+    // Versioned binary image of the cells and compiled formulas; loadFromFile
+    // recognizes it by its magic number and reads it without parsing
+    bool saveSnapshot(const MyString& filename);
     bool loadFromFile(const MyString& filename);
+    // Replaces the contents with the records of a CSV file, one row per record
+    // and as many columns as the longest; a tab delimiter reads TSV. Fields
+    // are typed like typed-in input, and error texts come back as errors.
+    bool importCsv(const MyString& filename, char delimiter);
+    bool exportCsv(const MyString& filename, char delimiter) const;
 };
\ No newline at end of file
@@ -4,10 +4,10 @@
 TableConfig::TableConfig()
     : initialTableRows(0), initialTableCols(0), maxTableRows(0), maxTableCols(0),
     autoFit(false), visibleCellSymbols(0), initialAlignment(Alignment::LEFT),
-    clearConsoleAfterCommand(false),
+    clearConsoleAfterCommand(false), recalculationThreads(1),
     hasInitialTableRows(false), hasInitialTableCols(false), hasMaxTableRows(false),
     hasMaxTableCols(false), hasAutoFit(false), hasVisibleCellSymbols(false),
-    hasInitialAlignment(false), hasClearConsoleAfterCommand(false) {
+    hasInitialAlignment(false), hasClearConsoleAfterCommand(false), hasRecalculationThreads(false) {
 }
 
 TableConfig::TableConfig(const TableConfig& other)
@@ -15,10 +15,12 @@ TableConfig::TableConfig(const TableConfig& other)
     maxTableRows(other.maxTableRows), maxTableCols(other.maxTableCols),
     autoFit(other.autoFit), visibleCellSymbols(other.visibleCellSymbols),
     initialAlignment(other.initialAlignment), clearConsoleAfterCommand(other.clearConsoleAfterCommand),
+    recalculationThreads(other.recalculationThreads),
     hasInitialTableRows(other.hasInitialTableRows), hasInitialTableCols(other.hasInitialTableCols),
     hasMaxTableRows(other.hasMaxTableRows), hasMaxTableCols(other.hasMaxTableCols),
     hasAutoFit(other.hasAutoFit), hasVisibleCellSymbols(other.hasVisibleCellSymbols),
-    hasInitialAlignment(other.hasInitialAlignment), hasClearConsoleAfterCommand(other.hasClearConsoleAfterCommand) {
+    hasInitialAlignment(other.hasInitialAlignment), hasClearConsoleAfterCommand(other.hasClearConsoleAfterCommand),
+    hasRecalculationThreads(other.hasRecalculationThreads) {
 }
 
 TableConfig& TableConfig::operator=(const TableConfig& other) {
@@ -31,6 +33,7 @@ TableConfig& TableConfig::operator=(const TableConfig& other) {
         visibleCellSymbols = other.visibleCellSymbols;
         initialAlignment = other.initialAlignment;
         clearConsoleAfterCommand = other.clearConsoleAfterCommand;
+        recalculationThreads = other.recalculationThreads;
         hasInitialTableRows = other.hasInitialTableRows;
         hasInitialTableCols = other.hasInitialTableCols;
         hasMaxTableRows = other.hasMaxTableRows;
@@ -39,6 +42,7 @@ TableConfig& TableConfig::operator=(const TableConfig& other) {
         hasVisibleCellSymbols = other.hasVisibleCellSymbols;
         hasInitialAlignment = other.hasInitialAlignment;
         hasClearConsoleAfterCommand = other.hasClearConsoleAfterCommand;
+        hasRecalculationThreads = other.hasRecalculationThreads;
     }
     return *this;
 }
@@ -128,7 +132,8 @@ bool TableConfig::isValidPropertyName(const MyString& propertyName) {
         propertyName == MyString("autoFit") ||
         propertyName == MyString("visibleCellSymbols") ||
         propertyName == MyString("initialAlignment") ||
-        propertyName == MyString("clearConsoleAfterCommand"));
+        propertyName == MyString("clearConsoleAfterCommand") ||
+        propertyName == MyString("recalculationThreads"));
 }
 
 bool TableConfig::validateAndSetProperty(const MyString& propertyName, const MyString& value) {
@@ -209,6 +214,15 @@ bool TableConfig::validateAndSetProperty(const MyString& propertyName, const MyS
         clearConsoleAfterCommand = val;
         hasClearConsoleAfterCommand = true;
     }
+    else if (propertyName == MyString("recalculationThreads")) {
+        int val;
+        if (!parsePositiveInteger(value, val)) {
+            printErrorAndExit(propertyName, value, MyString("Invalid value!"));
+            return false;
+        }
+        recalculationThreads = val;
+        hasRecalculationThreads = true;
+    }
 
     return true;
 }
@@ -277,6 +291,7 @@ void TableConfig::printErrorAndExit(const MyString& propertyName, const MyString
     exit(1);
 }
 
+// recalculationThreads is optional and not required here
 bool TableConfig::allPropertiesSet() const {
     return hasInitialTableRows && hasInitialTableCols && hasMaxTableRows &&
         hasMaxTableCols && hasAutoFit && hasVisibleCellSymbols &&
@@ -316,6 +331,10 @@ bool TableConfig::getClearConsoleAfterCommand() const {
     return clearConsoleAfterCommand;
 }
 
+int TableConfig::getRecalculationThreads() const {
+    return recalculationThreads;
+}
+
 void TableConfig::printConfig() const {
     cout << "Configuration loaded:" << ::endl;
     cout << "  initialTableRows: " << initialTableRows << ::endl;
@@ -332,6 +351,7 @@ void TableConfig::printConfig() const {
     }
     cout << ::endl;
     cout << "  clearConsoleAfterCommand: " << (clearConsoleAfterCommand ? "true" : "false") << ::endl;
+    cout << "  recalculationThreads: " << recalculationThreads << ::endl;
 }
 
 bool TableConfig::isValidConfig() const {
@@ -20,6 +20,7 @@ private:
     int visibleCellSymbols;
     Alignment initialAlignment;
     bool clearConsoleAfterCommand;
+    int recalculationThreads;   // optional, defaults to 1
 
     // Validation flags
     bool hasInitialTableRows;
@@ -30,6 +31,7 @@ private:
     bool hasVisibleCellSymbols;
     bool hasInitialAlignment;
     bool hasClearConsoleAfterCommand;
+    bool hasRecalculationThreads;
 
     // Helper methods
     bool parseProperty(const MyString& line);
@@ -58,6 +60,7 @@ public:
     int getVisibleCellSymbols() const;
     Alignment getInitialAlignment() const;
     bool getClearConsoleAfterCommand() const;
+    int getRecalculationThreads() const;
 
     // Utility methods
     void printConfig() const;
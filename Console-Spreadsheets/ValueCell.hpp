@@ -22,6 +22,10 @@ public:
         return MyString("unknown");
     }
 
+    CellKind getKind() const override {
+        return CellKind::EMPTY;
+    }
+
     BaseCell* clone() const override {
         return new ValueCell<T>(*this);
     }
@@ -65,6 +69,11 @@ inline MyString ValueCell<int>::getType() const {
     return MyString("int");
 }
 
+template<>
+inline CellKind ValueCell<int>::getKind() const {
+    return CellKind::INT;
+}
+
 template<>
 inline BaseCell* ValueCell<int>::clone() const {
     return new ValueCell<int>(*this);
@@ -86,6 +95,11 @@ inline MyString ValueCell<bool>::getType() const {
     return MyString("bool");
 }
 
+template<>
+inline CellKind ValueCell<bool>::getKind() const {
+    return CellKind::BOOL;
+}
+
 template<>
 inline BaseCell* ValueCell<bool>::clone() const {
     return new ValueCell<bool>(*this);
@@ -107,7 +121,37 @@ inline MyString ValueCell<MyString>::getType() const {
     return MyString("MyString");
 }
 
+template<>
+inline CellKind ValueCell<MyString>::getKind() const {
+    return CellKind::STRING;
+}
+
 template<>
 inline BaseCell* ValueCell<MyString>::clone() const {
     return new ValueCell<MyString>(*this);
 }
+
+// ---- SPECIALIZATION FOR double ----
+// Rendered like formula results, in CellFactory.cpp
+template<>
+MyString ValueCell<double>::toString() const;
+
+template<>
+inline double ValueCell<double>::evaluate() const {
+    return value;
+}
+
+template<>
+inline MyString ValueCell<double>::getType() const {
+    return MyString("double");
+}
+
+template<>
+inline CellKind ValueCell<double>::getKind() const {
+    return CellKind::DOUBLE;
+}
+
+template<>
+inline BaseCell* ValueCell<double>::clone() const {
+    return new ValueCell<double>(*this);
+}
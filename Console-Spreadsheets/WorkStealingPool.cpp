@@ -0,0 +1,133 @@
+#include "WorkStealingPool.h"
+
+static uint64_t packBounds(size_t front, size_t back) {
+    return (static_cast<uint64_t>(front) << 32) | static_cast<uint32_t>(back);
+}
+
+WorkStealingPool::WorkStealingPool(size_t threadCount)
+    : workerCount(threadCount > 0 ? threadCount : 1), generation(0), busyWorkers(0), stopping(false),
+    function(nullptr), context(nullptr) {
+    queues.reset(new WorkerQueue[workerCount]);
+    for (size_t i = 0; i < workerCount; i++) {
+        queues[i].bounds.store(0);
+    }
+
+    threads.reserve(workerCount - 1);
+    for (size_t i = 1; i < workerCount; i++) {
+        threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t WorkStealingPool::getThreadCount() const {
+    return workerCount;
+}
+
+bool WorkStealingPool::takeOwn(size_t worker, size_t& chunk) {
+    std::atomic<uint64_t>& bounds = queues[worker].bounds;
+    uint64_t current = bounds.load(std::memory_order_acquire);
+
+    while (true) {
+        size_t front = static_cast<size_t>(current >> 32);
+        size_t back = static_cast<size_t>(current & 0xFFFFFFFFu);
+        if (front >= back) {
+            return false;
+        }
+        if (bounds.compare_exchange_weak(current, packBounds(front + 1, back), std::memory_order_acq_rel)) {
+            chunk = front;
+            return true;
+        }
+    }
+}
+
+bool WorkStealingPool::steal(size_t worker, size_t& chunk) {
+    for (size_t offset = 1; offset < workerCount; offset++) {
+        std::atomic<uint64_t>& bounds = queues[(worker + offset) % workerCount].bounds;
+        uint64_t current = bounds.load(std::memory_order_acquire);
+
+        while (true) {
+            size_t front = static_cast<size_t>(current >> 32);
+            size_t back = static_cast<size_t>(current & 0xFFFFFFFFu);
+            if (front >= back) {
+                break;
+            }
+            if (bounds.compare_exchange_weak(current, packBounds(front, back - 1), std::memory_order_acq_rel)) {
+                chunk = back - 1;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Chunks are only ever taken, never added, so once every queue is empty the batch is done
+void WorkStealingPool::work(size_t worker) {
+    size_t chunk;
+    while (takeOwn(worker, chunk) || steal(worker, chunk)) {
+        function(context, chunk);
+    }
+}
+
+void WorkStealingPool::workerLoop(size_t worker) {
+    size_t seen = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+
+        work(worker);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0) {
+            done.notify_one();
+        }
+    }
+}
+
+void WorkStealingPool::run(size_t chunkCount, ChunkFunction function, void* context) {
+    if (workerCount == 1 || chunkCount == 1) {
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            function(context, chunk);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->function = function;
+        this->context = context;
+
+        // Contiguous shares keep neighbouring cells on the same worker
+        for (size_t i = 0; i < workerCount; i++) {
+            size_t front = chunkCount * i / workerCount;
+            size_t back = chunkCount * (i + 1) / workerCount;
+            queues[i].bounds.store(packBounds(front, back), std::memory_order_relaxed);
+        }
+
+        busyWorkers = workerCount - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]() { return busyWorkers == 0; });
+}
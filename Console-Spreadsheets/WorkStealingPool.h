@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "MyVector.hpp"
+
+// Fixed set of worker threads running one batch of chunks at a time. Each
+// worker starts on its own contiguous share of the chunks and, once that is
+// drained, steals from the far end of the other workers' shares.
+class WorkStealingPool {
+private:
+    // Remaining chunks of one worker packed as (front << 32) | back so the
+    // owner and the thieves can claim them with a single compare-and-swap
+    struct WorkerQueue {
+        std::atomic<uint64_t> bounds;
+        char padding[56];   // keeps each queue on its own cache line
+    };
+
+    typedef void (*ChunkFunction)(void* context, size_t chunk);
+
+    MyVector<std::thread> threads;
+    std::unique_ptr<WorkerQueue[]> queues;
+    size_t workerCount;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    size_t generation;
+    size_t busyWorkers;
+    bool stopping;
+
+    ChunkFunction function;
+    void* context;
+
+    bool takeOwn(size_t worker, size_t& chunk);
+    bool steal(size_t worker, size_t& chunk);
+    void work(size_t worker);
+    void workerLoop(size_t worker);
+    void run(size_t chunkCount, ChunkFunction function, void* context);
+
+public:
+    // The calling thread acts as one of the workers, so threadCount - 1 threads are started
+    explicit WorkStealingPool(size_t threadCount);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    size_t getThreadCount() const;
+
+    // Calls task(i) for every i in [0, count), grain consecutive indices per chunk,
+    // and returns once all of them have finished
+    template<typename Task>
+    void parallelFor(size_t count, size_t grain, Task& task);
+};
+
+template<typename Task>
+void WorkStealingPool::parallelFor(size_t count, size_t grain, Task& task) {
+    if (count == 0) {
+        return;
+    }
+    if (grain == 0) {
+        grain = 1;
+    }
+
+    struct Batch {
+        Task* task;
+        size_t count;
+        size_t grain;
+
+        static void runChunk(void* context, size_t chunk) {
+            Batch* batch = static_cast<Batch*>(context);
+            size_t first = chunk * batch->grain;
+            size_t last = first + batch->grain < batch->count ? first + batch->grain : batch->count;
+            for (size_t i = first; i < last; i++) {
+                (*batch->task)(i);
+            }
+        }
+    };
+
+    Batch batch = { &task, count, grain };
+    run((count + grain - 1) / grain, &Batch::runChunk, &batch);
+}